@@ -0,0 +1,545 @@
+// Benchmarks of the editor core, run without a terminal.
+//
+// Synthetic files of the given sizes are generated from a fixed seed, so the
+// numbers of two builds can be compared. Every benchmark drives an Editor the
+// way a key press would and times it; frames are composed into memory. The
+// results are printed as JSON.
+//
+// Frames drawn by a benchmark are reported with the cells they changed and
+// the heap allocations they made. An idle frame of a warmed-up editor must
+// not allocate at all; if one does, the run fails. So does a run where the
+// regular expressions disagree with a few known answers.
+//
+//   kj_bench [--sizes 10,1024] [--dir DIR] [--filter NAME] [--keep]
+//            [--output FILE]
+//
+// Sizes are in MiB. The files are written to DIR, by default the temporary
+// directory, and removed afterwards unless --keep is given.
+
+#include <algorithm> // count, min, sort
+#include <chrono>
+#include <cstdint> // uint64_t, SIZE_MAX
+#include <cstdio>  // fopen, fprintf, fwrite
+#include <cstdlib> // getenv, strtoull
+#include <functional>
+#include <iterator> // size
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Editor.hpp"
+#include "Regex.hpp"
+#include "Terminal.hpp"
+
+namespace {
+
+constexpr size_t screenRows{ 50 };
+constexpr size_t screenColumns{ 200 };
+constexpr uint64_t seed{ 0x6b696c6f6a6f756c };
+
+// Found on a few lines only, so a search has to go through the whole file
+constexpr std::string_view rareWord{ "quixotically" };
+constexpr size_t           rareEvery{ 50000 };
+
+struct Options
+{
+	std::vector<size_t> sizes{ 10, 1024 };
+	std::string         directory{};
+	std::string         filter{};
+	std::string         output{};
+	bool                keep{ false };
+};
+
+struct Result
+{
+	std::string         name{};
+	size_t              fileBytes{ 0 };
+	std::vector<double> samples{}; // nanoseconds
+	size_t              frameBytes{ 0 };
+	bool                draws{ false }; // the last three are of its frames
+	size_t              frameAllocations{ 0 }; // the most in one frame
+	size_t              changedCells{ 0 };
+	size_t              runs{ 0 };
+};
+
+struct Document
+{
+	std::string path{};
+	size_t      bytes{ 0 };
+	size_t      lines{ 0 };
+};
+
+// xorshift64*, the same sequence on every platform
+class Random
+{
+private:
+	uint64_t state{ seed };
+
+public:
+	uint64_t Next()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545f4914f6cdd1dULL;
+	}
+
+	size_t Below(size_t bound) { return static_cast<size_t>(Next() % bound); }
+};
+
+// Lines of up to 120 characters of words, indented with tabs now and then
+bool
+Generate(Document& document)
+{
+	static constexpr std::string_view words[] = {
+		"the",   "editor", "line",   "buffer", "render", "cursor", "screen",
+		"index", "piece",  "search", "tab",    "column", "file",   "undo",
+		"a",     "of",     "to",     "kilo",   "joule",  "return", "size_t",
+	};
+
+	FILE* file = std::fopen(document.path.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+
+	Random      random{};
+	std::string chunk{};
+	size_t      written = 0;
+	size_t      line = 0;
+	bool        ended = true; // the last byte written is a newline
+
+	document.lines = 0;
+	while (written < document.bytes) {
+		chunk.clear();
+		while (chunk.size() < (1 << 20)) {
+			size_t length = random.Below(121);
+			size_t start = chunk.size();
+
+			if (random.Below(8) == 0) {
+				chunk.append(random.Below(3) + 1, '\t');
+			}
+			if (line++ % rareEvery == rareEvery / 2) {
+				chunk.append(rareWord);
+			}
+			while (chunk.size() - start < length) {
+				chunk.append(words[random.Below(std::size(words))]);
+				chunk.push_back(' ');
+			}
+			chunk.push_back('\n');
+		}
+
+		size_t count = std::min(chunk.size(), document.bytes - written);
+		if (std::fwrite(chunk.data(), 1, count, file) != count) {
+			std::fclose(file);
+			return false;
+		}
+
+		document.lines += static_cast<size_t>(
+		  std::count(chunk.begin(), chunk.begin() + count, '\n'));
+		ended = chunk[count - 1] == '\n';
+		written += count;
+	}
+
+	// A cut last line still counts as one
+	if (!ended) {
+		document.lines++;
+	}
+
+	return std::fclose(file) == 0;
+}
+
+class Runner
+{
+private:
+	const Options&      options;
+	std::vector<Result> results{};
+	size_t              frameBytes{ 0 };
+	const Editor*       drawing{ nullptr }; // the last Headless one
+
+	std::unique_ptr<Editor> Headless()
+	{
+		auto editor = std::make_unique<Editor>();
+		drawing = editor.get();
+
+		editor->Init(nullptr);
+		editor->Resize(screenRows, screenColumns);
+		editor->SetOutput(
+		  [this](const std::string& frame) { frameBytes += frame.size(); });
+		return editor;
+	}
+
+	[[nodiscard]] bool Selected(std::string_view name) const
+	{
+		return options.filter.empty() ||
+		       name.find(options.filter) != std::string_view::npos;
+	}
+
+	// Runs `body` `iterations` times, `setup` before each run untimed. A
+	// body that `draws` ends with a frame, which is looked at as well.
+	void Measure(std::string_view             name,
+	             const Document&              document,
+	             size_t                       iterations,
+	             bool                         draws,
+	             const std::function<void()>& setup,
+	             const std::function<void()>& body)
+	{
+		if (!Selected(name)) {
+			return;
+		}
+
+		Result result{};
+		result.name = name;
+		result.fileBytes = document.bytes;
+		result.draws = draws;
+		frameBytes = 0;
+
+		for (size_t i = 0; i < iterations; i++) {
+			if (setup) {
+				setup();
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			body();
+			result.samples.push_back(
+			  std::chrono::duration<double, std::nano>(
+			    std::chrono::steady_clock::now() - start)
+			    .count());
+
+			if (draws) {
+				const FrameStats& frame = drawing->LastFrame();
+				result.frameAllocations =
+				  std::max(result.frameAllocations, frame.allocations);
+				result.changedCells += frame.changedCells;
+				result.runs += frame.runs;
+			}
+		}
+
+		result.frameBytes = iterations > 0 ? frameBytes / iterations : 0;
+		result.changedCells /= std::max(iterations, size_t{ 1 });
+		result.runs /= std::max(iterations, size_t{ 1 });
+		results.push_back(std::move(result));
+	}
+
+public:
+	explicit Runner(const Options& options) : options(options) {}
+
+	void Run(const Document& document)
+	{
+		// Big files get fewer runs of the benchmarks that scale with them
+		bool   big = document.bytes > (size_t{ 64 } << 20);
+		size_t loads = big ? 3 : 20;
+
+		std::unique_ptr<Editor> editor{};
+
+		Measure(
+		  "open_first_frame",
+		  document,
+		  loads,
+		  true,
+		  [&]() { editor = Headless(); },
+		  [&]() {
+			  editor->Open(document.path.c_str());
+			  editor->RefreshScreen();
+		  });
+
+		Measure(
+		  "open_full_index",
+		  document,
+		  loads,
+		  false,
+		  [&]() { editor = Headless(); },
+		  [&]() {
+			  editor->Open(document.path.c_str());
+			  editor->MoveTo(SIZE_MAX, 0);
+		  });
+
+		editor = Headless();
+		editor->Open(document.path.c_str());
+		editor->RefreshScreen();
+
+		Measure("refresh_idle", document, 1000, true, nullptr, [&]() {
+			editor->RefreshScreen();
+		});
+
+		Measure(
+		  "scroll_line_down",
+		  document,
+		  1000,
+		  true,
+		  nullptr,
+		  [&]() {
+			  editor->ProcessKey(Key::ArrowDown, 0);
+			  editor->RefreshScreen();
+		  });
+
+		Measure(
+		  "scroll_page_down",
+		  document,
+		  1000,
+		  true,
+		  nullptr,
+		  [&]() {
+			  editor->ProcessKey(Key::PageDown, 0);
+			  editor->RefreshScreen();
+		  });
+
+		// Typed a key at a time, as the prompt does, then confirmed
+		Measure(
+		  "search_incremental",
+		  document,
+		  big ? 2 : 10,
+		  false,
+		  [&]() { editor->MoveTo(0, 0); },
+		  [&]() {
+			  std::string query{};
+			  for (char c : rareWord) {
+				  query.push_back(c);
+				  editor->FindCallback(query.c_str(), c);
+			  }
+			  editor->FindCallback(query.c_str(), '\r');
+		  });
+
+		struct Place
+		{
+			const char* name;
+			size_t      row;
+		};
+		const Place places[] = {
+			{ "insert_newline_top", 0 },
+			{ "insert_newline_middle", document.lines / 2 },
+			{ "insert_newline_end", SIZE_MAX },
+		};
+
+		for (const Place& place : places) {
+			Measure(
+			  place.name,
+			  document,
+			  1000,
+			  false,
+			  [&]() { editor->MoveTo(place.row, 0); },
+			  [&]() { editor->InsertNewline(); });
+		}
+
+		Measure(
+		  "insert_newline_refresh",
+		  document,
+		  1000,
+		  true,
+		  [&]() { editor->MoveTo(document.lines / 2, 0); },
+		  [&]() {
+			  editor->InsertNewline();
+			  editor->RefreshScreen();
+		  });
+	}
+
+	// Whether the idle frames were drawn without allocating
+	[[nodiscard]] bool Check() const
+	{
+		bool passed = true;
+
+		for (const Result& result : results) {
+			if (result.name == "refresh_idle" && result.frameAllocations > 0) {
+				std::fprintf(stderr,
+				             "refresh_idle on %zu bytes: %zu allocations in a "
+				             "warmed-up frame\n",
+				             result.fileBytes,
+				             result.frameAllocations);
+				passed = false;
+			}
+		}
+		return passed;
+	}
+
+	void Print(FILE* out) const
+	{
+		std::fprintf(out, "{\n");
+		std::fprintf(out, "  \"version\": \"%s\",\n", KJ_VERSION);
+#if defined(__VERSION__)
+		std::fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+		std::fprintf(out,
+		             "  \"screen\": { \"rows\": %zu, \"columns\": %zu },\n",
+		             screenRows,
+		             screenColumns);
+		std::fprintf(out, "  \"results\": [");
+
+		for (size_t i = 0; i < results.size(); i++) {
+			std::vector<double> sorted = results[i].samples;
+			std::sort(sorted.begin(), sorted.end());
+
+			double total = 0;
+			for (double sample : sorted) {
+				total += sample;
+			}
+
+			auto at = [&sorted](double quantile) {
+				return sorted.empty()
+				         ? 0.0
+				         : sorted[static_cast<size_t>(
+				             quantile * static_cast<double>(sorted.size() - 1))];
+			};
+
+			std::fprintf(out, "%s\n    {\n", i > 0 ? "," : "");
+			std::fprintf(out, "      \"name\": \"%s\",\n", results[i].name.c_str());
+			std::fprintf(out, "      \"file_bytes\": %zu,\n", results[i].fileBytes);
+			std::fprintf(out, "      \"iterations\": %zu,\n", sorted.size());
+			std::fprintf(out, "      \"min_ns\": %.0f,\n", at(0));
+			std::fprintf(out, "      \"median_ns\": %.0f,\n", at(0.5));
+			std::fprintf(out, "      \"p99_ns\": %.0f,\n", at(0.99));
+			std::fprintf(out, "      \"max_ns\": %.0f,\n", at(1));
+			std::fprintf(out,
+			             "      \"mean_ns\": %.0f,\n",
+			             sorted.empty() ? 0.0 : total / sorted.size());
+			std::fprintf(
+			  out, "      \"frame_bytes\": %zu", results[i].frameBytes);
+			if (results[i].draws) {
+				std::fprintf(out,
+				             ",\n      \"frame_allocations_max\": %zu,\n"
+				             "      \"changed_cells\": %zu,\n"
+				             "      \"runs\": %zu",
+				             results[i].frameAllocations,
+				             results[i].changedCells,
+				             results[i].runs);
+			}
+			std::fprintf(out, "\n    }");
+		}
+
+		std::fprintf(out, "\n  ]\n}\n");
+	}
+};
+
+// Cases the lazily built DFA once got wrong, checked before timing anything
+bool
+CheckRegex()
+{
+	struct Case
+	{
+		const char* pattern;
+		const char* text;
+		bool        matches;
+	};
+	static constexpr Case cases[] = {
+		// Both anchors hold at the start of an empty line, in either order
+		{ "^$", "", true },
+		{ "$^", "", true },
+		{ "a*$^", "", true },
+		{ "\\d+.?a|$^", "", true },
+		{ "$^", "a", false },
+		{ "a$^", "a", false },
+	};
+
+	bool passed = true;
+
+	for (const Case& test : cases) {
+		Regex regex{};
+		regex.Compile(test.pattern);
+		regex.Scan(test.text);
+
+		bool matches = regex.Matches(test.text);
+		bool starts = regex.StartAfter(0) != Regex::npos;
+		if (matches != test.matches || starts != test.matches) {
+			std::fprintf(stderr,
+			             "regex %s on \"%s\": %s a match\n",
+			             test.pattern,
+			             test.text,
+			             matches ? "found" : "did not find");
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+bool
+Parse(int argc, char* argv[], Options& options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string_view argument = argv[i];
+		bool             hasValue = i + 1 < argc;
+
+		if (argument == "--sizes" && hasValue) {
+			options.sizes.clear();
+			for (const char* at = argv[++i]; *at != '\0';) {
+				char* end = nullptr;
+				options.sizes.push_back(std::strtoull(at, &end, 10));
+				if (end == at) {
+					return false;
+				}
+				at = *end == ',' ? end + 1 : end;
+			}
+		} else if (argument == "--dir" && hasValue) {
+			options.directory = argv[++i];
+		} else if (argument == "--filter" && hasValue) {
+			options.filter = argv[++i];
+		} else if (argument == "--output" && hasValue) {
+			options.output = argv[++i];
+		} else if (argument == "--keep") {
+			options.keep = true;
+		} else {
+			return false;
+		}
+	}
+
+	if (options.directory.empty()) {
+		const char* temporary = std::getenv("TMPDIR");
+		options.directory = temporary != nullptr ? temporary : "/tmp";
+	}
+	return true;
+}
+
+}
+
+int
+main(int argc, char* argv[])
+{
+	Options options{};
+	if (!Parse(argc, argv, options)) {
+		std::fprintf(stderr,
+		             "usage: %s [--sizes MiB,...] [--dir DIR] [--filter NAME] "
+		             "[--keep] [--output FILE]\n",
+		             argv[0]);
+		return 2;
+	}
+
+	if (!CheckRegex()) {
+		return 1;
+	}
+
+	Runner runner{ options };
+
+	for (size_t size : options.sizes) {
+		Document document{};
+		document.bytes = size << 20;
+		document.path =
+		  options.directory + "/kj_bench_" + std::to_string(size) + "M.txt";
+
+		std::fprintf(stderr, "generating %s\n", document.path.c_str());
+		if (!Generate(document)) {
+			std::fprintf(stderr, "could not write %s\n", document.path.c_str());
+			return 1;
+		}
+
+		std::fprintf(stderr, "running on %zu MiB\n", size);
+		runner.Run(document);
+
+		if (!options.keep) {
+			std::remove(document.path.c_str());
+		}
+	}
+
+	FILE* out = stdout;
+	if (!options.output.empty()) {
+		out = std::fopen(options.output.c_str(), "w");
+		if (out == nullptr) {
+			std::fprintf(stderr, "could not write %s\n", options.output.c_str());
+			return 1;
+		}
+	}
+
+	runner.Print(out);
+
+	if (out != stdout) {
+		std::fclose(out);
+	}
+	return runner.Check() ? 0 : 1;
+}
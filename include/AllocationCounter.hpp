@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef> // size_t
+
+// Counts heap allocations made by the calling thread.
+//
+// The global operator new is replaced to bump a thread-local counter, so the
+// difference between two readings on the UI thread is the number of
+// allocations done in between, unaffected by worker threads.
+//
+// Built into every binary that reads it, kj_bench included, so that a frame
+// can be checked to compose without allocating.
+class AllocationCounter
+{
+public:
+	static size_t Allocations();
+	static size_t Bytes();
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint32_t, uint64_t, UINT64_MAX
+#include <string_view>
+#include <vector>
+
+// Conversion between the columns of a line and the columns of its render.
+//
+// Plain ASCII takes one byte and one column per character, so a line is
+// described by the characters that do not: tabs, and runs of UTF-8
+// characters that all have the same length and width. For each of those the
+// list has where it is and which render column follows it. With that list a
+// column maps to its render column, and back, by a binary search instead of
+// a walk over the line. The list is built the first time a line is asked
+// about, skipping ASCII a vector at a time, and kept in a direct mapped
+// table keyed by TextBuffer line ids. Lines of plain ASCII have an empty
+// list, so moving about a long line costs the same either way.
+//
+// As with the RenderCache, an edited line has to be invalidated.
+class ColumnMap
+{
+private:
+	struct Stop
+	{
+		size_t   start{ 0 };    // first byte of the run
+		size_t   end{ 0 };      // byte after it
+		size_t   render{ 0 };   // render column after it
+		size_t   expanded{ 0 }; // spaces added for tabs up to its end
+		uint32_t width{ 0 };    // columns per character
+		uint8_t  length{ 0 };   // bytes per character, 0 for a tab
+	};
+
+	struct Entry
+	{
+		uint64_t          key{ UINT64_MAX };
+		std::vector<Stop> stops{};
+	};
+
+	std::vector<Entry> entries{};
+
+	const std::vector<Stop>& Stops(uint64_t key, std::string_view chars);
+	static void              Build(std::string_view chars, Entry& entry);
+
+	// Render column the run starts at
+	static size_t RenderStart(const Stop& stop)
+	{
+		size_t characters =
+		  stop.length == 0 ? 1 : (stop.end - stop.start) / stop.length;
+		return stop.render - characters * stop.width;
+	}
+
+public:
+	explicit ColumnMap(size_t lines);
+
+	// Render column of `column`, and the column shown at `render`: the
+	// character covering it, or the end of the line past its last one
+	size_t ToRender(uint64_t key, std::string_view chars, size_t column);
+	size_t ToColumn(uint64_t key, std::string_view chars, size_t render);
+	// Byte of the render where the character at `column` starts
+	size_t ToOffset(uint64_t key, std::string_view chars, size_t column);
+
+	// Where to start drawing the render to show it from column `render` on:
+	// returns the first render column at or after it that starts a cell, and
+	// its byte in `offset`. Tabs can be cut, wide characters cannot.
+	size_t VisibleFrom(uint64_t         key,
+	                   std::string_view chars,
+	                   size_t           render,
+	                   size_t&          offset);
+
+	void Invalidate(uint64_t key);
+	void Clear();
+};
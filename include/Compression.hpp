@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Compressed files, told apart by their first bytes.
+//
+// gzip goes through zlib and zstd through libzstd, each only if it was found
+// when building (KJ_HAVE_ZLIB, KJ_HAVE_ZSTD). Files of a format that was
+// left out are still recognized, so they are not shown as binary garbage.
+enum class Codec : uint8_t
+{
+	None,
+	Gzip,
+	Zstd,
+};
+
+namespace compression {
+// Format of `filename` by its magic bytes, None if it cannot be read
+Codec Detect(const char* filename);
+bool  Supported(Codec codec);
+const char* Name(Codec codec);
+
+// An unlinked file in $TMPDIR, or /var/tmp, which lives on disk where /tmp
+// may be memory. Returns -1 with errno set if none can be made.
+int TemporaryFile();
+
+// Compresses `in` from its start to its end into `out`. Returns -1 with
+// errno set if either cannot be read or written.
+int Compress(int in, int out, Codec codec);
+}
+
+// Decompresses a file on a thread of its own into a temporary file, as it
+// takes as long as the file is large and would hold up a worker of the pool.
+//
+// The temporary file grows as the input is read, a buffer at a time, so the
+// memory taken stays the same whatever the size of the file; what was written
+// can be mapped and read while the rest is still being decompressed. Progress
+// is published now and then, and on every publication `onProgress` runs.
+class Decompressor
+{
+private:
+	int    inputFd{ -1 };
+	int    outputFd{ -1 };
+	size_t inputSize{ 0 };
+	size_t limit{ 0 };
+
+	std::atomic<size_t> consumed{ 0 }; // of the input
+	std::atomic<size_t> produced{ 0 }; // written to the output
+	std::atomic<bool>   cancelled{ false };
+
+	std::mutex              mutex{};
+	std::condition_variable progress{};
+	bool                    done{ true };
+	int                     error{ 0 };
+	std::thread             worker{};
+
+	void Run(Codec codec, const std::function<void()>& onProgress);
+	// Writes `length` bytes of output; false once the output is unusable
+	bool Output(const char* data, size_t length);
+	void Publish(bool last, int failure, const std::function<void()>& onProgress);
+
+public:
+	Decompressor() = default;
+	~Decompressor();
+
+	Decompressor(const Decompressor&) = delete;
+	Decompressor& operator=(const Decompressor&) = delete;
+
+	// Starts decompressing `filename`, stopping with EFBIG after `limit`
+	// bytes of output. Returns -1 with errno set if it cannot be read or
+	// there is nowhere to put the output.
+	int  Start(const char*           filename,
+	           Codec                 codec,
+	           size_t                limit,
+	           std::function<void()> onProgress);
+	void Stop();
+
+	// The output, to be mapped; valid until Stop
+	[[nodiscard]] int    Fd() const { return outputFd; }
+	[[nodiscard]] size_t Bytes() const { return produced; }
+	// How far into the input it got, in percent
+	[[nodiscard]] size_t Progress() const;
+
+	[[nodiscard]] bool Done();
+	// errno of what ended the decompression early, 0 if nothing did
+	[[nodiscard]] int  Error();
+	// Waits until more than `bytes` were written, or it is done
+	void Wait(size_t bytes);
+};
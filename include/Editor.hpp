@@ -4,29 +4,27 @@
 #include <memory>
 #include <array>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <future>
+#include <utility> // move, pair
+#include <vector>
+
+#include "ColumnMap.hpp"
+#include "constants.hpp"
+#include "EventLoop.hpp"
+#include "FileWatcher.hpp"
+#include "Highlighter.hpp"
+#include "InputParser.hpp"
+#include "Journal.hpp"
+#include "RenderCache.hpp"
+#include "Screen.hpp"
+#include "Search.hpp"
+#include "TextBuffer.hpp"
+#include "UndoLog.hpp"
 
 class Terminal;
 
-class erow
-{
-public:
-	std::string chars{};
-	std::string render{};
-	std::string hl{};
-	erow() = default;
-	~erow() = default;
-};
-
-struct editorSyntax
-{
-	const char*  filetype;
-	const char** filematch;
-	const char** keywords;
-	const char*  singleline_comment_start;
-	int          flags;
-};
-
 class Editor
 {
 private:
@@ -38,10 +36,19 @@ private:
 	size_t columnOffset{ 0 };
 	size_t rowOffset{ 0 };
 
-	bool dirtyFlag{ false };
-	int  dirtyLevel{ 0 };
+	// Before the buffer, whose background work notifies it until the buffer
+	// is gone
+	Wakeup wakeup{}; // background work has something new to show
+
+	TextBuffer rows{};
 
-	std::vector<erow> rows{};
+	// Whether the buffer is modified follows from the position in the log
+	UndoLog history{ kilojoule::defaults::undoMemoryLimit };
+
+	// Rendered lines, built when DrawRows first shows them
+	mutable RenderCache renderCache{ kilojoule::defaults::renderCacheLines };
+	// Columns of the lines the cursor, the view and the matches were on
+	mutable ColumnMap columns{ kilojoule::defaults::renderCacheLines };
 
 	std::string filename{};
 
@@ -50,71 +57,169 @@ private:
 
 	std::string statusmsg{};
 	time_t      statusmsg_time{};
-
-	struct editorSyntax* syntax;
+	uint8_t     statusmsgColor{ 0 };
+
+	Screen     screen{};
+	FrameStats frameStats{};
+
+	std::function<void(const std::string&)> output{};
+
+	bool        showStats{ false }; // Instrumentation overlay, F12
+	std::string statsLine{};
+
+	EventLoop   events{};
+	bool        redraw{ false };
+	// SIGWINCH, the size is read again when the next frame is drawn
+	std::unique_ptr<SignalEvent> resizeSignal{};
+	bool                         resized{ false };
+	InputParser input{};
+	InputEvent  inputEvent{}; // reused, keeps the paste buffer around
+	int         escapeTimeout{ kilojoule::defaults::escapeTimeout };
+	size_t      keystrokes{ 0 }; // handled since the last frame
+
+	const editorSyntax* syntax{ nullptr };
+
+	// Line states are filled in as DrawRows reaches them
+	mutable Highlighter highlighter{};
+	mutable std::string highlight{}; // of the row being drawn
+
+	Search search{};
+	size_t findRow{ 0 }; // where the cursor was when Find started
+	size_t findColumn{ 0 };
+	bool   findRegex{ false };
+
+	// Matches of the row being drawn
+	mutable std::vector<std::pair<size_t, size_t>> matchSpans{};
+
+	FileWatcher watcher{};
+	std::string followed{};         // bytes read by the last check
+	bool        following{ false };
+	bool        followPending{ false }; // the file changed since the check
+	bool        followPartial{ false }; // the last line has no line break yet
+
+	void FollowFile();
+	void AppendFollowed(std::string_view text);
+
+	// Tells how decompressing ended, once it did
+	bool decompressing{ false };
+
+	// Compressed files are saved compressed again, on the thread pool
+	bool             recompress{ true };
+	std::future<int> pendingSave{}; // errno of compressing, 0 if it worked
+	std::string      pendingTarget{};
+	size_t           pendingWritten{ 0 };
+	size_t           pendingMark{ 0 }; // of the journal at the save
+
+	void FinishSave();
+
+	// Edits not saved yet, on disk in case the editor goes away. The journal
+	// is only made once there is an edit to put in it.
+	Journal       journal{};
+	std::string   journalPath{}; // empty for no journal
+	Journal::Base journalBase{};
+	size_t        journalKept{ 0 }; // bytes of it that were replayed
+	bool          journalFailed{ false };
+
+	bool StartJournal();
+	void LogEdit(const UndoLog::Operation& operation,
+	             std::string_view          text,
+	             bool                      undone);
+	bool ApplyJournaled(const Journal::Record& record);
+	void Recover();
 
 public:
 	Editor() = default;
-	~Editor() = default;
+	~Editor();
 
 	std::shared_ptr<Terminal> terminal = nullptr;
 
 	bool shouldClose{ false };
 
 	int Init(std::shared_ptr<Terminal> term);
+	// Size of the terminal, in rows and columns
+	void Resize(size_t rows, size_t columns);
 
 	void RefreshScreen();
+	// Frames go to `sink` instead of the terminal, for running headless
+	void SetOutput(std::function<void(const std::string&)> sink)
+	{
+		output = std::move(sink);
+	}
 
 	// Filesystem operations
 	void Open(const char* filename);
-	// void        Save();
+	void Save();
+	// Appends what is written to the file from now on, like tail -f
+	void Follow(bool on);
+	// Whether a compressed file is saved compressed, or as text under its
+	// name without the .gz or .zst
+	void SetRecompress(bool on) { recompress = on; }
 
 	// Text buffer manipulation
 	void UpdateRow(size_t at);
 	void InsertRow(size_t at, const char* s);
-
+	void DelRow(size_t at);
+	void RowInsertChar(size_t at, size_t column, int c);
+	void RowAppendString(size_t at, std::string_view s);
+	void RowDelChar(size_t at, size_t column);
+
+	void InsertSpan(size_t& row, size_t& column, std::string_view text);
+	void DeleteSpan(size_t row, size_t column, size_t endRow, size_t endColumn);
+	void SplitLine(size_t row, size_t column);
+	void JoinLine(size_t row);
+
+	bool AppendCursorLine();
+	void InsertChar(int c);
+	void InsertText(std::string_view text);
 	void InsertNewline();
+	void DelChar();
+
+	// History
+	void Undo();
+	void Redo();
+	void SetUndoLimit(size_t bytes) { history.SetLimit(bytes); }
+
+	// Huge files
+	void SetHugeFileThreshold(size_t bytes) { rows.SetHugeThreshold(bytes); }
+	void SetPageBudget(size_t bytes) { rows.SetPageBudget(bytes); }
 
 	// User input
 	void ProcessKeypress();
+	bool ReadEvent(InputEvent& event);
+	bool PollEvent(InputEvent& event);
+	void ProcessEvent(const InputEvent& event);
+	void ProcessKey(int c, uint8_t modifiers);
+	void ProcessPaste(std::string_view text);
+	void ProcessMouse(const InputEvent& event);
+	void SetEscapeTimeout(int milliseconds) { escapeTimeout = milliseconds; }
 
 	// Interface
-	void DrawRows(std::string& ab) const;
-	void DrawStatusBar(std::string& ab) const;
-	void DrawMessageBar(std::string& ab);
+	void DrawRows(Screen& out) const;
+	void DrawStatusBar(Screen& out) const;
+	void DrawMessageBar(Screen& out);
+
+	// Bytes written and time spent on the last RefreshScreen
+	[[nodiscard]] const FrameStats& LastFrame() const { return frameStats; }
 
 	void SetStatusMessage(const char* fmt, ...);
-	// std::string Prompt(const char*                           prompt,
-	//                    std::function<void(const char*, int)> callback);
+	// Heap bytes per line of the buffer, in the message bar
+	void MemoryReport();
+	std::string Prompt(const char*                           prompt,
+	                   std::function<void(const char*, int)> callback);
 
 	// Cursor and view offset
 	void Scroll();
 	void MoveCursor(int key);
-
-	// static int  RowCxToRx(erow* row, size_t cx);
-	// static int  RowRxToCx(erow* row, int rx);
-	// void        DelRow(size_t at);
-	// void        RowInsertChar(erow* row, size_t at, char c);
-	// void        RowAppendString(erow* row, char* s, size_t len);
-	// void        RowDelChar(erow* row, size_t at);
-	// void        InsertChar(int c);
-	// void        DelChar();
-	// void        Find();
-	// void        SelectSyntaxHighlight();
-	// static int  SyntaxToColor(int hl);
-	// void        FindCallback(const char* query, int key);
-	// void        UpdateSyntax(erow* row) const;
-
-	// [[nodiscard]] std::string RowsToString() const;
-
-	// enum editorHighlight
-	// {
-	// 	HL_NORMAL = 0,
-	// 	HL_COMMENT,
-	// 	HL_KEYWORD1,
-	// 	HL_KEYWORD2,
-	// 	HL_STRING,
-	// 	HL_NUMBER,
-	// 	HL_MATCH
-	// };
+	void MoveTo(size_t row, size_t column);
+
+	size_t RowCxToRx(size_t row, size_t cx) const;
+	size_t RowRxToCx(size_t row, size_t rx) const;
+	bool WaitForIndex(const char* action);
+	void GoTo();
+	void Find(bool regex);
+	void FindCallback(const char* query, int key);
+
+	// Syntax highlighting
+	void       SelectSyntaxHighlight();
+	static int SyntaxToColor(int hl);
 };
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint> // uint32_t
+#include <functional>
+#include <vector>
+
+// Waits for file descriptors to become readable and calls their handlers.
+//
+// Built on epoll on Linux and poll elsewhere. Nothing runs while there is
+// nothing to read, so an idle editor does not use any CPU time.
+class EventLoop
+{
+private:
+	struct Source
+	{
+		int                   fd{ -1 };
+		std::function<void()> onReadable{};
+	};
+
+	std::vector<Source> sources{};
+	int                 pollFd{ -1 };
+
+public:
+	EventLoop();
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	int  Add(int fd, std::function<void()> onReadable);
+	void Remove(int fd);
+
+	// Waits up to `timeout` milliseconds, -1 meaning forever, and runs the
+	// handlers of the descriptors that became readable. Returns how many ran,
+	// 0 when the time ran out, or -1 with errno EINTR when a signal cut the
+	// wait short.
+	int RunOnce(int timeout);
+};
+
+// A descriptor other threads make readable to interrupt EventLoop::RunOnce,
+// for instance when background work has something new to show. Notify may
+// be called from any thread; notifications that arrive before the loop
+// wakes up are coalesced into one.
+class Wakeup
+{
+private:
+	int readFd{ -1 };
+	int writeFd{ -1 };
+
+public:
+	Wakeup();
+	~Wakeup();
+
+	Wakeup(const Wakeup&) = delete;
+	Wakeup& operator=(const Wakeup&) = delete;
+
+	[[nodiscard]] int Fd() const { return readFd; }
+
+	void Notify() const;
+	void Drain() const;
+};
+
+// A descriptor that becomes readable when the process gets `signal`, so the
+// signal is handled by EventLoop along with the input instead of in a signal
+// handler. Signals that arrive before the loop wakes up are coalesced into
+// one, as with Wakeup. There can be one per signal at a time; the signal
+// gets its default action back when it goes.
+class SignalEvent
+{
+private:
+	Wakeup wakeup{};
+	int    signal{ 0 };
+
+public:
+	explicit SignalEvent(int signal);
+	~SignalEvent();
+
+	SignalEvent(const SignalEvent&) = delete;
+	SignalEvent& operator=(const SignalEvent&) = delete;
+
+	[[nodiscard]] int Fd() const { return wakeup.Fd(); }
+
+	void Drain() const { wakeup.Drain(); }
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <string>
+
+#include <sys/types.h> // dev_t, ino_t
+
+// Follows a file that is being written to, like tail -f.
+//
+// On Linux the file and its directory are watched with inotify; Fd becomes
+// readable when either changes, and is meant to be added to the EventLoop.
+// Check then reads only the bytes appended since the last call, so following
+// costs as much as what was written, not as much as the file. A file that
+// became shorter was truncated, and one whose name now leads to another
+// inode was rotated; both have to be loaded again.
+class FileWatcher
+{
+public:
+	enum class Change
+	{
+		None,
+		Appended,
+		Truncated,
+		Replaced
+	};
+
+private:
+	std::string path{};
+	int         notifyFd{ -1 };
+	int         fileFd{ -1 };
+	dev_t       device{};
+	ino_t       inode{};
+	size_t      offset{ 0 };
+
+public:
+	FileWatcher() = default;
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Starts following `filename` from byte `from` on. Returns -1 with errno
+	// set if it cannot be watched.
+	int  Start(const char* filename, size_t from);
+	void Stop();
+
+	[[nodiscard]] bool   Watching() const { return fileFd != -1; }
+	[[nodiscard]] int    Fd() const { return notifyFd; }
+	[[nodiscard]] size_t Offset() const { return offset; }
+
+	// Takes the pending notifications and looks at what happened to the
+	// file. Bytes appended are read into `appended`.
+	Change Check(std::string& appended);
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class TextBuffer;
+
+inline constexpr int HL_HIGHLIGHT_NUMBERS{ 1 << 0 };
+inline constexpr int HL_HIGHLIGHT_STRINGS{ 1 << 1 };
+
+struct editorSyntax
+{
+	const char*  filetype;
+	const char** filematch;
+	const char** keywords; // secondary keywords end with '|'
+	const char*  singleline_comment_start;
+	const char*  multiline_comment_start;
+	const char*  multiline_comment_end;
+	int          flags;
+};
+
+enum editorHighlight : uint8_t
+{
+	HL_NORMAL = 0,
+	HL_COMMENT,
+	HL_MLCOMMENT,
+	HL_KEYWORD1,
+	HL_KEYWORD2,
+	HL_STRING,
+	HL_NUMBER,
+	HL_MATCH
+};
+
+// Incremental syntax highlighting.
+//
+// The only thing that carries over from one line to the next is the lexer
+// state at the end of a line (whether a block comment is still open), so
+// that is all that is kept per line. States are known up to a frontier and
+// computed lazily, only as far as a line that is about to be drawn. Edits
+// mark their lines stale and pull the frontier back; walking forward again
+// stops re-lexing as soon as an untouched line ends in the state it had
+// before, because everything after it is then unaffected. Opening a block
+// comment at the top of a huge file therefore costs the lines up to the
+// bottom of the screen, not the rest of the file.
+//
+// The highlight of a single line is cheap to derive from the state before
+// it, so it is computed when the line is drawn and not stored at all.
+//
+// Large files get a head start on the thread pool. Workers compute, for
+// every line of the file and in chunks, the end state for each possible
+// start state. That needs no knowledge of the lines before, so every line
+// start is a checkpoint and the chunks are independent. Each chunk is
+// published with a release store of its ready flag; walking the frontier
+// over unedited lines of a ready chunk is then a table lookup. While the
+// lines before the screen are neither ready nor cheap to scan, StateBefore
+// reports them as unknown and the rows are drawn plain.
+class Highlighter
+{
+private:
+	// Set on lines edited since their state was last computed
+	static constexpr uint8_t stale{ 0x80 };
+
+	struct Pass
+	{
+		size_t                               lines{ 0 };
+		size_t                               chunkLines{ 0 };
+		std::unique_ptr<uint8_t[]>           transitions{}; // bit s: end state
+		std::unique_ptr<std::atomic<bool>[]> ready{};       // per chunk
+		std::atomic<size_t>                  readyChunks{ 0 };
+		size_t                               chunks{ 0 };
+		std::atomic<bool>                    cancelled{ false };
+	};
+
+	const editorSyntax* syntax{ nullptr };
+	size_t              validLines{ 0 };
+
+	// State at the end of each line, with a gap at the last edit. Lines are
+	// added and removed in runs at one place, so each of those only moves
+	// the gap as far as the previous edit instead of every line after it.
+	std::vector<uint8_t> states{};
+	size_t               gapBegin{ 0 };
+	size_t               gapEnd{ 0 };
+
+	[[nodiscard]] size_t StateCount() const
+	{
+		return states.size() - (gapEnd - gapBegin);
+	}
+	uint8_t& State(size_t at)
+	{
+		return states[at < gapBegin ? at : at + (gapEnd - gapBegin)];
+	}
+	void MoveGap(size_t at);
+
+	std::shared_ptr<Pass>          pass{};
+	std::vector<std::future<void>> tasks{};
+	bool                           started{ false };
+
+	// Last run of unedited lines looked up, document lines [runBegin, runEnd)
+	// being original lines from runIndex on
+	size_t runBegin{ 0 };
+	size_t runEnd{ 0 };
+	size_t runIndex{ 0 };
+
+	bool Advance(const TextBuffer& rows, size_t count, size_t budget);
+	bool Transition(const TextBuffer& rows,
+	                size_t            at,
+	                uint8_t           before,
+	                uint8_t&          state);
+	void Stop();
+
+public:
+	Highlighter() = default;
+	~Highlighter();
+
+	Highlighter(const Highlighter&) = delete;
+	Highlighter& operator=(const Highlighter&) = delete;
+
+	static const editorSyntax* Select(std::string_view filename);
+
+	void Reset(const editorSyntax* newSyntax);
+	[[nodiscard]] const editorSyntax* Syntax() const { return syntax; }
+
+	// Starts the background pass once `rows` is fully indexed, if the file is
+	// large enough to need one. `onProgress` runs on the pool whenever more
+	// lines are ready. `rows` has to outlive the pass, see Reset.
+	void Start(const TextBuffer& rows, std::function<void()> onProgress);
+	[[nodiscard]] bool Running() const
+	{
+		return pass != nullptr && pass->readyChunks.load() < pass->chunks;
+	}
+
+	// Keep the states in step with the lines of the buffer
+	void Edited(size_t at);
+	void Inserted(size_t at, size_t count);
+	void Erased(size_t at, size_t count);
+
+	// Lexer state at the start of line `at`, computing what is missing.
+	// Returns false while that would take long because the background pass
+	// has not got there yet.
+	bool StateBefore(const TextBuffer& rows, size_t at, uint8_t& state);
+
+	// Fills `hl` with one editorHighlight per byte of `text` and returns the
+	// state at the end of the line
+	static uint8_t Highlight(const editorSyntax& syntax,
+	                         std::string_view    text,
+	                         uint8_t             state,
+	                         std::string&        hl);
+	// Same state as Highlight, without classifying every byte
+	static uint8_t Scan(const editorSyntax& syntax,
+	                    std::string_view    text,
+	                    uint8_t             state);
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <string>
+
+enum class InputType : uint8_t
+{
+	Key,
+	Paste,
+	Mouse,
+};
+
+enum Modifier : uint8_t
+{
+	Shift = 1,
+	Alt = 2,
+	Control = 4,
+};
+
+enum MouseButton : int
+{
+	Left = 0,
+	Middle = 1,
+	Right = 2,
+	WheelUp = 64,
+	WheelDown = 65,
+};
+
+struct InputEvent
+{
+	InputType type{ InputType::Key };
+	int       key{ 0 }; // a byte or a Key
+	uint8_t   modifiers{ 0 };
+
+	// Mouse reports, 1-based like the terminal sends them
+	int      button{ 0 };
+	bool     pressed{ false };
+	unsigned row{ 0 };
+	unsigned column{ 0 };
+
+	// Bracketed paste
+	std::string text{};
+};
+
+// Turns the bytes coming from the terminal into input events.
+//
+// Bytes are read in batches into a ring buffer and decoded by a state
+// machine: plain bytes, CSI and SS3 sequences with xterm modifier
+// parameters, SGR mouse reports and bracketed pastes. A lone escape byte is
+// ambiguous until more input arrives, Next leaves it alone until the caller
+// says the escape timeout has run out.
+class InputParser
+{
+private:
+	static constexpr size_t capacity{ 1 << 16 };
+	static constexpr size_t maxSequence{ 32 };
+
+	enum class Result : uint8_t
+	{
+		Event,
+		Incomplete,
+		Skipped,
+	};
+
+	std::array<char, capacity> ring{};
+	size_t                     head{ 0 }; // next byte to decode
+	size_t                     tail{ 0 }; // next byte to fill
+	bool                       inPaste{ false };
+	std::string                paste{};
+
+	[[nodiscard]] size_t Available() const { return tail - head; }
+	[[nodiscard]] char   Peek(size_t i) const
+	{
+		return ring[(head + i) & (capacity - 1)];
+	}
+	void Consume(size_t count) { head += count; }
+	void MoveTo(std::string& out, size_t count);
+
+	Result ParseEscape(InputEvent& event, bool timedOut);
+	Result ParseCsi(InputEvent& event, bool timedOut);
+	Result ParseSs3(InputEvent& event, bool timedOut);
+	Result ParsePaste(InputEvent& event);
+
+public:
+	InputParser() = default;
+	~InputParser() = default;
+
+	// Reads everything `fd` has available. Returns the number of bytes read,
+	// or -1 once the other end is gone.
+	long Fill(int fd);
+	void Feed(const char* data, size_t length);
+
+	// Decodes the next event. With `timedOut` an unfinished escape sequence
+	// is given up on and reported as the keys it started with.
+	bool Next(InputEvent& event, bool timedOut);
+
+	// Whether an escape sequence is waiting for more bytes
+	[[nodiscard]] bool HasPartial() const
+	{
+		return !inPaste && Available() > 0;
+	}
+
+	// Whether any input has been read that is not decoded yet
+	[[nodiscard]] bool Pending() const { return inPaste || Available() > 0; }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <string>
+
+#include "AllocationCounter.hpp"
+#include "Screen.hpp"
+
+// Where the time of a frame goes, compiled in with the KJ_INSTRUMENT option.
+//
+// Each frame records the time spent in its phases, the bytes and write()
+// calls it took to get it to the terminal and the heap allocations made
+// while composing it. The time from reading a key to having written the
+// frame showing its effect goes into a histogram, as do the time of whole
+// frames and the keystrokes each frame handled. A summary can be shown in
+// the message bar, and everything can be dumped as JSON.
+//
+// Without the option every function is an empty inline one, and Frame only
+// measures the time and the allocations of the whole frame for FrameStats,
+// which is what kj_bench looks at.
+enum class Phase : uint8_t
+{
+	Scroll,
+	DrawRows,
+	DrawStatusBar,
+	DrawMessageBar,
+	Flush,
+	Write,
+	Count
+};
+
+class Instrumentation
+{
+public:
+#if defined(KJ_INSTRUMENT)
+	static constexpr bool enabled{ true };
+
+	// Measures one frame, a phase at a time
+	class Frame
+	{
+	private:
+		std::chrono::steady_clock::time_point start{};
+		std::chrono::steady_clock::time_point lap{};
+		size_t                                allocations{ 0 };
+
+	public:
+		Frame();
+
+		// Ends `phase`, which started at the previous lap
+		void Lap(Phase phase);
+		// Ends the frame and fills in its time and allocations
+		void Done(FrameStats& stats);
+	};
+
+	// An input event was read; the first one since the last frame starts a
+	// latency measurement
+	static void InputRead();
+	// A write() to the terminal; the bytes of a frame are in its FrameStats
+	static void Wrote();
+
+	// One line summary of the frames so far
+	static void Overlay(std::string& out);
+	// Writes everything measured to `filename`. Returns -1 with errno set
+	// if it cannot be written.
+	static int Dump(const char* filename);
+#else
+	static constexpr bool enabled{ false };
+
+	class Frame
+	{
+	private:
+		std::chrono::steady_clock::time_point start{
+			std::chrono::steady_clock::now()
+		};
+		size_t allocations{ AllocationCounter::Allocations() };
+
+	public:
+		void Lap(Phase /*phase*/) {}
+		void Done(FrameStats& stats)
+		{
+			stats.microseconds = std::chrono::duration<double, std::micro>(
+			                       std::chrono::steady_clock::now() - start)
+			                       .count();
+			stats.allocations = AllocationCounter::Allocations() - allocations;
+		}
+	};
+
+	static void InputRead() {}
+	static void Wrote() {}
+	static void Overlay(std::string& out) { out.clear(); }
+	static int  Dump(const char* /*filename*/) { return 0; }
+#endif
+};
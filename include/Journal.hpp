@@ -0,0 +1,121 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Edits made since the file was last saved, kept on disk for when the editor
+// goes away without saving, e.g. with the SSH session it ran in.
+//
+// Each edit is appended as a small binary record: its kind and position as
+// varints, the text of an insert, and a checksum. Adding a record only
+// encodes it into a buffer; a thread of its own writes the buffer out as
+// soon as there is something in it and syncs the file at most once per sync
+// interval, so typing never waits for the disk.
+//
+// The journal starts with the size, modification time and inode of the file
+// as saved. On startup a journal is only replayed onto that same file, so
+// recovering costs as much as the edits, not as much as the file. A record
+// cut short by the crash ends the replay.
+class Journal
+{
+public:
+	enum class Edit : uint8_t
+	{
+		Insert,     // text at (row, column)
+		Delete,     // from (row, column) up to (endRow, endColumn)
+		Split,      // a line break at (row, column)
+		Join,       // the line break at the end of row
+		AppendLine, // an empty line as row
+		EraseLine,  // row
+	};
+
+	struct Record
+	{
+		Edit             edit{ Edit::Insert };
+		size_t           row{ 0 };
+		size_t           column{ 0 };
+		size_t           endRow{ 0 };
+		size_t           endColumn{ 0 };
+		std::string_view text{};
+	};
+
+	// The version of the file the records apply to. All zero for a file
+	// that does not exist, all ones while it is not known yet.
+	struct Base
+	{
+		uint64_t size{ 0 };
+		uint64_t seconds{ 0 };
+		uint64_t nanoseconds{ 0 };
+		uint64_t inode{ 0 };
+
+		bool operator==(const Base& other) const
+		{
+			return size == other.size && seconds == other.seconds &&
+			       nanoseconds == other.nanoseconds && inode == other.inode;
+		}
+	};
+
+private:
+	std::string path{};
+	int         fd{ -1 };
+	std::string encoding{}; // of the record being added
+	size_t      offset{ 0 }; // of the end, only used by the writer
+	size_t      added{ 0 }; // bytes of records since the last Reset
+
+	std::mutex              mutex{};
+	std::condition_variable wake{};
+	std::string             pending{}; // records not written yet
+	std::string             writing{}; // the ones being written
+	bool                    reset{ false };
+	size_t                  dropped{ 0 }; // bytes of records to drop
+	Base                    base{};
+	bool                    stopping{ false };
+	std::thread             writer{};
+
+	void Run();
+
+public:
+	Journal() = default;
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Name of the journal of `filename`, a hidden file next to it
+	static std::string PathOf(const std::string& filename);
+	// Version of `filename` as it is on disk now
+	static Base BaseOf(const std::string& filename);
+
+	// Hands the records of the journal at `path` to `apply` in order, until
+	// one is cut short or `apply` returns false. Returns the bytes of the
+	// journal that were applied, 0 for an empty journal of another version,
+	// or -1 with errno set if there is no journal, it cannot be read, or it
+	// was written for another version of the file than `current` (ESTALE).
+	static long Replay(const std::string&                         path,
+	                   const Base&                                current,
+	                   const std::function<bool(const Record&)>& apply);
+
+	// Starts journaling into `path`, keeping its first `keep` bytes if it
+	// is already a journal for `current`. Returns -1 with errno set if it
+	// cannot be written.
+	int  Start(const std::string& path, const Base& current, size_t keep);
+	// Stops journaling; the journal is removed unless `keep` is given
+	void Stop(bool keep);
+
+	[[nodiscard]] bool               Active() const { return fd != -1; }
+	[[nodiscard]] const std::string& Path() const { return path; }
+
+	// Where the records added so far end, for Reset
+	[[nodiscard]] size_t Mark() const { return added; }
+	// The text as it was at `mark` was saved as `saved`: the records up to
+	// there are dropped, the ones added since are kept
+	void Reset(const Base& saved, size_t mark);
+
+	void Add(const Record& record);
+};
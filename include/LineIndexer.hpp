@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+enum class LineEnding : uint8_t
+{
+	LF,
+	CRLF,
+};
+
+struct LineIndex
+{
+	std::vector<size_t> lineStarts{}; // byte offset of every line
+	size_t              crlfLines{ 0 };
+	size_t              longestLine{ 0 }; // in bytes, without the '\n'
+
+	[[nodiscard]] size_t LineCount() const { return lineStarts.size(); }
+};
+
+// Finds line starts in a block of memory.
+//
+// The newline scan uses the widest vector unit the CPU offers (AVX2, SSE2 or
+// a plain memchr loop), picked once at runtime. Large inputs are cut into
+// chunks that are scanned on the shared thread pool and stitched together
+// into a single table; the same pass counts CRLF line breaks and measures
+// the longest line.
+class LineIndexer
+{
+public:
+	// Name of the scanner selected for this CPU
+	static const char* Implementation();
+
+	// Appends the offsets of all '\n' in data[begin, end) to `positions`
+	static void FindNewlines(const char*          data,
+	                         size_t               begin,
+	                         size_t               end,
+	                         std::vector<size_t>& positions);
+
+	// `onDone` runs on the pool once the returned future is ready. The bytes
+	// of the chunks scanned so far are added up in `scanned`.
+	static std::future<LineIndex> BuildAsync(
+	  const char*                          data,
+	  size_t                               size,
+	  std::function<void()>                onDone = nullptr,
+	  std::shared_ptr<std::atomic<size_t>> scanned = nullptr);
+	static LineIndex Build(const char* data, size_t size);
+};
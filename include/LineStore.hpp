@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class erow
+{
+public:
+	std::string chars{};
+	erow() = default;
+	~erow() = default;
+};
+
+// Lines of the TextBuffer that are not views of the original file.
+//
+// Lines are written once into large blocks of bytes and found through a
+// packed array of 16 byte entries; lines of up to 8 bytes, blank ones among
+// them, are kept in their entry. A line only becomes an erow of its own once
+// it is handed out for editing; it then stays one, so only the lines being
+// worked on pay for a string each. Entries and blocks never move, so a view
+// of a line stays valid until the line is edited or the store cleared.
+class LineStore
+{
+private:
+	static constexpr size_t inlineBytes{ 8 };
+
+	struct Entry
+	{
+		union
+		{
+			const char* data;
+			char        bytes[inlineBytes];
+		};
+		uint32_t length{ 0 };
+		uint32_t edited{ 0 }; // 1 + the index in `edits`, 0 if not edited
+	};
+
+	std::deque<Entry>                    entries{};
+	std::vector<std::unique_ptr<char[]>> blocks{};
+	size_t                               blockBytes{ 0 };
+	size_t                               blockUsed{ 0 };
+	size_t                               arenaBytes{ 0 };
+	std::deque<erow>                     edits{};
+
+	// What one std::string per line would have taken, for the report
+	size_t stringBytes{ 0 };
+
+	char* Allocate(size_t length);
+
+public:
+	struct Usage
+	{
+		size_t lines{ 0 };
+		size_t edited{ 0 };
+		size_t bytes{ 0 };       // entries, blocks and edited lines
+		size_t stringBytes{ 0 }; // the same lines as a std::string each
+	};
+
+	// Returns the index of the new line
+	size_t Add(std::string_view chars);
+
+	[[nodiscard]] std::string_view Get(size_t index) const;
+	// Moves the line into an erow of its own, if it is not in one yet
+	erow&                          Edit(size_t index);
+
+	[[nodiscard]] size_t Size() const { return entries.size(); }
+	[[nodiscard]] Usage  Measure() const;
+
+	void Clear();
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef> // size_t
+
+// Read-only view of a whole file. On Linux the file is mapped with mmap, so
+// opening it costs the same regardless of its size and pages are only read
+// once something looks at them.
+//
+// A file that is still being written can be mapped with room to grow: the
+// mapping reaches further than the file, and Grow makes more of it readable
+// as the file gets longer, without the data moving.
+class MappedFile
+{
+private:
+	const char* data{ nullptr };
+	size_t      size{ 0 };
+	size_t      reserved{ 0 }; // length of a mapping made with Reserve
+	bool        mapped{ false };
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	int  Open(const char* filename);
+	// Maps `capacity` bytes of `fd`, of which none are readable yet
+	int  Reserve(int fd, size_t capacity);
+	// Makes the first `bytes` of a reserved mapping readable; they have to
+	// be in the file by now
+	void Grow(size_t bytes) { size = bytes < reserved ? bytes : reserved; }
+	void Close();
+
+	// Hints that the pages holding [offset, offset + length) will be read
+	// soon, or that they can be dropped and read again from the file later
+	void Advise(size_t offset, size_t length, bool needed) const;
+
+	[[nodiscard]] const char* Data() const { return data; }
+	[[nodiscard]] size_t      Size() const { return size; }
+	[[nodiscard]] bool        IsOpen() const { return mapped; }
+};
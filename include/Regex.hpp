@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, int32_t
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Regular expressions matched a line at a time, in linear time.
+//
+// The pattern is parsed once and compiled into two Thompson NFAs, one for
+// the pattern and one for the pattern read backwards. Neither is simulated
+// directly: each is run as a DFA whose states (sets of NFA states) are only
+// built when the input first reaches them and are then cached, so matching
+// is a table lookup per byte with no backtracking, whatever the pattern.
+// Bytes the pattern does not tell apart share a column of the tables. When
+// the cache grows past its budget it is thrown away and rebuilt from the
+// state at hand.
+//
+// Supported: literals, `.`, classes with ranges and negation, the escapes
+// \d \w \s and their negations, groups, `|`, `*`, `+`, `?`, `{m,n}` and the
+// line anchors `^` and `$`. Matches are leftmost-longest.
+//
+// The longest run of bytes every match has to contain is made available as
+// a literal, so callers can skip lines without it using a fast search.
+class Regex
+{
+private:
+	using ByteSet = std::array<uint64_t, 4>;
+
+	struct Node
+	{
+		enum Kind : uint8_t
+		{
+			Empty,
+			Set,
+			Begin,
+			End,
+			Concat,
+			Alternate,
+			Repeat,
+		};
+
+		Kind             kind{ Empty };
+		int              set{ -1 };
+		int              min{ 0 };
+		int              max{ 0 }; // -1 for no limit
+		std::vector<int> children{};
+	};
+
+	struct State
+	{
+		enum Kind : uint8_t
+		{
+			Byte,
+			Split,
+			Begin,
+			End,
+			Match,
+		};
+
+		Kind kind{ Match };
+		int  set{ -1 };
+		int  out{ -1 };
+		int  out1{ -1 };
+	};
+	static constexpr int matchState{ 0 }; // first state of every automaton
+
+	struct DfaState
+	{
+		std::vector<int> nfa{}; // sorted Byte, End and Match states
+		bool             match{ false };
+		bool             matchAtEnd{ false }; // once `$` holds
+		bool             matchAtEmpty{ false }; // once `$` and `^` hold
+		bool             dead{ false };
+	};
+
+	// One direction of the pattern and the DFA built for it so far
+	struct Automaton
+	{
+		std::vector<State> states{};
+		int                anchored{ -1 };   // NFA start
+		int                unanchored{ -1 }; // the same after a .* loop
+
+		std::vector<DfaState>                dfa{};
+		std::vector<int32_t>                 next{}; // dfa x classes, -1 unknown
+		std::unordered_map<std::string, int> known{};
+		std::array<int, 4>                   starts{ -1, -1, -1, -1 };
+	};
+
+	std::string          error{};
+	std::string          literal{};
+	std::vector<Node>    nodes{};
+	std::vector<ByteSet> sets{};
+	int                  root{ -1 };
+
+	std::array<uint8_t, 256> classes{}; // byte to column
+	size_t                   classCount{ 0 };
+
+	Automaton forward{};
+	Automaton backward{};
+
+	std::vector<uint8_t> startsAt{}; // of the last Scan, per position
+	std::vector<int>     scratch{};
+	std::vector<uint8_t> seen{};
+
+	// Parsing
+	int  Parse(std::string_view pattern, size_t& at, int depth);
+	int  ParseRepeat(std::string_view pattern, size_t& at, int depth);
+	int  ParseAtom(std::string_view pattern, size_t& at, int depth);
+	bool ParseClass(std::string_view pattern, size_t& at, ByteSet& set);
+	bool ParseEscape(std::string_view pattern, size_t& at, ByteSet& set);
+	int  AddNode(Node node);
+	int  AddSet(const ByteSet& set);
+
+	std::string RequiredLiteral(int node, std::string& run) const;
+
+	// Compiling
+	int  Emit(Automaton& automaton, int node, int out, bool reversed);
+	int  AddState(Automaton& automaton, State state);
+	void BuildClasses();
+
+	// Running
+	void Closure(const Automaton&      automaton,
+	             int                   state,
+	             bool                  atBegin,
+	             std::vector<int>&     out,
+	             std::vector<uint8_t>& visited) const;
+	bool ReachesMatch(const Automaton&        automaton,
+	                  const std::vector<int>& nfa,
+	                  bool                    atBegin) const;
+	int  Intern(Automaton& automaton, std::vector<int>& nfa);
+	int  Start(Automaton& automaton, bool unanchored, bool atBegin);
+	int  Step(Automaton& automaton, int from, uint8_t byte);
+	void Flush(Automaton& automaton);
+
+public:
+	Regex() = default;
+
+	// Returns false with Error set if `pattern` is not a valid expression
+	bool Compile(std::string_view pattern);
+
+	[[nodiscard]] const std::string& Error() const { return error; }
+	[[nodiscard]] const std::string& Literal() const { return literal; }
+
+	// Whether `text` contains a match
+	bool Matches(std::string_view text);
+
+	// Finds where matches in `text` start, for StartAfter and StartBefore
+	void Scan(std::string_view text);
+	// First start at or after `from` / last one before `before`, npos if none
+	[[nodiscard]] size_t StartAfter(size_t from) const;
+	[[nodiscard]] size_t StartBefore(size_t before) const;
+	// Length of the longest match starting at `start`, npos if there is none
+	size_t Length(std::string_view text, size_t start);
+
+	static constexpr size_t npos{ std::string_view::npos };
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t, uint64_t
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bounded least-recently-used cache of rendered lines.
+//
+// Rendering only has work to do for lines containing tabs; every other line
+// is handed back as is without being copied or cached. Entries are keyed by
+// TextBuffer line ids, which stay the same while lines around them are
+// inserted or erased, and have to be invalidated when the line is edited.
+// Evicted entries keep their string capacity, so once the cache is warm it
+// stops allocating.
+class RenderCache
+{
+private:
+	static constexpr uint32_t none{ UINT32_MAX };
+
+	struct Entry
+	{
+		uint64_t    key{ 0 };
+		std::string render{};
+		uint32_t    newer{ none };
+		uint32_t    older{ none };
+	};
+
+	std::vector<Entry>    entries{};
+	std::vector<uint32_t> slots{}; // open addressing index into `entries`
+	uint32_t              newest{ none };
+	uint32_t              oldest{ none };
+	size_t                hits{ 0 };
+	size_t                misses{ 0 };
+
+	[[nodiscard]] size_t Slot(uint64_t key) const;
+	[[nodiscard]] size_t Find(uint64_t key) const;
+	void                 Unlink(uint32_t entry);
+	void                 PushNewest(uint32_t entry);
+	void                 EraseSlot(size_t slot);
+
+public:
+	explicit RenderCache(size_t capacity);
+	~RenderCache() = default;
+
+	static void Expand(std::string_view chars, std::string& render);
+
+	std::string_view Get(uint64_t key, std::string_view chars);
+	void             Invalidate(uint64_t key);
+	void             Clear();
+
+	[[nodiscard]] size_t Capacity() const { return entries.capacity(); }
+	[[nodiscard]] size_t Size() const { return entries.size(); }
+	[[nodiscard]] size_t Hits() const { return hits; }
+	[[nodiscard]] size_t Misses() const { return misses; }
+};
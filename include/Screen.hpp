@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint32_t
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Style
+{
+	uint8_t foreground{ 0 }; // SGR color code, 0 is the default color
+	bool    reverse{ false };
+
+	bool operator==(const Style& other) const
+	{
+		return foreground == other.foreground && reverse == other.reverse;
+	}
+	bool operator!=(const Style& other) const { return !(*this == other); }
+};
+
+struct Cell
+{
+	uint32_t glyph{ ' ' }; // bytes of the character, lowest byte first
+	Style    style{};
+
+	bool operator==(const Cell& other) const
+	{
+		return glyph == other.glyph && style == other.style;
+	}
+	bool operator!=(const Cell& other) const { return !(*this == other); }
+};
+
+struct FrameStats
+{
+	size_t bytes{ 0 };        // written to the terminal
+	size_t changedCells{ 0 }; // cells that differ from the previous frame
+	size_t runs{ 0 };         // cursor jumps needed to reach them
+	size_t allocations{ 0 };  // heap allocations while composing the frame
+	double microseconds{ 0 }; // composing, diffing and writing the frame
+	size_t keystrokes{ 0 };   // input events handled since the last frame
+};
+
+// Double-buffered model of the terminal contents.
+//
+// A frame is drawn into the `next` grid from scratch, then Flush compares it
+// with what the terminal is known to show and emits only the runs of cells
+// that changed, each preceded by a cursor jump. Short unchanged gaps inside a
+// run are rewritten rather than jumped over, and stale line tails are cleared
+// with a single erase instead of spaces.
+//
+// The escape sequences go to an output buffer owned by the screen. It is
+// sized for a full redraw when the screen is resized and reused for every
+// frame, so composing a frame does not allocate.
+class Screen
+{
+private:
+	size_t            rows{ 0 };
+	size_t            columns{ 0 };
+	std::vector<Cell> current{};
+	std::vector<Cell> next{};
+	std::string       output{};
+	bool              invalid{ true };
+
+	size_t cursorRow{ 0 };
+	size_t cursorColumn{ 0 };
+
+	// What the terminal is showing, as far as we know
+	size_t shownCursorRow{ SIZE_MAX };
+	size_t shownCursorColumn{ SIZE_MAX };
+	size_t outputRow{ SIZE_MAX }; // where the next byte would land
+	size_t outputColumn{ SIZE_MAX };
+	Style  outputStyle{};
+
+	void MoveTo(size_t row, size_t column);
+	void SetStyle(Style style);
+	void EmitRun(size_t row, size_t begin, size_t end);
+
+public:
+	Screen() = default;
+	~Screen() = default;
+
+	void Resize(size_t rows, size_t columns);
+	void Invalidate() { invalid = true; }
+
+	[[nodiscard]] size_t Rows() const { return rows; }
+	[[nodiscard]] size_t Columns() const { return columns; }
+
+	// Drawing into the next frame
+	void   Clear();
+	size_t Put(size_t row, size_t column, std::string_view text, Style style);
+	size_t PutNumber(size_t row, size_t column, size_t number, Style style);
+	void   Fill(size_t row, size_t column, size_t count, char c, Style style);
+	void   SetCursor(size_t row, size_t column);
+
+	[[nodiscard]] const Cell& At(size_t row, size_t column) const
+	{
+		return next[row * columns + column];
+	}
+
+	// Returns the escape sequences turning the previous frame into the next
+	// one and makes the next frame the current one. The result stays valid
+	// until the next Flush.
+	const std::string& Flush(FrameStats& stats);
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility> // pair
+#include <vector>
+
+#include "Regex.hpp"
+#include "Searcher.hpp"
+#include "TextBuffer.hpp"
+
+// The lines of a document that contain a query.
+//
+// Unedited parts of the file are searched in place, as one block of bytes
+// per piece, so the search runs at the speed of the Searcher rather than
+// line by line; a hit is mapped to its line through the line index and the
+// search carries on at the next line. Only edited lines are visited one at a
+// time. The result is a bitmap with one bit per line, from which Next picks
+// the matches.
+//
+// As long as the query only grows, the lines that can still match are a
+// subset of the last result, so typing a query rechecks the marked lines
+// instead of the whole document. Edits are not tracked, the search has to be
+// cleared once the document changes.
+//
+// A query can also be a regular expression. The literal every match of it
+// has to contain then takes the place of the query in the block search, and
+// only the lines that have it are run through the expression. Without such
+// a literal every line is.
+class Search
+{
+private:
+	std::string           query{};
+	bool                  regex{ false };
+	bool                  valid{ false };
+	Searcher              searcher{}; // the query, or the literal of `pattern`
+	mutable Regex         pattern{};  // its DFA is built while matching
+	std::vector<uint64_t> matches{}; // bit per line of the document
+	std::vector<uint64_t> scratch{};
+	size_t                lines{ 0 };
+	size_t                count{ 0 };
+
+	std::vector<TextBuffer::Piece> pieces{};
+
+	bool Scan(const TextBuffer& rows, const std::function<bool()>& cancelled);
+	bool Refine(const TextBuffer& rows, const std::function<bool()>& cancelled);
+
+	[[nodiscard]] bool   LineMatches(std::string_view text) const;
+	[[nodiscard]] size_t First(std::string_view text, size_t from) const;
+	[[nodiscard]] size_t Last(std::string_view text, size_t before) const;
+
+	[[nodiscard]] bool Test(size_t line) const
+	{
+		return line < lines && (matches[line / 64] >> (line % 64) & 1) != 0;
+	}
+	[[nodiscard]] size_t NextSet(size_t line) const;
+	[[nodiscard]] size_t PreviousSet(size_t line) const;
+
+public:
+	Search() = default;
+
+	// Finds the lines of `rows` matching `newQuery`, taken literally or as a
+	// regular expression. `cancelled` is asked now and then whether to give
+	// up, in which case false is returned and the previous result is kept.
+	// An invalid expression matches nothing, see Error.
+	bool Run(const TextBuffer&            rows,
+	         std::string_view             newQuery,
+	         bool                         newRegex,
+	         const std::function<bool()>& cancelled);
+	void Clear();
+
+	[[nodiscard]] bool               Valid() const { return valid; }
+	[[nodiscard]] const std::string& Query() const { return query; }
+	[[nodiscard]] bool               IsRegex() const { return regex; }
+	[[nodiscard]] const std::string& Error() const { return pattern.Error(); }
+	[[nodiscard]] size_t             Count() const { return count; }
+	[[nodiscard]] bool Marked(size_t line) const { return valid && Test(line); }
+
+	// The matches in `text` as (start, length), leftmost first and not
+	// overlapping
+	void Spans(std::string_view                         text,
+	           std::vector<std::pair<size_t, size_t>>& out) const;
+
+	// Moves to the nearest match at (direction 0), after (1) or before (-1)
+	// the given position, wrapping around the document
+	bool Next(const TextBuffer& rows,
+	          size_t&           line,
+	          size_t&           column,
+	          int               direction) const;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <string>
+#include <string_view>
+
+// Finds a fixed string in a block of memory.
+//
+// Candidates are filtered a vector at a time by comparing the first and the
+// last byte of the needle against two shifted loads, so only positions where
+// both match are compared in full. The widest vector unit the CPU offers is
+// picked once at runtime (AVX2, SSE2); without one, and for the tail of a
+// block, the C library's memmem (Two-Way in glibc) does the work.
+class Searcher
+{
+private:
+	std::string needle{};
+
+public:
+	Searcher() = default;
+	explicit Searcher(std::string_view needle)
+	  : needle(needle)
+	{
+	}
+
+	// Name of the search loop selected for this CPU
+	static const char* Implementation();
+
+	[[nodiscard]] const std::string& Needle() const { return needle; }
+	[[nodiscard]] size_t             Size() const { return needle.size(); }
+
+	// Offset of the first occurrence in data[0, size), npos if there is none
+	[[nodiscard]] size_t Find(const char* data, size_t size) const;
+	[[nodiscard]] size_t Find(std::string_view text) const
+	{
+		return Find(text.data(), text.size());
+	}
+
+	static constexpr size_t npos{ std::string_view::npos };
+};
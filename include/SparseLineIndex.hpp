@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WindowPager;
+
+// Line index of a file too large to keep the start of every line of.
+//
+// Only every `interval`-th line start is kept, as a checkpoint. A line is
+// found by going to the checkpoint before it and looking for the newlines
+// after it, at most `interval` - 1 of them; the line starts of the few
+// blocks of lines between two checkpoints that were looked at last are kept
+// around, so drawing a screen full of lines scans each block once.
+//
+// The file is scanned on a thread of its own rather than the pool, as the
+// scan takes as long as the file is large. Plain reads into a buffer of the
+// scan keep indexing from bringing the mapping into memory. What the scan
+// found so far is published now and then and taken over by Poll, so the
+// lines at the start of the file can be shown while the rest is indexed.
+class SparseLineIndex
+{
+private:
+	struct Scan
+	{
+		std::vector<size_t> checkpoints{};
+		size_t              lines{ 0 };
+		size_t              bytes{ 0 }; // start of the line after the last one
+		size_t              crlfLines{ 0 };
+		size_t              longestLine{ 0 };
+		bool                done{ false };
+	};
+
+	struct Block
+	{
+		size_t              number{ SIZE_MAX };
+		std::vector<size_t> starts{};
+	};
+
+	size_t interval{ 0 };
+
+	// The part of the scan taken over by Poll
+	Scan adopted{};
+
+	// Shared with the scanning task
+	Scan                    published{};
+	std::mutex              mutex{};
+	std::condition_variable progress{};
+	std::atomic<bool>       cancelled{ false };
+	std::thread             scanner{};
+
+	mutable std::array<Block, 8> blocks{};
+	mutable size_t               nextBlock{ 0 };
+	mutable std::vector<size_t>  newlines{};
+
+	void Run(int fd, size_t size, std::function<void()> onProgress);
+
+	const Block& BlockOf(const char*  data,
+	                     WindowPager* pager,
+	                     size_t       number) const;
+
+public:
+	SparseLineIndex() = default;
+	~SparseLineIndex();
+
+	SparseLineIndex(const SparseLineIndex&) = delete;
+	SparseLineIndex& operator=(const SparseLineIndex&) = delete;
+
+	// Starts indexing the first `size` bytes of `filename`, keeping the start
+	// of every `every`-th line. `onProgress` runs on the scanning thread
+	// whenever there is more to Poll. Returns -1 with errno set if the file
+	// cannot be read.
+	int  Start(const char*           filename,
+	           size_t                size,
+	           size_t                every,
+	           std::function<void()> onProgress);
+	void Stop();
+
+	// Takes over what the scan found since the last call. Returns whether
+	// there are more lines.
+	bool Poll();
+	// Waits until the scan found more lines, or is done
+	void Wait();
+
+	[[nodiscard]] size_t Lines() const { return adopted.lines; }
+	[[nodiscard]] size_t Bytes() const { return adopted.bytes; }
+	[[nodiscard]] bool   Done() const { return adopted.done; }
+	[[nodiscard]] size_t CrlfLines() const { return adopted.crlfLines; }
+	[[nodiscard]] size_t LongestLine() const { return adopted.longestLine; }
+
+	// Offset of line `index`, Bytes() for the line after the last one. Pages
+	// read through `data` are reported to `pager`.
+	size_t LineStart(const char* data, WindowPager* pager, size_t index) const;
+	// Line holding the indexed byte at `offset`
+	size_t LineAt(const char* data, WindowPager* pager, size_t offset) const;
+};
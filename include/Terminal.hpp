@@ -52,7 +52,20 @@ enum Key : int
 	Home,
 	End,
 	PageUp,
-	PageDown
+	PageDown,
+	Insert,
+	F1,
+	F2,
+	F3,
+	F4,
+	F5,
+	F6,
+	F7,
+	F8,
+	F9,
+	F10,
+	F11,
+	F12,
 };
 
 class Terminal
@@ -77,6 +90,9 @@ public:
 
 	static std::string SetCursorPositionEscapeSequence(unsigned int row,
 	                                                   unsigned int column);
+	static void        SetCursorPositionEscapeSequence(std::string& out,
+	                                                   unsigned int row,
+	                                                   unsigned int column);
 
 	int GetWindowSize();
 	int GetCursorPosition();
@@ -88,6 +104,4 @@ public:
 	static void Write(const std::string& content);
 	static void Write(const char* content, size_t length);
 	static void Write(const char* content);
-
-	static int Read();
 };
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint32_t
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Compression.hpp"
+#include "constants.hpp"
+#include "LineIndexer.hpp"
+#include "LineStore.hpp"
+#include "MappedFile.hpp"
+#include "SparseLineIndex.hpp"
+#include "WindowPager.hpp"
+
+class VectorWriter;
+
+// Line-level piece table.
+//
+// Lines come from two sources: the original file, which is memory mapped and
+// read through views, and an append-only store of lines that were created or
+// edited (see LineStore). The document is a sequence of pieces, each one a
+// run of consecutive lines from one source, kept in an implicit treap ordered
+// by position and augmented with line counts. Looking up, inserting and
+// erasing a line splits or merges O(log n) nodes no matter where in the
+// document it happens.
+//
+// The original file is indexed lazily: line starts are only searched for as
+// far as somebody asked with EnsureLines, so opening a file costs as much as
+// the part of it that is shown. Large files are meanwhile indexed as a whole
+// on the thread pool; Poll adopts that index once it is done, which also
+// brings in the line count, the line ending and the longest line.
+//
+// Compressed files are decompressed on a thread into a temporary file
+// (see Decompressor), which is mapped as it grows. Poll indexes what was
+// decompressed since the last call, so lines show up as they come in.
+//
+// Files larger than the huge file threshold are paged instead: only every
+// so many line starts are kept (see SparseLineIndex), the count of lines
+// grows as the background scan gets further, and the parts of the mapping
+// that were read are kept within a memory budget (see WindowPager).
+class TextBuffer
+{
+private:
+	using NodeId = uint32_t;
+	static constexpr NodeId nil{ 0 };
+
+	enum class Source : uint8_t
+	{
+		Original,
+		Added,
+	};
+
+	struct Node
+	{
+		size_t   start{ 0 }; // first line of the piece in its source
+		size_t   count{ 0 }; // lines in the piece
+		size_t   lines{ 0 }; // lines in the whole subtree
+		uint32_t priority{ 0 };
+		NodeId   left{ nil };
+		NodeId   right{ nil };
+		Source   source{ Source::Added };
+	};
+
+	struct Location
+	{
+		Source source;
+		size_t index;
+	};
+
+	MappedFile             file{};
+	std::vector<size_t>    lineStarts{}; // offsets of the indexed original lines
+	size_t                 indexedBytes{ 0 };
+	std::vector<size_t>    newlines{}; // scratch space for the lazy scan
+	std::future<LineIndex> pendingIndex{};
+	std::shared_ptr<std::atomic<size_t>> pendingScanned{}; // by pendingIndex
+	std::future<void>      indexNotified{}; // onIndexed ran for pendingIndex
+	std::function<void()>  onIndexed{};
+
+	Decompressor stream{};
+	Codec        codec{ Codec::None };
+	bool         streaming{ false }; // the decompressor is not done yet
+	int          streamError{ 0 };
+
+	bool                paged{ false };
+	SparseLineIndex     sparse{};
+	mutable WindowPager pager{};
+	size_t hugeThreshold{ kilojoule::defaults::hugeFileThreshold };
+	size_t pageBudget{ kilojoule::defaults::pageBudget };
+
+	LineEnding lineEnding{ LineEnding::LF };
+	size_t     crlfLines{ 0 };
+	size_t     longestLine{ 0 };
+
+	LineStore           store{};
+	std::vector<Node>   nodes{ Node{} }; // nodes[0] is the nil sentinel
+	std::vector<NodeId> freeNodes{};
+	NodeId              root{ nil };
+	uint32_t            seed{ 0x9e3779b9 };
+
+	NodeId NewNode(Source source, size_t start, size_t count, uint32_t priority);
+	NodeId NewNode(Source source, size_t start, size_t count);
+	void   FreeTree(NodeId t);
+	void   Update(NodeId t);
+
+	void   Split(NodeId t, size_t k, NodeId& l, NodeId& r);
+	NodeId Merge(NodeId l, NodeId r);
+	void   Append(Source source, size_t start, size_t count);
+
+	void Adopt(LineIndex index);
+	int  LoadCompressed(const char* filename, Codec format);
+	bool PollStream();
+
+	int WritePieces(NodeId t, VectorWriter& out) const;
+
+	[[nodiscard]] Location Locate(size_t at) const;
+
+public:
+	TextBuffer() = default;
+	~TextBuffer();
+
+	TextBuffer(const TextBuffer&) = delete;
+	TextBuffer& operator=(const TextBuffer&) = delete;
+
+	int  Load(const char* filename);
+	void EnsureLines(size_t count);
+	bool Poll();
+
+	// Called from a background thread when an index is ready to Poll
+	void OnIndexed(std::function<void()> callback)
+	{
+		onIndexed = std::move(callback);
+	}
+
+	[[nodiscard]] size_t LineCount() const { return nodes[root].lines; }
+	[[nodiscard]] bool   Empty() const { return root == nil; }
+	[[nodiscard]] bool   FullyIndexed() const
+	{
+		return paged ? sparse.Done()
+		             : !streaming && indexedBytes == file.Size();
+	}
+
+	// Format the file was compressed in, and what stopped decompressing it
+	// before its end (an errno, 0 if nothing did)
+	[[nodiscard]] Codec Compression() const { return codec; }
+	[[nodiscard]] int   CompressionError() const { return streamError; }
+
+	// Files above `bytes` are paged from the next Load on, within `budget`
+	void SetHugeThreshold(size_t bytes) { hugeThreshold = bytes; }
+	void SetPageBudget(size_t budget)
+	{
+		pageBudget = budget;
+		pager.SetBudget(budget);
+	}
+	[[nodiscard]] bool   Paged() const { return paged; }
+	// Bytes of the file as loaded that lines were found in so far
+	[[nodiscard]] size_t IndexedBytes() const
+	{
+		return paged ? sparse.Bytes() : indexedBytes;
+	}
+	// How far indexing got, in percent, counting the background index
+	[[nodiscard]] size_t LoadProgress() const;
+	[[nodiscard]] size_t ResidentBytes() const { return pager.Resident(); }
+	[[nodiscard]] LineEnding Ending() const { return lineEnding; }
+	[[nodiscard]] size_t     CrlfLines() const { return crlfLines; }
+	[[nodiscard]] size_t     LongestLine() const { return longestLine; }
+
+	// Identifies a line for as long as it is not edited, regardless of the
+	// lines inserted or erased around it
+	[[nodiscard]] uint64_t Id(size_t at) const;
+
+	[[nodiscard]] std::string_view Line(size_t at) const;
+	erow&                          Row(size_t at);
+
+	// Lines of the file as loaded, by their position in the file. Once the
+	// file is fully indexed these may be read from other threads while the
+	// document is being edited, unless it is paged.
+	[[nodiscard]] size_t OriginalLineCount() const
+	{
+		return paged ? sparse.Lines() : lineStarts.size();
+	}
+	[[nodiscard]] std::string_view OriginalLine(size_t index) const;
+
+	// How many lines from `at` on are consecutive unedited lines of the file,
+	// the first one being original line `index`. 0 for an edited line.
+	size_t OriginalRun(size_t at, size_t& index) const;
+
+	// The raw file and where its indexed lines start, OriginalOffset of the
+	// line after the last indexed one being the end of the indexed part.
+	[[nodiscard]] std::string_view OriginalBytes() const
+	{
+		return std::string_view(file.Data(), file.Size());
+	}
+	[[nodiscard]] size_t OriginalOffset(size_t index) const;
+	// Original line holding the indexed byte at `offset`
+	[[nodiscard]] size_t OriginalLineAt(size_t offset) const;
+
+	void InsertLine(size_t at, std::string_view chars);
+	void EraseLine(size_t at) { EraseLines(at, 1); }
+	void EraseLines(size_t at, size_t count);
+	void PushBack(std::string_view chars);
+	void Clear();
+
+	// Streams the whole document to `fd`, each line followed by the line
+	// ending. Returns -1 with errno set when writing fails.
+	int Write(int fd, size_t& written);
+
+	struct Piece
+	{
+		size_t at;    // first line in the document
+		size_t count; // lines
+		bool   original;
+		size_t start; // first original line, for original pieces
+	};
+
+	struct Memory
+	{
+		size_t           indexBytes; // starts of the original lines
+		size_t           pieceBytes; // the treap
+		LineStore::Usage store;
+	};
+
+	// What the buffer keeps on the heap, the mapped file aside
+	[[nodiscard]] Memory MemoryUsage() const;
+
+	// Appends the pieces of the document in order
+	void Pieces(std::vector<Piece>& out) const;
+
+private:
+	void CollectPieces(NodeId t, size_t at, std::vector<Piece>& out) const;
+};
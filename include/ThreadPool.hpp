@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads running tasks in submission order.
+//
+// Tasks are started strictly first in, first out, so a task may wait for
+// tasks that were submitted before it without deadlocking the pool.
+class ThreadPool
+{
+private:
+	std::vector<std::thread>          workers{};
+	std::queue<std::function<void()>> tasks{};
+	std::mutex                        mutex{};
+	std::condition_variable           available{};
+	bool                              stopping{ false };
+
+	void Work();
+
+public:
+	explicit ThreadPool(size_t threadCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	[[nodiscard]] size_t Size() const { return workers.size(); }
+
+	// Pool shared by the whole editor, sized to the hardware.
+	static ThreadPool& Shared();
+
+	template<typename F>
+	auto Submit(F&& task) -> std::future<std::invoke_result_t<F>>
+	{
+		using Result = std::invoke_result_t<F>;
+
+		auto packaged =
+		  std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		std::future<Result> result = packaged->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.emplace([packaged]() { (*packaged)(); });
+		}
+		available.notify_one();
+
+		return result;
+	}
+};
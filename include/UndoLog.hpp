@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, SIZE_MAX
+#include <deque>
+#include <memory>
+#include <string_view>
+
+// History of the edits made to a document, for undo and redo.
+//
+// Every edit is recorded as one primitive operation: a span of text inserted
+// or deleted at a position, a line split or joined, or a line appended at
+// the end. Spans may cross lines, so a paste is one record no matter how
+// many lines it has. The text of the records is kept in an arena of large
+// blocks rather than in a string per record. Undoing an insert only needs
+// its extent, so the text of a paste is held once, by the log, however
+// often it is undone and redone.
+//
+// Typing extends the last insert as long as it goes on where that one ended
+// and nothing else happened in between (see Seal). Once the log takes more
+// memory than its limit, the oldest operations are dropped along with the
+// blocks holding their text; the latest edit is always kept.
+//
+// The position in the log stands for the state of the document, so whether
+// the document is modified is whether the position is the one it was saved
+// at.
+class UndoLog
+{
+public:
+	enum class Kind : uint8_t
+	{
+		Insert,
+		Delete,
+		Split,      // a line break inserted at (row, column)
+		Join,       // the line break after (row, column) removed
+		AppendLine, // an empty line added at the end
+	};
+
+	struct Operation
+	{
+		Kind   kind{ Kind::Insert };
+		bool   withPrevious{ false }; // undone and redone along with it
+		bool   open{ false };         // typing may extend it, see Extend
+		size_t row{ 0 };              // where the span starts
+		size_t column{ 0 };
+		size_t endRow{ 0 }; // where it ends, with the text in place
+		size_t endColumn{ 0 };
+		size_t cursorRow{ 0 }; // the cursor before the edit
+		size_t cursorColumn{ 0 };
+		size_t block{ 0 }; // where the text is in the arena
+		size_t offset{ 0 };
+		size_t length{ 0 };
+	};
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data{};
+		size_t                  capacity{ 0 };
+		size_t                  used{ 0 };
+	};
+
+	static constexpr size_t unreachable{ SIZE_MAX };
+
+	std::deque<Operation> operations{};
+	std::deque<Block>     blocks{};
+	size_t                firstBlock{ 0 }; // number of blocks.front()
+	size_t                dropped{ 0 };    // operations evicted so far
+	size_t                position{ 0 };   // operations applied
+	size_t                saved{ 0 }; // dropped + position when last saved
+	size_t                limit{ 0 };
+	size_t                memory{ 0 }; // in blocks
+
+	void Store(std::string_view text, Operation& operation);
+	void Truncate();
+	void Evict();
+	void FreeBlocks();
+
+public:
+	explicit UndoLog(size_t limit)
+	  : limit(limit)
+	{
+	}
+
+	UndoLog(const UndoLog&) = delete;
+	UndoLog& operator=(const UndoLog&) = delete;
+
+	// Forgets all history, the document as it is counts as saved
+	void Clear();
+	void SetLimit(size_t bytes);
+
+	// Adds an operation that was just carried out, dropping whatever could
+	// have been redone. `text` is the span inserted or deleted.
+	void Record(Operation operation, std::string_view text);
+	// Appends a typed character to the last operation if that is an open
+	// insert ending at (row, column), and nothing was recorded or undone
+	// since
+	bool Extend(size_t row, size_t column, char c);
+	// Keeps the next edit from being merged into the last one
+	void Seal();
+
+	// The operation to revert or carry out again, nullptr if there is none.
+	// With `grouped` only one that goes along with the previous one.
+	const Operation* Undo();
+	const Operation* Redo(bool grouped = false);
+
+	[[nodiscard]] std::string_view Text(const Operation& operation) const;
+
+	void               MarkSaved();
+	// The saved file turned out not to hold the document
+	void               MarkUnsaved() { saved = unreachable; }
+	[[nodiscard]] bool Dirty() const { return dropped + position != saved; }
+
+	[[nodiscard]] size_t Memory() const
+	{
+		return memory + operations.size() * sizeof(Operation);
+	}
+	[[nodiscard]] size_t Size() const { return operations.size(); }
+};
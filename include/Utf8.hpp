@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <string_view>
+
+// Decoding of UTF-8 text and the number of terminal columns it takes.
+//
+// Widths follow East Asian Width: wide and fullwidth characters take two
+// columns, combining marks and other format characters none, everything
+// else one. They are looked up in a two-stage table covering the first two
+// planes, which is generated at compile time from the Unicode ranges, and
+// in the ranges themselves beyond that.
+//
+// Most text is ASCII, so SkipPlain finds the next byte needing any of this
+// a vector at a time.
+namespace utf8 {
+
+// Stands in for a byte that does not start a valid sequence
+inline constexpr char32_t invalid{ 0x110000 };
+
+// Whether `c` is a byte in the middle of a sequence
+inline bool
+IsContinuation(char c)
+{
+	return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Name of the ASCII scan selected for this CPU
+const char* Implementation();
+
+// First byte at or after `from` that is a tab or not ASCII, the size of
+// `text` if there is none
+size_t SkipPlain(std::string_view text, size_t from);
+
+// Decodes the character at `at` into `codepoint` and returns its length.
+// Overlong forms, surrogates and truncated sequences decode one byte at a
+// time to `invalid`.
+size_t Decode(std::string_view text, size_t at, char32_t& codepoint);
+
+// Columns taken by `codepoint`: 0, 1 or 2. Invalid bytes and control
+// characters are shown in one.
+int Width(char32_t codepoint);
+
+// Start of the character after / before the one at `at`, moving over the
+// combining marks that go with it
+size_t Next(std::string_view text, size_t at);
+size_t Previous(std::string_view text, size_t at);
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <vector>
+
+class MappedFile;
+
+// Keeps the part of a mapped file that is held in memory within a budget.
+//
+// The file is seen as a row of fixed-size windows. Reading through the
+// mapping brings a window in; Touch records that and asks for the window
+// after it ahead of time. Once more windows are in than the budget allows,
+// the least recently used ones are given back to the kernel, so the mapping
+// can be as large as the address space while the memory it takes stays put.
+// Views into a window that was given back stay valid, its pages are simply
+// read from the file again.
+class WindowPager
+{
+private:
+	const MappedFile*   file{ nullptr };
+	size_t              windowSize{ 0 };
+	size_t              capacity{ 0 };  // windows
+	std::vector<size_t> resident{}; // most recently used first
+
+	void Use(size_t window, bool ahead);
+
+public:
+	WindowPager() = default;
+
+	void Attach(const MappedFile* mapped, size_t window, size_t budget);
+	void Detach();
+	void SetBudget(size_t budget);
+
+	// Records a read of [offset, offset + length)
+	void Touch(size_t offset, size_t length);
+
+	[[nodiscard]] size_t Resident() const { return resident.size() * windowSize; }
+	[[nodiscard]] size_t Budget() const { return capacity * windowSize; }
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <charconv> // to_chars
+#include <cstddef>  // size_t
 #include <string>
 #include <array>
 
@@ -9,6 +11,39 @@ namespace defaults {
 inline constexpr int tabStop{ 3 };
 inline constexpr int quitTimes{ 3 };
 inline constexpr int messageWaitDuration{ 5 };
+// Files larger than this (in bytes) are indexed on the thread pool while the
+// first screen is already shown
+inline constexpr size_t backgroundIndexThreshold{ 4 << 20 };
+// Files larger than this are paged rather than indexed line by line,
+// overridden by KJ_HUGE_FILE (in MiB)
+inline constexpr size_t hugeFileThreshold{ size_t{ 1 } << 30 };
+// Memory the pages of such a file may take, overridden by KJ_PAGE_BUDGET
+// (in MiB), and the windows it is paged in
+inline constexpr size_t pageBudget{ size_t{ 256 } << 20 };
+inline constexpr size_t pageWindow{ 4 << 20 };
+// Address space set aside for the decompressed text of a compressed file,
+// which is also as large as it may get
+inline constexpr size_t streamReserve{ size_t{ 1 } << 40 };
+// Lines between two line starts a paged file keeps
+inline constexpr size_t checkpointInterval{ 1024 };
+// Rendered lines kept around, a few screens worth
+inline constexpr size_t renderCacheLines{ 1024 };
+// Milliseconds to wait for the rest of an escape sequence before taking a
+// lone escape byte as the Escape key, overridden by ESCDELAY
+inline constexpr int escapeTimeout{ 25 };
+// Longest time in milliseconds spent handling queued input before a frame is
+// drawn, so that a steady stream of input still shows progress
+inline constexpr int inputBurstDuration{ 50 };
+// Milliseconds between two frames showing the progress of loading while an
+// action waits for the whole file
+inline constexpr int progressInterval{ 100 };
+// Milliseconds between two syncs of the journal of unsaved edits
+inline constexpr int journalSyncInterval{ 1000 };
+// Bytes searched between two checks for input that cancels a search
+inline constexpr size_t searchWindow{ 1 << 20 };
+// Memory the undo history may take before the oldest edits are forgotten,
+// overridden by KJ_UNDO_LIMIT (in MiB)
+inline constexpr size_t undoMemoryLimit{ size_t{ 64 } << 20 };
 }
 }
 
@@ -36,6 +71,12 @@ inline const char* cursorMaxDown = "\x1b[999B";
 inline const char* cursorMaxForwardAndDown = "\x1b[999C\x1b[999B";
 inline const char* cursorRepositionLeftmostTop = "\x1b[H";
 inline const char* clearEntireScreen = "\x1b[2J";
+// Pasted text arrives between "\x1b[200~" and "\x1b[201~"
+inline const char* enableBracketedPaste = "\x1b[?2004h";
+inline const char* disableBracketedPaste = "\x1b[?2004l";
+// Clicks and wheel as SGR reports, "\x1b[<b;x;yM"
+inline const char* enableMouse = "\x1b[?1000h\x1b[?1006h";
+inline const char* disableMouse = "\x1b[?1006l\x1b[?1000l";
 namespace color {
 inline const char* reset = "\x1b[m";
 inline const char* reverse = "\x1b[7m";
@@ -45,6 +86,19 @@ getEscapeSequence(int color)
 {
 	return std::string("\x1b[" + std::to_string(color) + "m");
 }
+inline void
+appendEscapeSequence(std::string& out, int color)
+{
+	std::array<char, 16> sequence{ '\x1b', '[' };
+
+	char* at = std::to_chars(sequence.data() + 2,
+	                         sequence.data() + sequence.size() - 1,
+	                         color)
+	             .ptr;
+	*at++ = 'm';
+
+	out.append(sequence.data(), at - sequence.data());
+}
 }
 namespace deviceStatusReport {
 inline const char* cursorPosition = "\x1b[6n";
@@ -0,0 +1,46 @@
+#include <cstdlib> // malloc, free
+#include <new>     // bad_alloc
+
+#include "AllocationCounter.hpp"
+
+namespace {
+thread_local size_t allocations{ 0 };
+thread_local size_t allocatedBytes{ 0 };
+}
+
+size_t
+AllocationCounter::Allocations()
+{
+	return allocations;
+}
+
+size_t
+AllocationCounter::Bytes()
+{
+	return allocatedBytes;
+}
+
+void*
+operator new(std::size_t size)
+{
+	allocations++;
+	allocatedBytes += size;
+
+	void* block = std::malloc(size != 0 ? size : 1);
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+void
+operator delete(void* block) noexcept
+{
+	std::free(block);
+}
+
+void
+operator delete(void* block, std::size_t /*size*/) noexcept
+{
+	std::free(block);
+}
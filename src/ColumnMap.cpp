@@ -0,0 +1,199 @@
+#include <algorithm> // min, upper_bound
+
+#include "ColumnMap.hpp"
+#include "constants.hpp"
+#include "Utf8.hpp"
+
+namespace {
+
+size_t
+Slot(uint64_t key, size_t size)
+{
+	return static_cast<size_t>(key * 0x9e3779b97f4a7c15ULL >> 32) & (size - 1);
+}
+
+}
+
+ColumnMap::ColumnMap(size_t lines)
+{
+	size_t size = 1;
+	while (size < lines) {
+		size <<= 1;
+	}
+	entries.resize(size);
+}
+
+void
+ColumnMap::Build(std::string_view chars, Entry& entry)
+{
+	std::vector<Stop>& stops = entry.stops;
+	stops.clear();
+
+	// A tab takes at least one column and runs up to the next tab stop
+	const size_t tabStop = kilojoule::defaults::tabStop;
+
+	size_t column = 0;
+	size_t render = 0; // of `column`
+	size_t expanded = 0;
+	for (size_t at = utf8::SkipPlain(chars, 0); at < chars.size();
+	     at = utf8::SkipPlain(chars, column)) {
+		render += at - column;
+
+		if (chars[at] == '\t') {
+			size_t width = tabStop - render % tabStop;
+
+			render += width;
+			expanded += width - 1;
+			column = at + 1;
+			stops.push_back(Stop{
+			  at, column, render, expanded, static_cast<uint32_t>(width), 0 });
+			continue;
+		}
+
+		char32_t codepoint = 0;
+		size_t   length = utf8::Decode(chars, at, codepoint);
+		auto     width = static_cast<uint32_t>(utf8::Width(codepoint));
+
+		render += width;
+		column = at + length;
+
+		// Characters like the one before it join its run
+		if (!stops.empty() && stops.back().end == at &&
+		    stops.back().length == length && stops.back().width == width) {
+			stops.back().end = column;
+			stops.back().render = render;
+		} else {
+			stops.push_back(Stop{
+			  at, column, render, expanded, width, static_cast<uint8_t>(length) });
+		}
+	}
+}
+
+const std::vector<ColumnMap::Stop>&
+ColumnMap::Stops(uint64_t key, std::string_view chars)
+{
+	Entry& entry = entries[Slot(key, entries.size())];
+
+	if (entry.key != key) {
+		Build(chars, entry);
+		entry.key = key;
+	}
+
+	return entry.stops;
+}
+
+size_t
+ColumnMap::ToRender(uint64_t key, std::string_view chars, size_t column)
+{
+	const std::vector<Stop>& stops = Stops(key, chars);
+
+	column = std::min(column, chars.size());
+
+	// The first run ending after the column, which holds it if it starts at
+	// or before it
+	auto run = std::upper_bound(
+	  stops.begin(), stops.end(), column, [](size_t column, const Stop& stop) {
+		  return column < stop.end;
+	  });
+	if (run != stops.end() && run->start <= column) {
+		size_t start = RenderStart(*run);
+		if (run->length == 0) {
+			return start;
+		}
+		return start + (column - run->start) / run->length * run->width;
+	}
+
+	if (run == stops.begin()) {
+		return column;
+	}
+	const Stop& before = *(run - 1);
+	return before.render + (column - before.end);
+}
+
+size_t
+ColumnMap::ToColumn(uint64_t key, std::string_view chars, size_t render)
+{
+	const std::vector<Stop>& stops = Stops(key, chars);
+
+	// The first run ending past `render`, which covers it if it starts at or
+	// before it
+	auto run = std::upper_bound(
+	  stops.begin(), stops.end(), render, [](size_t render, const Stop& stop) {
+		  return render < stop.render;
+	  });
+	if (run != stops.end() && RenderStart(*run) <= render) {
+		if (run->length == 0) {
+			return run->start;
+		}
+		return run->start +
+		       (render - RenderStart(*run)) / run->width * run->length;
+	}
+
+	size_t column = 0;
+	size_t start = 0; // render column of `column`
+	if (run != stops.begin()) {
+		column = (run - 1)->end;
+		start = (run - 1)->render;
+	}
+
+	return std::min(column + (render - start), chars.size());
+}
+
+size_t
+ColumnMap::ToOffset(uint64_t key, std::string_view chars, size_t column)
+{
+	const std::vector<Stop>& stops = Stops(key, chars);
+
+	column = std::min(column, chars.size());
+
+	// Only the tabs before the character make the render longer
+	auto run = std::upper_bound(
+	  stops.begin(), stops.end(), column, [](size_t column, const Stop& stop) {
+		  return column < stop.end;
+	  });
+	return run == stops.begin() ? column : column + (run - 1)->expanded;
+}
+
+size_t
+ColumnMap::VisibleFrom(uint64_t         key,
+                       std::string_view chars,
+                       size_t           render,
+                       size_t&          offset)
+{
+	size_t column = ToColumn(key, chars, render);
+	size_t start = ToRender(key, chars, column);
+
+	offset = ToOffset(key, chars, column);
+	if (start == render || column == chars.size()) {
+		return render;
+	}
+
+	// The spaces of a tab can be shown in part
+	if (chars[column] == '\t') {
+		offset += render - start;
+		return render;
+	}
+
+	// A wide character cut in half is left out
+	column = utf8::Next(chars, column);
+	offset = ToOffset(key, chars, column);
+	return ToRender(key, chars, column);
+}
+
+void
+ColumnMap::Invalidate(uint64_t key)
+{
+	Entry& entry = entries[Slot(key, entries.size())];
+
+	if (entry.key == key) {
+		entry.key = UINT64_MAX;
+	}
+}
+
+void
+ColumnMap::Clear()
+{
+	for (Entry& entry : entries) {
+		entry.key = UINT64_MAX;
+	}
+}
@@ -0,0 +1,597 @@
+#include <array>
+#include <cerrno> // for EBADMSG, ECANCELED, EFBIG, EINTR, ENOMEM, errno
+#include <chrono>
+#include <cstdio>  // fopen, fread
+#include <cstdlib> // getenv, mkstemp
+#include <string>
+#include <utility> // move
+#include <vector>
+
+// The codecs work on file descriptors
+#if !defined(__linux__)
+#undef KJ_HAVE_ZLIB
+#undef KJ_HAVE_ZSTD
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>    // for open, posix_fadvise, O_RDONLY, O_TMPFILE
+#include <sys/stat.h> // for fstat
+#include <unistd.h>   // for close, pread, read, unlink, write
+#endif
+
+#if defined(KJ_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(KJ_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "constants.hpp"
+#include "Compression.hpp"
+
+namespace {
+constexpr size_t inputBuffer{ 256 << 10 };
+constexpr size_t outputBuffer{ 1 << 20 };
+
+constexpr std::array<unsigned char, 2> gzipMagic{ 0x1f, 0x8b };
+constexpr std::array<unsigned char, 4> zstdMagic{ 0x28, 0xb5, 0x2f, 0xfd };
+
+using Emit = std::function<bool(const char*, size_t)>;
+
+#if defined(KJ_HAVE_ZLIB) || defined(KJ_HAVE_ZSTD)
+ssize_t
+ReadSome(int fd, char* buffer, size_t length)
+{
+	ssize_t count = 0;
+	do {
+		count = read(fd, buffer, length);
+	} while (count == -1 && errno == EINTR);
+	return count;
+}
+
+int
+WriteAll(int fd, const char* data, size_t length)
+{
+	while (length > 0) {
+		ssize_t count = write(fd, data, length);
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += count;
+		length -= static_cast<size_t>(count);
+	}
+	return 0;
+}
+#endif
+
+#if defined(KJ_HAVE_ZLIB)
+// Concatenated gzip members make up one file, as with gunzip. Returns the
+// errno that ended it early, 0 if it went to the end.
+int
+Inflate(int fd, std::atomic<size_t>& consumed, const Emit& emit)
+{
+	std::vector<char> in(inputBuffer);
+	std::vector<char> out(outputBuffer);
+	z_stream          stream{};
+
+	if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+		return ENOMEM;
+	}
+
+	int  failure = 0;
+	bool ended = false; // the last member is complete
+
+	while (failure == 0) {
+		ssize_t count = ReadSome(fd, in.data(), in.size());
+		if (count <= 0) {
+			failure = count == -1 ? errno : ended ? 0 : EBADMSG;
+			break;
+		}
+		consumed += static_cast<size_t>(count);
+
+		stream.next_in = reinterpret_cast<Bytef*>(in.data());
+		stream.avail_in = static_cast<uInt>(count);
+
+		while (stream.avail_in > 0 && failure == 0) {
+			if (ended) {
+				inflateReset(&stream);
+			}
+
+			stream.next_out = reinterpret_cast<Bytef*>(out.data());
+			stream.avail_out = static_cast<uInt>(out.size());
+
+			int result = inflate(&stream, Z_NO_FLUSH);
+			if (result != Z_OK && result != Z_STREAM_END) {
+				// Padding after a complete member is not another one
+				failure = ended ? -1 : EBADMSG;
+				break;
+			}
+			ended = result == Z_STREAM_END;
+
+			size_t have = out.size() - stream.avail_out;
+			if (have > 0 && !emit(out.data(), have)) {
+				failure = errno;
+			}
+		}
+	}
+
+	inflateEnd(&stream);
+	return failure == -1 ? 0 : failure;
+}
+
+int
+Deflate(int in, int out)
+{
+	std::vector<char> input(inputBuffer);
+	std::vector<char> output(outputBuffer);
+	z_stream          stream{};
+
+	// 16 more window bits ask for a gzip header instead of a zlib one
+	if (deflateInit2(&stream,
+	                 Z_DEFAULT_COMPRESSION,
+	                 Z_DEFLATED,
+	                 15 + 16,
+	                 8,
+	                 Z_DEFAULT_STRATEGY) != Z_OK) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int  result = Z_OK;
+	bool failed = false;
+
+	while (result != Z_STREAM_END && !failed) {
+		ssize_t count = ReadSome(in, input.data(), input.size());
+		if (count == -1) {
+			failed = true;
+			break;
+		}
+
+		stream.next_in = reinterpret_cast<Bytef*>(input.data());
+		stream.avail_in = static_cast<uInt>(count);
+
+		do {
+			stream.next_out = reinterpret_cast<Bytef*>(output.data());
+			stream.avail_out = static_cast<uInt>(output.size());
+
+			result = deflate(&stream, count == 0 ? Z_FINISH : Z_NO_FLUSH);
+			if (WriteAll(out,
+			             output.data(),
+			             output.size() - stream.avail_out) == -1) {
+				failed = true;
+				break;
+			}
+		} while (stream.avail_out == 0);
+	}
+
+	int error = errno;
+	deflateEnd(&stream);
+	errno = error;
+	return failed ? -1 : 0;
+}
+#endif
+
+#if defined(KJ_HAVE_ZSTD)
+// Concatenated frames make up one file, as with zstd -d
+int
+ZstdDecompress(int fd, std::atomic<size_t>& consumed, const Emit& emit)
+{
+	std::vector<char> in(inputBuffer);
+	std::vector<char> out(outputBuffer);
+	ZSTD_DStream*     stream = ZSTD_createDStream();
+
+	if (stream == nullptr) {
+		return ENOMEM;
+	}
+	ZSTD_initDStream(stream);
+
+	int    failure = 0;
+	size_t pending = 0; // not 0 while a frame is incomplete
+
+	while (failure == 0) {
+		ssize_t count = ReadSome(fd, in.data(), in.size());
+		if (count <= 0) {
+			failure = count == -1 ? errno : pending != 0 ? EBADMSG : 0;
+			break;
+		}
+		consumed += static_cast<size_t>(count);
+
+		ZSTD_inBuffer input{ in.data(), static_cast<size_t>(count), 0 };
+		bool          full = false;
+
+		// A full output buffer may leave output behind without any input
+		while ((input.pos < input.size || full) && failure == 0) {
+			ZSTD_outBuffer output{ out.data(), out.size(), 0 };
+
+			pending = ZSTD_decompressStream(stream, &output, &input);
+			if (ZSTD_isError(pending) != 0) {
+				failure = EBADMSG;
+				break;
+			}
+			if (output.pos > 0 && !emit(out.data(), output.pos)) {
+				failure = errno;
+			}
+			full = output.pos == output.size;
+		}
+	}
+
+	ZSTD_freeDStream(stream);
+	return failure;
+}
+
+int
+ZstdCompress(int in, int out)
+{
+	std::vector<char> input(inputBuffer);
+	std::vector<char> output(outputBuffer);
+	ZSTD_CCtx*        context = ZSTD_createCCtx();
+
+	if (context == nullptr) {
+		errno = ENOMEM;
+		return -1;
+	}
+	ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, 3);
+
+	bool failed = false;
+	bool last = false;
+
+	while (!last && !failed) {
+		ssize_t count = ReadSome(in, input.data(), input.size());
+		if (count == -1) {
+			failed = true;
+			break;
+		}
+
+		last = count == 0;
+		ZSTD_inBuffer     source{ input.data(), static_cast<size_t>(count), 0 };
+		ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+		bool              finished = false;
+
+		while (!finished) {
+			ZSTD_outBuffer target{ output.data(), output.size(), 0 };
+
+			size_t remaining =
+			  ZSTD_compressStream2(context, &target, &source, mode);
+			if (ZSTD_isError(remaining) != 0) {
+				errno = ENOMEM;
+				failed = true;
+				break;
+			}
+			if (WriteAll(out, output.data(), target.pos) == -1) {
+				failed = true;
+				break;
+			}
+			finished = last ? remaining == 0 : source.pos == source.size;
+		}
+	}
+
+	int error = errno;
+	ZSTD_freeCCtx(context);
+	errno = error;
+	return failed ? -1 : 0;
+}
+#endif
+}
+
+Codec
+compression::Detect(const char* filename)
+{
+	std::array<unsigned char, 4> magic{};
+
+	FILE* file = std::fopen(filename, "rb");
+	if (file == nullptr) {
+		return Codec::None;
+	}
+	size_t count = std::fread(magic.data(), 1, magic.size(), file);
+	std::fclose(file);
+
+	if (count >= gzipMagic.size() && magic[0] == gzipMagic[0] &&
+	    magic[1] == gzipMagic[1]) {
+		return Codec::Gzip;
+	}
+	if (count >= zstdMagic.size() && magic == zstdMagic) {
+		return Codec::Zstd;
+	}
+	return Codec::None;
+}
+
+bool
+compression::Supported(Codec codec)
+{
+	switch (codec) {
+		case Codec::None:
+			return true;
+		case Codec::Gzip:
+#if defined(KJ_HAVE_ZLIB)
+			return true;
+#else
+			return false;
+#endif
+		case Codec::Zstd:
+#if defined(KJ_HAVE_ZSTD)
+			return true;
+#else
+			return false;
+#endif
+	}
+	return false;
+}
+
+const char*
+compression::Name(Codec codec)
+{
+	switch (codec) {
+		case Codec::None:
+			break;
+		case Codec::Gzip:
+			return "gzip";
+		case Codec::Zstd:
+			return "zstd";
+	}
+	return "plain";
+}
+
+int
+compression::TemporaryFile()
+{
+#if defined(__linux__)
+	const char* directory = std::getenv("TMPDIR");
+	if (directory == nullptr || *directory == '\0') {
+		directory = "/var/tmp";
+	}
+
+#if defined(O_TMPFILE)
+	int fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd != -1) {
+		return fd;
+	}
+#endif
+
+	// Without O_TMPFILE support in the file system
+	std::string path = std::string(directory) + "/kj-XXXXXX";
+	int         named = mkstemp(path.data());
+	if (named != -1) {
+		unlink(path.c_str());
+	}
+	return named;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+compression::Compress(int in, int out, Codec codec)
+{
+#if defined(__linux__)
+	if (lseek(in, 0, SEEK_SET) == -1) {
+		return -1;
+	}
+#endif
+
+	switch (codec) {
+#if defined(KJ_HAVE_ZLIB)
+		case Codec::Gzip:
+			return Deflate(in, out);
+#endif
+#if defined(KJ_HAVE_ZSTD)
+		case Codec::Zstd:
+			return ZstdCompress(in, out);
+#endif
+		default:
+			(void)out;
+			errno = ENOSYS;
+			return -1;
+	}
+}
+
+Decompressor::~Decompressor()
+{
+	Stop();
+}
+
+int
+Decompressor::Start(const char*           filename,
+                    Codec                 codec,
+                    size_t                limit,
+                    std::function<void()> onProgress)
+{
+	Stop();
+
+#if defined(__linux__)
+	if (!compression::Supported(codec) || codec == Codec::None) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	inputFd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (inputFd == -1) {
+		return -1;
+	}
+
+	struct stat st
+	{};
+	outputFd = fstat(inputFd, &st) == -1 ? -1 : compression::TemporaryFile();
+	if (outputFd == -1) {
+		int failure = errno;
+		Stop();
+		errno = failure;
+		return -1;
+	}
+	posix_fadvise(inputFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	inputSize = static_cast<size_t>(st.st_size);
+	this->limit = limit;
+	consumed = 0;
+	produced = 0;
+	cancelled = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done = false;
+		error = 0;
+	}
+
+	worker = std::thread([this, codec, onProgress = std::move(onProgress)]() {
+		Run(codec, onProgress);
+	});
+	return 0;
+#else
+	(void)filename;
+	(void)codec;
+	(void)limit;
+	(void)onProgress;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void
+Decompressor::Stop()
+{
+	if (worker.joinable()) {
+		cancelled = true;
+		worker.join();
+	}
+
+#if defined(__linux__)
+	if (inputFd != -1) {
+		close(inputFd);
+	}
+	if (outputFd != -1) {
+		close(outputFd);
+	}
+#endif
+
+	inputFd = -1;
+	outputFd = -1;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	done = true;
+}
+
+bool
+Decompressor::Output(const char* data, size_t length)
+{
+#if defined(__linux__)
+	if (cancelled) {
+		errno = ECANCELED;
+		return false;
+	}
+	if (produced + length > limit) {
+		errno = EFBIG;
+		return false;
+	}
+
+	while (length > 0) {
+		ssize_t count = write(outputFd, data, length);
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		data += count;
+		length -= static_cast<size_t>(count);
+		produced += static_cast<size_t>(count);
+	}
+	return true;
+#else
+	(void)data;
+	(void)length;
+	return false;
+#endif
+}
+
+void
+Decompressor::Publish(bool                         last,
+                      int                          failure,
+                      const std::function<void()>& onProgress)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done = last;
+		error = failure;
+	}
+
+	progress.notify_all();
+	if (onProgress) {
+		onProgress();
+	}
+}
+
+// Decompresses on the worker thread. The first output is published right
+// away, so the first screen can be shown, and the rest every progress
+// interval.
+void
+Decompressor::Run(Codec codec, const std::function<void()>& onProgress)
+{
+	using Clock = std::chrono::steady_clock;
+
+	auto interval =
+	  std::chrono::milliseconds(kilojoule::defaults::progressInterval);
+	auto lastPublished = Clock::time_point{};
+
+	Emit emit = [&](const char* data, size_t length) {
+		if (!Output(data, length)) {
+			return false;
+		}
+
+		Clock::time_point now = Clock::now();
+		if (now - lastPublished >= interval) {
+			lastPublished = now;
+			Publish(false, 0, onProgress);
+		}
+		return true;
+	};
+
+	int failure = ENOSYS;
+	switch (codec) {
+#if defined(KJ_HAVE_ZLIB)
+		case Codec::Gzip:
+			failure = Inflate(inputFd, consumed, emit);
+			break;
+#endif
+#if defined(KJ_HAVE_ZSTD)
+		case Codec::Zstd:
+			failure = ZstdDecompress(inputFd, consumed, emit);
+			break;
+#endif
+		default:
+			(void)emit;
+			break;
+	}
+
+	Publish(true, failure, onProgress);
+}
+
+size_t
+Decompressor::Progress() const
+{
+	return inputSize > 0 ? consumed * 100 / inputSize : 100;
+}
+
+bool
+Decompressor::Done()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return done;
+}
+
+int
+Decompressor::Error()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return error;
+}
+
+void
+Decompressor::Wait(size_t bytes)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	progress.wait(lock, [this, bytes]() { return done || produced > bytes; });
+}
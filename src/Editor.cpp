@@ -2,80 +2,248 @@
 #include <cstring>
 #include <cstdlib> // free
 #include <cstdarg> // va_start va_end
+#include <cstdint> // SIZE_MAX
+#include <csignal> // SIGWINCH
 // uncomment to disable assert()
+#ifndef NDEBUG
 #define NDEBUG
+#endif
 #include <cassert>
-#include <fstream>
+#include <algorithm> // copy_n, fill, min
+#include <array>
+#include <charconv> // to_chars
+#include <chrono>
 #include <string>
 
 #if defined(__linux__)
+#include <fcntl.h>    // for open, O_DIRECTORY, O_RDONLY
+#include <sys/stat.h> // for stat, fchmod, umask
 #include <unistd.h>
 #endif
 
 #include "constants.hpp"
 #include "Editor.hpp"
+#include "Instrumentation.hpp"
 #include "Terminal.hpp"
+#include "ThreadPool.hpp"
+#include "Utf8.hpp"
 
 #define CTRL_KEY(k) ((k)&0x1f)
 
+Editor::~Editor()
+{
+	// The compressing task only touches its own copies and files, but the
+	// file should be in place before the editor is gone
+	if (pendingSave.valid()) {
+		pendingSave.wait();
+	}
+}
+
 int
 Editor::Init(std::shared_ptr<Terminal> term)
 {
 	terminal = term;
 
+	// Without a terminal nothing is drawn until Resize gives a size
 	if (terminal == nullptr) {
-		screenRows = 0;
-		screenCols = 0;
+		Resize(0, 0);
 	} else {
-		screenRows = terminal->GetRows();
-		screenCols = terminal->GetColumns();
+		Resize(terminal->GetRows(), terminal->GetColumns());
 	}
 
-	// Adjust for the status prompt
-	screenRows -= 2;
+	rows.OnIndexed([this]() { wakeup.Notify(); });
+
+	if (terminal != nullptr) {
+		events.Add(wakeup.Fd(), [this]() {
+			wakeup.Drain();
+			redraw = true;
+		});
+
+		events.Add(STDIN_FILENO, [this]() {
+			if (input.Fill(STDIN_FILENO) == -1) {
+				shouldClose = true;
+			}
+			Instrumentation::InputRead();
+		});
+
+		// However many signals a resize sends before the next frame, the size
+		// is only read and drawn once
+		resizeSignal = std::make_unique<SignalEvent>(SIGWINCH);
+		events.Add(resizeSignal->Fd(), [this]() {
+			resizeSignal->Drain();
+			resized = true;
+			redraw = true;
+		});
+	}
 
 	return 0;
 }
 
+// The text area takes all rows but the status bar and the message bar.
+// Rendered lines do not depend on the size and stay cached; the next frame
+// is drawn in full, the terminal may have rearranged what was on it.
+void
+Editor::Resize(size_t rows, size_t columns)
+{
+	screenRows = rows > 2 ? rows - 2 : 0;
+	screenCols = columns;
+
+	screen.Resize(screenRows + 2, screenCols);
+}
+
 void
 Editor::RefreshScreen()
 {
-	if (terminal == nullptr) {
+	if (terminal == nullptr && !output) {
 		return;
 	}
 
+	Instrumentation::Frame frame{};
+
+	redraw = false;
+
+	if (resized) {
+		resized = false;
+		if (terminal->GetWindowSize() == 0 &&
+		    (static_cast<size_t>(terminal->GetRows()) != screenRows + 2 ||
+		     static_cast<size_t>(terminal->GetColumns()) != screenCols)) {
+			Resize(terminal->GetRows(), terminal->GetColumns());
+		}
+	}
+
 	Scroll();
+	frame.Lap(Phase::Scroll);
+
+	screen.Clear();
+
+	DrawRows(screen);
+	frame.Lap(Phase::DrawRows);
+	DrawStatusBar(screen);
+	frame.Lap(Phase::DrawStatusBar);
+	DrawMessageBar(screen);
+	frame.Lap(Phase::DrawMessageBar);
+
+	screen.SetCursor(cursorRow - rowOffset, cursorRenderColumn - columnOffset);
+
+	// Only the cells that differ from the previous frame are written
+	const std::string& textBuffer = screen.Flush(frameStats);
+	frame.Lap(Phase::Flush);
+
+	frameStats.keystrokes = keystrokes;
+	keystrokes = 0;
+
+	if (!textBuffer.empty()) {
+		if (output) {
+			output(textBuffer);
+		} else {
+			terminal->Write(textBuffer);
+		}
+	}
+	frame.Lap(Phase::Write);
+
+	frame.Done(frameStats);
+}
+
+// Blocks until a whole event has been decoded, or until background work asks
+// for a redraw. An unfinished escape sequence is given escapeTimeout
+// milliseconds to complete, however often a signal or a wakeup cuts the wait
+// short.
+bool
+Editor::ReadEvent(InputEvent& event)
+{
+	using Clock = std::chrono::steady_clock;
+
+	bool              partial = false;
+	Clock::time_point deadline{};
+
+	while (!shouldClose) {
+		if (input.Next(event, false)) {
+			return true;
+		}
+		if (redraw) {
+			return false;
+		}
 
-	std::string textBuffer{};
+		if (!input.HasPartial()) {
+			partial = false;
+			events.RunOnce(-1);
+			continue;
+		}
 
-	textBuffer.append(escapeSequences::hideCursor);
-	textBuffer.append(escapeSequences::cursorRepositionLeftmostTop);
+		Clock::time_point now = Clock::now();
+		if (!partial) {
+			partial = true;
+			deadline = now + std::chrono::milliseconds(escapeTimeout);
+		}
+		if (now >= deadline) {
+			return input.Next(event, true);
+		}
 
-	DrawRows(textBuffer);
-	DrawStatusBar(textBuffer);
-	DrawMessageBar(textBuffer);
+		// Rounded up, so the wait does not end just before the deadline
+		auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+		events.RunOnce(static_cast<int>(left.count()));
+	}
 
-	textBuffer.append(Terminal::SetCursorPositionEscapeSequence(
-	  (cursorRow - rowOffset) + 1, (cursorRenderColumn - columnOffset) + 1));
-	textBuffer.append(escapeSequences::showCursor);
+	return false;
+}
 
-	terminal->Write(textBuffer);
+// Takes the next event if one can be had without waiting
+bool
+Editor::PollEvent(InputEvent& event)
+{
+	if (input.Next(event, false)) {
+		return true;
+	}
+	return events.RunOnce(0) > 0 && input.Next(event, false);
 }
 
+// Handles everything that is pending before the next frame is drawn, so a
+// burst of keys or a paste costs one redraw instead of one per key.
 void
 Editor::ProcessKeypress()
 {
-	if (terminal == nullptr) {
+	if (terminal == nullptr || !ReadEvent(inputEvent)) {
 		return;
 	}
 
+	auto burstEnd = std::chrono::steady_clock::now() +
+	                std::chrono::milliseconds(
+	                  kilojoule::defaults::inputBurstDuration);
+
+	do {
+		ProcessEvent(inputEvent);
+		keystrokes++;
+	} while (!shouldClose && std::chrono::steady_clock::now() < burstEnd &&
+	         PollEvent(inputEvent));
+}
+
+void
+Editor::ProcessEvent(const InputEvent& event)
+{
+	switch (event.type) {
+		case InputType::Key:
+			ProcessKey(event.key, event.modifiers);
+			break;
+		case InputType::Paste:
+			ProcessPaste(event.text);
+			break;
+		case InputType::Mouse:
+			history.Seal();
+			ProcessMouse(event);
+			break;
+	}
+}
+
+void
+Editor::ProcessKey(int c, uint8_t modifiers)
+{
 	static int quit_times = kilojoule::defaults::quitTimes;
 
-	int c = Terminal::Read();
+	bool typed = false;
 
 	switch (c) {
 		case CTRL_KEY('q'):
-			if (dirtyFlag && quit_times > 0) {
+			if (history.Dirty() && quit_times > 0) {
 				SetStatusMessage("WARNING!!! File has unsaved changes. "
 				                 "Press Ctrl-Q %d more times to quit.",
 				                 quit_times);
@@ -83,20 +251,52 @@ Editor::ProcessKeypress()
 				return;
 			}
 
-			terminal->Write(escapeSequences::clearEntireScreen, 4);
-			terminal->Write(escapeSequences::cursorRepositionLeftmostTop, 3);
+			if (terminal != nullptr) {
+				terminal->Write(escapeSequences::clearEntireScreen, 4);
+				terminal->Write(escapeSequences::cursorRepositionLeftmostTop,
+				                3);
+			}
 
 			shouldClose = true;
 			break;
 		case '\r':
 			InsertNewline();
 			break;
+		case CTRL_KEY('s'):
+			Save();
+			break;
+		case CTRL_KEY('f'):
+			Find(false);
+			break;
+		case CTRL_KEY('r'):
+			Find(true);
+			break;
+		case CTRL_KEY('g'):
+			GoTo();
+			break;
+		case CTRL_KEY('t'):
+			Follow(!following);
+			break;
+		case CTRL_KEY('z'):
+			Undo();
+			break;
+		case CTRL_KEY('y'):
+			Redo();
+			break;
+		case Key::Backspace:
+		case CTRL_KEY('h'):
+		case Key::Del:
+			if (c == Key::Del) {
+				MoveCursor(Key::ArrowRight);
+			}
+			DelChar();
+			break;
 		case Key::Home:
 			cursorColumn = 0;
 			break;
 		case Key::End:
-			if (cursorRow < rows.size()) {
-				cursorColumn = rows[cursorRow].chars.size();
+			if (cursorRow < rows.LineCount()) {
+				cursorColumn = rows.Line(cursorRow).size();
 			}
 			break;
 		case Key::ArrowUp:
@@ -105,196 +305,404 @@ Editor::ProcessKeypress()
 		case Key::ArrowRight:
 			MoveCursor(c);
 			break;
+		case Key::PageUp:
+		case Key::PageDown:
+			for (size_t i = 0; i < screenRows; i++) {
+				MoveCursor(c == Key::PageUp ? Key::ArrowUp : Key::ArrowDown);
+			}
+			break;
+		case Key::F11:
+			MemoryReport();
+			break;
+		case Key::F12:
+			if (!Instrumentation::enabled) {
+				SetStatusMessage("Built without instrumentation (KJ_INSTRUMENT)");
+			}
+			showStats = Instrumentation::enabled && !showStats;
+			break;
 		case CTRL_KEY('l'):
 		case '\x1b':
 			break;
 		default:
+			// Alt chords and function keys have no binding (yet)
+			if (c < Key::ArrowLeft && (modifiers & Modifier::Alt) == 0) {
+				InsertChar(c);
+				typed = true;
+			}
 			break;
 	}
 
+	// Only typing straight on is merged into one undo operation
+	if (!typed) {
+		history.Seal();
+	}
+
 	quit_times = kilojoule::defaults::quitTimes;
 }
 
+void
+Editor::ProcessPaste(std::string_view text)
+{
+	InsertText(text);
+}
+
+void
+Editor::ProcessMouse(const InputEvent& event)
+{
+	if (!event.pressed) {
+		return;
+	}
+
+	switch (event.button) {
+		case MouseButton::WheelUp:
+		case MouseButton::WheelDown:
+			for (int i = 0; i < 3; i++) {
+				MoveCursor(event.button == MouseButton::WheelUp ? Key::ArrowUp
+				                                                : Key::ArrowDown);
+			}
+			break;
+		case MouseButton::Left:
+			// Clicks on the status and message bars are ignored
+			if (event.row == 0 || event.row > screenRows || event.column == 0) {
+				break;
+			}
+
+			rows.EnsureLines(rowOffset + event.row);
+			if (rows.Empty()) {
+				break;
+			}
+
+			cursorRow = std::min(rowOffset + event.row - 1, rows.LineCount() - 1);
+			cursorColumn = RowRxToCx(cursorRow, columnOffset + event.column - 1);
+			break;
+		default:
+			break;
+	}
+}
+
 std::vector<std::string> logo = { " _    _ ", "| |  (_)", "| | ___ ",
 	                                "| |/ / |", "|   <| |", "|_|\\_\\ |",
 	                                "    _/ |", "   |__/ " };
 
 void
-Editor::DrawRows(std::string& ab) const
+Editor::DrawRows(Screen& out) const
 {
 	int logoPadding = (screenRows / 2) - logo.size() - 2;
 
+	// Rows before which the state is not known yet are drawn plain
+	bool highlighted = syntax != nullptr;
+
 	for (size_t y = 0; y < screenRows; y++) {
 		size_t filerow = y + rowOffset;
 
-		if (filerow >= rows.size()) {
-			if (rows.empty() && y == screenRows / 2) {
+		if (filerow >= rows.LineCount()) {
+			if (rows.Empty() && y == screenRows / 2) {
 				// Version info
-				std::string welcome{ "KiloJoule editor -- version " };
-				welcome.append(kilojoule::version);
+				std::string_view welcome{ "KiloJoule editor -- version " };
+				std::string_view version{ kilojoule::version };
 
-				size_t welcomelen = welcome.size();
+				size_t welcomelen = welcome.size() + version.size();
 				if (welcomelen > screenCols) {
 					welcomelen = screenCols;
 				}
 
 				int padding = (screenCols - welcomelen) / 2;
 				if (padding > 0) {
-					ab.append("~");
-					padding--;
-				}
-				while (padding-- > 0) {
-					ab.append(" ");
+					out.Put(y, 0, "~", Style{});
 				}
 
 				// Clip the string if necessary
-				ab.append(welcome.c_str(), welcomelen);
-			} else if (rows.empty() && y - logoPadding - 1 < logo.size() &&
+				size_t at = padding + out.Put(y, padding, welcome, Style{});
+				out.Put(y, at, version, Style{});
+			} else if (rows.Empty() && y - logoPadding - 1 < logo.size() &&
 			           y - logoPadding > 0) {
 				// Logo
-				ab.append("~");
+				out.Put(y, 0, "~", Style{});
 				int padding = (screenCols - logo[y - logoPadding - 1].size()) / 2;
-				while (padding-- > 0) {
-					ab.append(" ");
-				}
-				ab.append(logo[y - logoPadding - 1]);
+				out.Put(y, 1 + padding, logo[y - logoPadding - 1], Style{});
 			} else {
 				// Vim style: lines not belonging to the file == tilde
-				ab.append("~");
+				out.Put(y, 0, "~", Style{});
 			}
 		} else {
-			size_t len = rows[filerow].render.size() - columnOffset;
-
-			// if (len < 0) {
-			// 	len = 0;
-			// }
-
-			if (len > screenCols) {
-				len = screenCols;
-			}
-
-			const std::string& c = rows[filerow].render; //[columnOffset];
-			// const char* hl = &rows[filerow].hl[columnOffset];
-			// int         current_color = -1;
-			for (size_t j = 0; j < len; j++) {
-				// if (hl[j] == HL_NORMAL) {
-				// if (current_color != -1) {
-				// ab.append(escapeSequences::color::defaultForeground);
-				// 	current_color = -1;
-				// }
-				if (j + columnOffset < rows[filerow].render.size()) {
-					ab.append(&c[j + columnOffset], 1);
+			uint64_t         id = rows.Id(filerow);
+			std::string_view line = rows.Line(filerow);
+			std::string_view render = renderCache.Get(id, line);
+
+			// Bytes and columns of the render differ once it has UTF-8 in it
+			size_t x = 0;
+			size_t column =
+			  columns.VisibleFrom(id, line, columnOffset, x) - columnOffset;
+			if (x >= render.size()) {
+				continue;
+			}
+			uint8_t state = 0;
+			if (highlighted) {
+				highlighted = highlighter.StateBefore(rows, filerow, state);
+			}
+			bool marked = search.Marked(filerow);
+			if (!highlighted && !marked) {
+				out.Put(y, column, render.substr(x), Style{});
+				continue;
+			}
+
+			if (highlighted) {
+				Highlighter::Highlight(*syntax, render, state, highlight);
+			} else {
+				highlight.assign(render.size(), HL_NORMAL);
+			}
+
+			// Matches are found in the line and painted over its render
+			if (marked) {
+				search.Spans(line, matchSpans);
+				for (auto [start, length] : matchSpans) {
+					size_t from = columns.ToOffset(id, line, start);
+					size_t to = columns.ToOffset(id, line, start + length);
+					std::fill(highlight.begin() + from, highlight.begin() + to, HL_MATCH);
 				}
-				// } else {
-				// 	int color = SyntaxToColor(hl[j]);
-				// 	if (color != current_color) {
-				// 		current_color = color;
-				// std::string buf = escapeSequences::color::getEscapeSequence(color);
-				// ab.append(buf);
-				// 	}
-				// 	ab.append(&c[j], 1);
-				// }
 			}
-			ab.append(escapeSequences::color::defaultForeground);
-		}
 
-		ab.append(escapeSequences::eraseInLine);
-		ab.append("\r\n");
+			// One Put per run of equally highlighted characters, up to as many
+			// bytes as the rest of the row can show
+			size_t end = std::min(render.size(), x + (screenCols - column) * 4);
+			while (x < end && column < screenCols) {
+				size_t runEnd = x + 1;
+				while (runEnd < end && (highlight[runEnd] == highlight[x] ||
+				                        utf8::IsContinuation(render[runEnd]))) {
+					runEnd++;
+				}
+
+				Style style{ static_cast<uint8_t>(SyntaxToColor(highlight[x])),
+					           false };
+				column += out.Put(y, column, render.substr(x, runEnd - x), style);
+				x = runEnd;
+			}
+		}
 	}
 }
 
 void
-Editor::DrawStatusBar(std::string& ab) const
+Editor::DrawStatusBar(Screen& out) const
 {
-	ab.append(escapeSequences::color::reverse);
+	Style bar{ 0, true };
 
-	std::string status{};
-	std::string statusRight{};
+	out.Fill(screenRows, 0, screenCols, ' ', bar);
 
-	if (!filename.empty()) {
-		status.append(filename);
-	} else {
-		status.append("[No Name]");
+	// The left part is written piece by piece, clipped by the screen
+	std::string_view name = filename;
+	if (name.empty()) {
+		name = "[No Name]";
 	}
 
-	status.append(" - ");
-	status.append(std::to_string(rows.size()));
-
-	if (dirtyFlag) {
-		status.append(" (modified)");
+	size_t len = 0;
+	len += out.Put(screenRows, len, name, bar);
+	len += out.Put(screenRows, len, " - ", bar);
+	len += out.PutNumber(screenRows, len, rows.LineCount(), bar);
+	if (!rows.FullyIndexed()) {
+		len += out.Put(screenRows, len, "+", bar);
 	}
-
-	size_t len = status.size();
-
-	if (len > screenCols) {
-		len = screenCols;
+	if (history.Dirty()) {
+		len += out.Put(screenRows, len, " (modified)", bar);
 	}
-	ab.append(status.c_str(), len);
-
-	if (syntax != nullptr) {
-		statusRight.append(syntax->filetype);
-	} else {
-		statusRight.append("no ft");
+	if (following) {
+		len += out.Put(screenRows, len, " (following)", bar);
 	}
 
-	statusRight.append(" | ");
-	statusRight.append(std::to_string(cursorRow + 1));
-	statusRight.append("/");
-	statusRight.append(std::to_string(rows.size()));
+	// The right part has to be measured first, it is composed on the stack
+	std::array<char, 96> statusRight{};
+	char*                end = statusRight.data() + statusRight.size();
+	char*                at = statusRight.data();
+
+	auto append = [&at, end](std::string_view text) {
+		size_t count = std::min<size_t>(text.size(), end - at);
+		at = std::copy_n(text.data(), count, at);
+	};
+
+	append(syntax != nullptr ? syntax->filetype : "no ft");
+	append(" | ");
+	append(rows.Ending() == LineEnding::CRLF ? "CRLF" : "LF");
+	append(" | ");
+	at = std::to_chars(at, end, cursorRow + 1).ptr;
+	append("/");
+	at = std::to_chars(at, end, rows.LineCount()).ptr;
+	if (!rows.FullyIndexed()) {
+		append("+ | loading ");
+		at = std::to_chars(at, end, rows.LoadProgress()).ptr;
+		append("%");
+	}
 
-	size_t rlen = statusRight.size();
+	size_t rlen = at - statusRight.data();
 
-	while (len < screenCols) {
-		if (screenCols - len == rlen) {
-			ab.append(statusRight.c_str(), rlen);
-			break;
-		}
-		ab.append(" ");
-		len++;
+	if (len + rlen <= screenCols) {
+		out.Put(screenRows,
+		        screenCols - rlen,
+		        std::string_view(statusRight.data(), rlen),
+		        bar);
 	}
-
-	ab.append(escapeSequences::color::reset);
-	ab.append("\r\n");
 }
 
 void
-Editor::DrawMessageBar(std::string& ab)
+Editor::DrawMessageBar(Screen& out)
 {
-	ab.append(escapeSequences::eraseInLine);
+	// The measurements of the last frame take the place of any message
+	if (showStats) {
+		Instrumentation::Overlay(statsLine);
+		out.Put(screenRows + 1,
+		        0,
+		        std::string_view(statsLine).substr(0, screenCols),
+		        Style{ 0, false });
+		return;
+	}
+
 	size_t msglen = statusmsg.size();
 	if (msglen > screenCols) {
 		msglen = screenCols;
 	}
 	if (msglen > 0 && time(nullptr) - statusmsg_time <
 	                    kilojoule::defaults::messageWaitDuration) {
-		ab.append(statusmsg);
+		out.Put(screenRows + 1,
+		        0,
+		        std::string_view(statusmsg).substr(0, msglen),
+		        Style{ statusmsgColor, false });
 	}
 }
 
 void
 Editor::SetStatusMessage(const char* fmt, ...)
 {
-	char*   tmp = new char[screenCols];
 	va_list ap;
+	va_list again;
 
+	// Kept whole, the message bar cuts it to the width it has when drawn
 	va_start(ap, fmt);
-	vsnprintf(tmp, screenCols, fmt, ap);
+	va_copy(again, ap);
+	int length = vsnprintf(nullptr, 0, fmt, ap);
 	va_end(ap);
 
-	statusmsg = tmp;
+	statusmsg.assign(length > 0 ? static_cast<size_t>(length) : 0, '\0');
+	vsnprintf(statusmsg.data(), statusmsg.size() + 1, fmt, again);
+	va_end(again);
+
 	statusmsg_time = time(nullptr);
+	statusmsgColor = 0;
+}
+
+// The lines of the file as loaded cost their index entry; the lines created
+// or edited also what the store keeps of them, next to what the same lines
+// took as one std::string each.
+void
+Editor::MemoryReport()
+{
+	TextBuffer::Memory memory = rows.MemoryUsage();
+	const LineStore::Usage& store = memory.store;
+
+	auto perLine = [](size_t bytes, size_t lines) {
+		return lines > 0 ? static_cast<double>(bytes) / lines : 0.0;
+	};
+
+	SetStatusMessage("Memory: index %.1f B/line of %zu | %zu new lines "
+	                 "%.1f B/line, was %.1f (%zu edited) | pieces %zu KiB",
+	                 perLine(memory.indexBytes, rows.OriginalLineCount()),
+	                 rows.OriginalLineCount(),
+	                 store.lines,
+	                 perLine(store.bytes, store.lines),
+	                 perLine(store.stringBytes, store.lines),
+	                 store.edited,
+	                 memory.pieceBytes >> 10);
+}
+
+// Reads a line of input in the message bar, `prompt` being a format with a
+// %s for the text so far. `callback` is told about every key. Returns an
+// empty string when the prompt is cancelled with Escape.
+std::string
+Editor::Prompt(const char*                           prompt,
+               std::function<void(const char*, int)> callback)
+{
+	std::string buf{};
+
+	while (true) {
+		SetStatusMessage(prompt, buf.c_str());
+		RefreshScreen();
+
+		if (!ReadEvent(inputEvent)) {
+			if (shouldClose) {
+				if (callback) {
+					callback(buf.c_str(), '\x1b');
+				}
+				return "";
+			}
+			continue; // a redraw was asked for
+		}
+
+		int c = 0;
+		if (inputEvent.type == InputType::Paste) {
+			for (char p : inputEvent.text) {
+				if (p != '\r' && p != '\n') {
+					buf.push_back(p);
+				}
+			}
+		} else if (inputEvent.type == InputType::Key) {
+			c = inputEvent.key;
+		} else {
+			continue;
+		}
+
+		if (c == Key::Del || c == CTRL_KEY('h') || c == Key::Backspace) {
+			if (!buf.empty()) {
+				buf.pop_back();
+			}
+		} else if (c == '\x1b') {
+			SetStatusMessage("");
+			if (callback) {
+				callback(buf.c_str(), c);
+			}
+			return "";
+		} else if (c == '\r') {
+			if (!buf.empty()) {
+				SetStatusMessage("");
+				if (callback) {
+					callback(buf.c_str(), c);
+				}
+				return buf;
+			}
+		} else if (c >= ' ' && c < 127) {
+			buf.push_back(static_cast<char>(c));
+		}
 
-	delete[] tmp;
+		if (callback) {
+			callback(buf.c_str(), c);
+		}
+	}
 }
 
 void
 Editor::Scroll()
 {
+	// Pick up the full line index once the thread pool is done with it
+	rows.Poll();
+	if (decompressing && rows.FullyIndexed()) {
+		decompressing = false;
+		if (rows.CompressionError() != 0) {
+			SetStatusMessage("Decompressing stopped early: %s",
+			                 strerror(rows.CompressionError()));
+			statusmsgColor = 31;
+		}
+	}
+	if (pendingSave.valid() &&
+	    pendingSave.wait_for(std::chrono::seconds(0)) ==
+	      std::future_status::ready) {
+		FinishSave();
+	}
+	// Appended lines go after the last line of the file as loaded
+	if (followPending && rows.FullyIndexed()) {
+		FollowFile();
+	}
+	highlighter.Start(rows, [this]() { wakeup.Notify(); });
+
 	cursorRenderColumn = 0;
 
-	if (cursorRow < rows.size()) {
-		cursorRenderColumn = cursorColumn;
-		// RowCxToRx(&rows[cursorRow], cursorColumn);
+	if (cursorRow < rows.LineCount()) {
+		cursorRenderColumn = RowCxToRx(cursorRow, cursorColumn);
 	}
 
 	if (cursorRow < rowOffset) {
@@ -309,23 +717,61 @@ Editor::Scroll()
 	if (cursorRenderColumn >= columnOffset + screenCols) {
 		columnOffset = cursorRenderColumn - screenCols + 1;
 	}
+
+	// Index just enough of the file to fill the screen
+	rows.EnsureLines(rowOffset + screenRows);
+}
+
+// Puts the cursor on `column` of `row`, both clamped to the document
+void
+Editor::MoveTo(size_t row, size_t column)
+{
+	rows.EnsureLines(row < SIZE_MAX ? row + 1 : row);
+
+	cursorRow = std::min(row, rows.LineCount());
+	cursorColumn = cursorRow < rows.LineCount()
+	                 ? std::min(column, rows.Line(cursorRow).size())
+	                 : 0;
+}
+
+// Column of the render that character `cx` of the row is shown at
+size_t
+Editor::RowCxToRx(size_t row, size_t cx) const
+{
+	return columns.ToRender(rows.Id(row), rows.Line(row), cx);
+}
+
+// Character of the row shown at column `rx` of its render
+size_t
+Editor::RowRxToCx(size_t row, size_t rx) const
+{
+	return columns.ToColumn(rows.Id(row), rows.Line(row), rx);
 }
 
 void
 Editor::MoveCursor(int key)
 {
-	erow* row = (cursorRow >= rows.size()) ? nullptr : &rows[cursorRow];
+	// Make sure the line below the cursor is known, if there is one
+	rows.EnsureLines(cursorRow + 2);
+
+	size_t rowlen =
+	  cursorRow < rows.LineCount() ? rows.Line(cursorRow).size() : 0;
+
+	// Moving up and down keeps to the same place on the screen
+	size_t renderColumn = cursorRow < rows.LineCount()
+	                        ? RowCxToRx(cursorRow, cursorColumn)
+	                        : cursorColumn;
 
 	switch (key) {
 		case Key::ArrowLeft:
 			if (cursorColumn != 0) {
-				cursorColumn--;
+				cursorColumn = utf8::Previous(rows.Line(cursorRow), cursorColumn);
 			}
 			// Move up when moving left at the start of a line
 			else if (cursorRow > 0) {
 				cursorRow--;
-				if (!rows.empty()) {
-					cursorColumn = rows[cursorRow].chars.size();
+				if (!rows.Empty()) {
+					cursorColumn = rows.Line(cursorRow).size();
 				} else {
 					cursorColumn = 0;
 				}
@@ -333,8 +779,8 @@ Editor::MoveCursor(int key)
 			break;
 		case Key::ArrowRight:
 			// Limit scrolling to the right
-			if (row != nullptr && cursorColumn < row->chars.size()) {
-				cursorColumn++;
+			if (cursorRow < rows.LineCount() && cursorColumn < rowlen) {
+				cursorColumn = utf8::Next(rows.Line(cursorRow), cursorColumn);
 			}
 			// Move down when moving right at the end of a line
 			else {
@@ -345,18 +791,19 @@ Editor::MoveCursor(int key)
 		case Key::ArrowUp:
 			if (cursorRow != 0) {
 				cursorRow--;
+				cursorColumn = RowRxToCx(cursorRow, renderColumn);
 			}
 			break;
 		case Key::ArrowDown:
-			if (cursorRow != rows.size() - 1) {
+			if (cursorRow != rows.LineCount() - 1) {
 				cursorRow++;
+				cursorColumn = RowRxToCx(cursorRow, renderColumn);
 			}
 			break;
 	}
 
 	// Snap cursor to end of line
-	row = (cursorRow >= rows.size()) ? nullptr : &rows[cursorRow];
-	size_t rowlen = row != nullptr ? row->chars.size() : 0;
+	rowlen = cursorRow < rows.LineCount() ? rows.Line(cursorRow).size() : 0;
 	if (cursorColumn > rowlen) {
 		cursorColumn = rowlen;
 	}
@@ -365,83 +812,1200 @@ Editor::MoveCursor(int key)
 void
 Editor::UpdateRow(size_t at)
 {
-	rows.at(at).render.clear();
+	// The render is rebuilt the next time the row is drawn
+	renderCache.Invalidate(rows.Id(at));
+	columns.Invalidate(rows.Id(at));
 
-	int idx = 0;
-	for (size_t j = 0; j < rows.at(at).chars.size(); j++) {
-		if (rows.at(at).chars[j] == '\t') {
-			rows.at(at).render += ' ';
-			idx++;
-			while (idx % kilojoule::defaults::tabStop != 0) {
-				rows.at(at).render += ' ';
-				idx++;
-			}
-		} else {
-			rows.at(at).render += rows.at(at).chars[j];
-			idx++;
-		}
+	highlighter.Edited(at);
+}
+
+void
+Editor::InsertRow(size_t at, const char* s)
+{
+	rows.EnsureLines(at + 1);
+	if (at > rows.LineCount()) {
+		return;
 	}
 
-	// UpdateSyntax(row);
+	rows.InsertLine(at, s);
+	highlighter.Inserted(at, 1);
+
+	UpdateRow(at);
 }
 
 void
-Editor::InsertRow(size_t at, const char* s)
+Editor::DelRow(size_t at)
 {
-	if (at > rows.size()) {
+	if (at >= rows.LineCount()) {
 		return;
 	}
 
-	erow tmp{};
-	tmp.chars = s;
+	rows.EraseLine(at);
+	highlighter.Erased(at, 1);
+}
+
+void
+Editor::RowInsertChar(size_t at, size_t column, int c)
+{
+	erow& row = rows.Row(at);
 
-	auto it = rows.begin() + at;
-	rows.insert(it, tmp);
+	if (column > row.chars.size()) {
+		column = row.chars.size();
+	}
+	row.chars.insert(column, 1, static_cast<char>(c));
 
 	UpdateRow(at);
 }
 
 void
-Editor::InsertNewline()
+Editor::RowAppendString(size_t at, std::string_view s)
 {
-	if (cursorColumn == 0) {
-		InsertRow(cursorRow, "");
-	} else {
-		erow* row = &rows[cursorRow];
-		InsertRow(cursorRow + 1, &row->chars[cursorColumn]);
-		row = &rows[cursorRow];
-		row->chars.erase(cursorColumn, std::string::npos);
-		UpdateRow(cursorRow);
+	rows.Row(at).chars.append(s);
+
+	UpdateRow(at);
+}
+
+void
+Editor::RowDelChar(size_t at, size_t column)
+{
+	erow& row = rows.Row(at);
+
+	if (column >= row.chars.size()) {
+		return;
 	}
-	cursorRow++;
-	cursorColumn = 0;
+	row.chars.erase(column, 1);
 
-	dirtyFlag = true;
-	dirtyLevel++;
+	UpdateRow(at);
 }
 
+// Inserts `text` at (row, column), "\n", "\r\n" and "\r" starting new lines,
+// and moves (row, column) to the end of it
 void
-Editor::Open(const char* filename)
+Editor::InsertSpan(size_t& row, size_t& column, std::string_view text)
 {
-	rows.clear();
+	erow& first = rows.Row(row);
 
-	this->filename = filename;
+	column = std::min(column, first.chars.size());
 
-	// SelectSyntaxHighlight();
+	// What followed the insertion point ends up after the last inserted line
+	std::string tail = first.chars.substr(column);
+	size_t      firstRow = row;
+	size_t      end = text.find_first_of("\r\n");
 
-	std::string   line{};
-	std::ifstream file(filename);
+	first.chars.erase(column);
+	first.chars.append(text.substr(0, end));
+	UpdateRow(row);
+
+	// The lines after the first go in whole, so they are stored compactly
+	// instead of being edited one at a time
+	while (end != std::string_view::npos) {
+		size_t start = end + 1;
+		if (text[end] == '\r' && start < text.size() && text[start] == '\n') {
+			start++;
+		}
+		end = text.find_first_of("\r\n", start);
 
-	if (file.is_open()) {
-		while (getline(file, line)) {
-			InsertRow(rows.size(), line.c_str());
+		std::string line{ text.substr(start, end - start) };
+		if (end == std::string_view::npos) {
+			column = line.size();
+			line.append(tail);
 		}
-		file.close();
+		rows.InsertLine(++row, line);
+	}
+
+	if (row == firstRow) {
+		column = first.chars.size();
+		first.chars.append(tail);
+	}
+
+	highlighter.Inserted(firstRow + 1, row - firstRow);
+}
+
+// Removes the text from (row, column) up to (endRow, endColumn). The lines
+// in between go in one operation however many there are.
+void
+Editor::DeleteSpan(size_t row, size_t column, size_t endRow, size_t endColumn)
+{
+	if (row == endRow) {
+		rows.Row(row).chars.erase(column, endColumn - column);
+		UpdateRow(row);
+		return;
+	}
+
+	std::string tail{ rows.Line(endRow).substr(endColumn) };
+	erow&       first = rows.Row(row);
+
+	first.chars.erase(column);
+	first.chars.append(tail);
+	UpdateRow(row);
+
+	rows.EraseLines(row + 1, endRow - row);
+	highlighter.Erased(row + 1, endRow - row);
+}
+
+void
+Editor::SplitLine(size_t row, size_t column)
+{
+	if (column == 0) {
+		InsertRow(row, "");
 	} else {
-		std::string errorMessage{};
-		errorMessage.append(escapeSequences::color::getEscapeSequence(31));
-		errorMessage.append("Could not access the selected file.");
-		errorMessage.append(escapeSequences::color::reset);
-		SetStatusMessage(errorMessage.c_str());
+		InsertRow(row + 1, &rows.Row(row).chars[column]);
+		rows.Row(row).chars.erase(column, std::string::npos);
+		UpdateRow(row);
+	}
+}
+
+void
+Editor::JoinLine(size_t row)
+{
+	RowAppendString(row, rows.Line(row + 1));
+	DelRow(row + 1);
+}
+
+// The cursor may be on the line after the last one, which has to be made
+// before anything can go in it. Returns whether it was.
+bool
+Editor::AppendCursorLine()
+{
+	if (cursorRow < rows.LineCount()) {
+		cursorColumn = std::min(cursorColumn, rows.Line(cursorRow).size());
+		return false;
+	}
+
+	UndoLog::Operation append{ UndoLog::Kind::AppendLine };
+	append.row = rows.LineCount();
+	append.endRow = append.row;
+	append.cursorRow = cursorRow;
+	append.cursorColumn = cursorColumn;
+	history.Record(append, {});
+	LogEdit(append, {}, false);
+
+	InsertRow(rows.LineCount(), "");
+	cursorColumn = 0;
+	return true;
+}
+
+void
+Editor::InsertChar(int c)
+{
+	bool appended = AppendCursorLine();
+	char ch = static_cast<char>(c);
+
+	UndoLog::Operation insert{ UndoLog::Kind::Insert, appended, true };
+	insert.row = cursorRow;
+	insert.column = cursorColumn;
+	insert.endRow = cursorRow;
+	insert.endColumn = cursorColumn + 1;
+	insert.cursorRow = cursorRow;
+	insert.cursorColumn = cursorColumn;
+
+	if (appended || !history.Extend(cursorRow, cursorColumn, ch)) {
+		history.Record(insert, std::string_view(&ch, 1));
+	}
+	LogEdit(insert, std::string_view(&ch, 1), false);
+
+	RowInsertChar(cursorRow, cursorColumn, c);
+	cursorColumn++;
+}
+
+// Inserts a whole block at the cursor in one go and leaves the cursor after
+// it. The block is a single operation in the undo log.
+void
+Editor::InsertText(std::string_view text)
+{
+	if (text.empty()) {
+		return;
+	}
+
+	bool appended = AppendCursorLine();
+
+	UndoLog::Operation insert{ UndoLog::Kind::Insert, appended };
+	insert.row = cursorRow;
+	insert.column = cursorColumn;
+	insert.cursorRow = cursorRow;
+	insert.cursorColumn = cursorColumn;
+
+	InsertSpan(cursorRow, cursorColumn, text);
+
+	insert.endRow = cursorRow;
+	insert.endColumn = cursorColumn;
+	history.Record(insert, text);
+	LogEdit(insert, text, false);
+}
+
+void
+Editor::InsertNewline()
+{
+	// On the line after the last one, making it is all there is to do
+	if (cursorRow == rows.LineCount()) {
+		AppendCursorLine();
+		cursorRow++;
+		return;
+	}
+
+	cursorColumn = std::min(cursorColumn, rows.Line(cursorRow).size());
+
+	UndoLog::Operation split{ UndoLog::Kind::Split };
+	split.row = cursorRow;
+	split.column = cursorColumn;
+	split.endRow = cursorRow + 1;
+	split.cursorRow = cursorRow;
+	split.cursorColumn = cursorColumn;
+	history.Record(split, {});
+	LogEdit(split, {}, false);
+
+	SplitLine(cursorRow, cursorColumn);
+	cursorRow++;
+	cursorColumn = 0;
+}
+
+void
+Editor::DelChar()
+{
+	if (cursorRow == rows.LineCount()) {
+		return;
+	}
+	if (cursorColumn == 0 && cursorRow == 0) {
+		return;
+	}
+
+	std::string_view line = rows.Line(cursorRow);
+
+	cursorColumn = std::min(cursorColumn, line.size());
+
+	if (cursorColumn > 0) {
+		// The whole character before the cursor, with its combining marks
+		UndoLog::Operation erase{ UndoLog::Kind::Delete };
+		erase.row = cursorRow;
+		erase.column = utf8::Previous(line, cursorColumn);
+		erase.endRow = cursorRow;
+		erase.endColumn = cursorColumn;
+		erase.cursorRow = cursorRow;
+		erase.cursorColumn = cursorColumn;
+		std::string_view erased =
+		  line.substr(erase.column, erase.endColumn - erase.column);
+		history.Record(erase, erased);
+		LogEdit(erase, erased, false);
+
+		DeleteSpan(cursorRow, erase.column, cursorRow, cursorColumn);
+		cursorColumn = erase.column;
+	} else {
+		// Join with the previous line
+		UndoLog::Operation join{ UndoLog::Kind::Join };
+		join.row = cursorRow - 1;
+		join.column = rows.Line(cursorRow - 1).size();
+		join.endRow = cursorRow;
+		join.cursorRow = cursorRow;
+		join.cursorColumn = cursorColumn;
+		history.Record(join, {});
+		LogEdit(join, {}, false);
+
+		cursorColumn = join.column;
+		JoinLine(cursorRow - 1);
+		cursorRow--;
+	}
+}
+
+// Reverts the last edit, with those that were made along with it
+void
+Editor::Undo()
+{
+	const UndoLog::Operation* operation = history.Undo();
+	if (operation == nullptr) {
+		SetStatusMessage("Nothing to undo.");
+		return;
+	}
+
+	for (; operation != nullptr;
+	     operation = operation->withPrevious ? history.Undo() : nullptr) {
+		size_t row = operation->row;
+		size_t column = operation->column;
+
+		LogEdit(*operation, history.Text(*operation), true);
+
+		switch (operation->kind) {
+			case UndoLog::Kind::Insert:
+				DeleteSpan(row, column, operation->endRow, operation->endColumn);
+				break;
+			case UndoLog::Kind::Delete:
+				InsertSpan(row, column, history.Text(*operation));
+				break;
+			case UndoLog::Kind::Split:
+				JoinLine(row);
+				break;
+			case UndoLog::Kind::Join:
+				SplitLine(row, column);
+				break;
+			case UndoLog::Kind::AppendLine:
+				DelRow(row);
+				break;
+		}
+
+		cursorRow = operation->cursorRow;
+		cursorColumn = operation->cursorColumn;
+	}
+}
+
+// Carries out the last undone edit again, with those that go along with it
+void
+Editor::Redo()
+{
+	const UndoLog::Operation* operation = history.Redo();
+	if (operation == nullptr) {
+		SetStatusMessage("Nothing to redo.");
+		return;
+	}
+
+	for (; operation != nullptr; operation = history.Redo(true)) {
+		size_t row = operation->row;
+		size_t column = operation->column;
+
+		LogEdit(*operation, history.Text(*operation), false);
+
+		switch (operation->kind) {
+			case UndoLog::Kind::Insert:
+				InsertSpan(row, column, history.Text(*operation));
+				break;
+			case UndoLog::Kind::Delete:
+				DeleteSpan(row, column, operation->endRow, operation->endColumn);
+				break;
+			case UndoLog::Kind::Split:
+				SplitLine(row, column);
+				row++;
+				column = 0;
+				break;
+			case UndoLog::Kind::Join:
+				JoinLine(row);
+				break;
+			case UndoLog::Kind::AppendLine:
+				InsertRow(row, "");
+				break;
+		}
+
+		cursorRow = row;
+		cursorColumn = column;
+	}
+}
+
+// Makes the journal for the first edit. If it can't be written that is
+// told once, and the edits go unjournaled.
+bool
+Editor::StartJournal()
+{
+	if (journalPath.empty() || journalFailed) {
+		return false;
+	}
+
+	if (journal.Start(journalPath, journalBase, journalKept) == -1) {
+		journalFailed = true;
+		SetStatusMessage("No crash recovery: %s", strerror(errno));
+		statusmsgColor = 31;
+		return false;
+	}
+	journalKept = 0;
+	return true;
+}
+
+// Puts `operation` in the journal, or its inverse if it is being undone
+void
+Editor::LogEdit(const UndoLog::Operation& operation,
+                std::string_view          text,
+                bool                      undone)
+{
+	if (!journal.Active() && !StartJournal()) {
+		return;
+	}
+
+	Journal::Record record{};
+	record.row = operation.row;
+	record.column = operation.column;
+	record.endRow = operation.endRow;
+	record.endColumn = operation.endColumn;
+
+	switch (operation.kind) {
+		case UndoLog::Kind::Insert:
+			record.edit = undone ? Journal::Edit::Delete : Journal::Edit::Insert;
+			record.text = text;
+			break;
+		case UndoLog::Kind::Delete:
+			record.edit = undone ? Journal::Edit::Insert : Journal::Edit::Delete;
+			record.text = text;
+			break;
+		case UndoLog::Kind::Split:
+			record.edit = undone ? Journal::Edit::Join : Journal::Edit::Split;
+			break;
+		case UndoLog::Kind::Join:
+			record.edit = undone ? Journal::Edit::Split : Journal::Edit::Join;
+			break;
+		case UndoLog::Kind::AppendLine:
+			record.edit =
+			  undone ? Journal::Edit::EraseLine : Journal::Edit::AppendLine;
+			break;
+	}
+
+	journal.Add(record);
+}
+
+// Carries out an edit read back from the journal. Returns false for one
+// that does not fit the buffer, which ends the recovery.
+bool
+Editor::ApplyJournaled(const Journal::Record& record)
+{
+	size_t row = record.row;
+	size_t column = record.column;
+
+	rows.EnsureLines(std::max(row, record.endRow) + 2);
+	if (row >= rows.LineCount()) {
+		if (record.edit != Journal::Edit::AppendLine ||
+		    row != rows.LineCount()) {
+			return false;
+		}
+		InsertRow(row, "");
+		return true;
+	}
+	if (column > rows.Line(row).size()) {
+		return false;
+	}
+
+	switch (record.edit) {
+		case Journal::Edit::Insert:
+			InsertSpan(row, column, record.text);
+			break;
+		case Journal::Edit::Delete:
+			if (record.endRow < row || record.endRow >= rows.LineCount() ||
+			    record.endColumn > rows.Line(record.endRow).size() ||
+			    (record.endRow == row && record.endColumn < column)) {
+				return false;
+			}
+			DeleteSpan(row, column, record.endRow, record.endColumn);
+			break;
+		case Journal::Edit::Split:
+			SplitLine(row, column);
+			break;
+		case Journal::Edit::Join:
+			if (row + 1 >= rows.LineCount()) {
+				return false;
+			}
+			JoinLine(row);
+			break;
+		case Journal::Edit::EraseLine:
+			DelRow(row);
+			break;
+		case Journal::Edit::AppendLine:
+			return false;
+	}
+	return true;
+}
+
+// Replays the journal left behind by an editor that went away without
+// saving. The edits of this one are journaled from the first on.
+void
+Editor::Recover()
+{
+	std::string   path = Journal::PathOf(filename);
+	Journal::Base base = Journal::BaseOf(filename);
+	size_t        edits = 0;
+
+	journalPath = path;
+	journalBase = base;
+
+	long kept = Journal::Replay(path, base, [&](const Journal::Record& record) {
+		if (!ApplyJournaled(record)) {
+			return false;
+		}
+		edits++;
+		return true;
+	});
+
+	if (kept == -1 && errno == ESTALE) {
+		// Made for another version of the file, kept for whoever wants it
+		std::string old = path + ".old";
+		rename(path.c_str(), old.c_str());
+		SetStatusMessage("Unsaved edits of an older version are in %s",
+		                 old.c_str());
+		statusmsgColor = 31;
+	} else if (edits > 0) {
+		history.MarkUnsaved();
+		SetStatusMessage("Recovered %zu unsaved edits, Ctrl-S to keep them",
+		                 edits);
+		// They are unsaved, so they stay journaled
+		journalKept = static_cast<size_t>(kept);
+		StartJournal();
+	} else if (kept != -1) {
+		// Held nothing that still applies
+		unlink(path.c_str());
+	}
+}
+
+void
+Editor::Open(const char* filename)
+{
+	// Done with the old file first, its journal is about to go
+	if (pendingSave.valid()) {
+		pendingSave.wait();
+		FinishSave();
+	}
+
+	this->filename = filename;
+
+	renderCache.Clear();
+	columns.Clear();
+	history.Clear();
+	journal.Stop(false);
+	journalPath.clear();
+	journalKept = 0;
+	journalFailed = false;
+
+	// Also stops the background highlighter, which reads the old file
+	SelectSyntaxHighlight();
+
+	// Lines are only read from the mapping once they are shown
+	if (rows.Load(filename) == -1) {
+		int   error = errno;
+		Codec codec = compression::Detect(filename);
+		if (!compression::Supported(codec)) {
+			SetStatusMessage("Built without %s support, can't decompress.",
+			                 compression::Name(codec));
+		} else {
+			SetStatusMessage("Could not access the selected file.");
+		}
+		statusmsgColor = 31;
+
+		// A new file is made on saving, and may have edits to recover
+		if (error == ENOENT && !this->filename.empty()) {
+			Recover();
+		}
+		return;
+	}
+
+	decompressing = rows.Compression() != Codec::None;
+
+	// Highlighting and searching would read the whole file
+	if (rows.Paged()) {
+		syntax = nullptr;
+		highlighter.Reset(syntax);
+		SetStatusMessage("Huge file, paged without highlighting or search. "
+		                 "Ctrl-G = go to line or %%");
+	}
+
+	if (!this->filename.empty()) {
+		Recover();
+	}
+}
+
+void
+Editor::Follow(bool on)
+{
+	if (following) {
+		events.Remove(watcher.Fd());
+		watcher.Stop();
+		following = false;
+	}
+	if (!on) {
+		return;
+	}
+
+	if (filename.empty()) {
+		SetStatusMessage("Can't follow, no file name.");
+		statusmsgColor = 31;
+		return;
+	}
+	if (rows.Compression() != Codec::None) {
+		SetStatusMessage("Can't follow a compressed file.");
+		statusmsgColor = 31;
+		return;
+	}
+
+	std::string_view loaded = rows.OriginalBytes();
+	if (watcher.Start(filename.c_str(), loaded.size()) == -1 ||
+	    events.Add(watcher.Fd(), [this]() {
+		    followPending = true;
+		    redraw = true;
+	    }) == -1) {
+		SetStatusMessage("Can't follow: %s", strerror(errno));
+		statusmsgColor = 31;
+		watcher.Stop();
+		return;
+	}
+
+	following = true;
+	followPartial = !loaded.empty() && loaded.back() != '\n';
+
+	// Catch up with what was written since the file was loaded
+	followPending = true;
+	SetStatusMessage("Following %s, Ctrl-T to stop", filename.c_str());
+}
+
+// Looks at the followed file after a notification. Only what was appended
+// is read; a truncated or rotated file is loaded again, unless that would
+// throw away changes.
+void
+Editor::FollowFile()
+{
+	followPending = false;
+
+	FileWatcher::Change change = watcher.Check(followed);
+	if (change == FileWatcher::Change::None) {
+		return;
+	}
+	// Appending is not an edit, so it is only done to an unmodified buffer,
+	// which is the file again afterwards
+	if (change == FileWatcher::Change::Appended) {
+		if (history.Dirty()) {
+			Follow(false);
+			SetStatusMessage("File grew, stopped following the modified buffer");
+			statusmsgColor = 31;
+			return;
+		}
+		AppendFollowed(followed);
+		journal.Stop(false);
+		journalBase = Journal::BaseOf(filename);
+		journalKept = 0;
+		return;
+	}
+
+	const char* what =
+	  change == FileWatcher::Change::Truncated ? "truncated" : "replaced";
+
+	if (history.Dirty()) {
+		Follow(false);
+		SetStatusMessage("File was %s, stopped following the modified buffer",
+		                 what);
+		statusmsgColor = 31;
+		return;
+	}
+
+	bool atEnd = cursorRow + 1 >= rows.LineCount();
+
+	Follow(false);
+	std::string name = filename;
+	Open(name.c_str());
+	Follow(true);
+
+	// The view stays on the end of the file if it was there
+	rowOffset = 0;
+	rows.EnsureLines(cursorRow + 1);
+	if (atEnd || cursorRow >= rows.LineCount()) {
+		rows.EnsureLines(SIZE_MAX);
+		cursorRow = rows.LineCount() > 0 ? rows.LineCount() - 1 : 0;
+		cursorColumn = 0;
+	}
+	SetStatusMessage("File was %s, loaded again", what);
+}
+
+// Adds the lines of `text` after the last one, the first of them continuing
+// the last line if that had no line break yet
+void
+Editor::AppendFollowed(std::string_view text)
+{
+	bool atEnd = cursorRow + 1 >= rows.LineCount();
+	bool crlf = rows.Ending() == LineEnding::CRLF;
+
+	size_t from = 0;
+	while (from < text.size()) {
+		size_t newline = text.find('\n', from);
+		size_t end = newline == std::string_view::npos ? text.size() : newline;
+		std::string_view chars = text.substr(from, end - from);
+		bool             finished = newline != std::string_view::npos;
+
+		if (followPartial && !rows.Empty()) {
+			RowAppendString(rows.LineCount() - 1, chars);
+
+			// The carriage return of a finished line may have come in an
+			// earlier append
+			size_t last = rows.LineCount() - 1;
+			if (finished && crlf && !rows.Line(last).empty() &&
+			    rows.Line(last).back() == '\r') {
+				rows.Row(last).chars.pop_back();
+				UpdateRow(last);
+			}
+		} else {
+			// Whole lines go in as they are, without being edited after
+			if (finished && crlf && !chars.empty() && chars.back() == '\r') {
+				chars.remove_suffix(1);
+			}
+
+			size_t at = rows.LineCount();
+			rows.InsertLine(at, chars);
+			highlighter.Inserted(at, 1);
+			UpdateRow(at);
+		}
+
+		followPartial = newline == std::string_view::npos;
+		from = end + 1;
+	}
+
+	if (atEnd && !rows.Empty()) {
+		cursorRow = rows.LineCount() - 1;
+		cursorColumn = 0;
+	}
+}
+
+namespace {
+// A rename is only durable once the directory is synced as well
+void
+SyncDirectory(const std::string& path)
+{
+	size_t      slash = path.rfind('/');
+	std::string directory = slash == std::string::npos ? "."
+	                        : slash == 0               ? "/"
+	                                                   : path.substr(0, slash);
+
+	int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (directoryFd != -1) {
+		fsync(directoryFd);
+		close(directoryFd);
+	}
+}
+
+// Compresses the text in `plain` into a temporary file next to `target` and
+// renames it over `target`, as Save does with text. Runs on the thread pool.
+// Returns the errno of what failed, 0 if nothing did.
+int
+ReplaceCompressed(int                plain,
+                  const std::string& target,
+                  mode_t             mode,
+                  Codec              codec)
+{
+	std::string temporary = target + ".kj-XXXXXX";
+	int         error = 0;
+
+	int fd = mkstemp(temporary.data());
+	if (fd == -1) {
+		error = errno;
+	} else {
+		if (fchmod(fd, mode) == -1 ||
+		    compression::Compress(plain, fd, codec) == -1 || fsync(fd) == -1) {
+			error = errno;
+		}
+		if (close(fd) == -1 && error == 0) {
+			error = errno;
+		}
+		if (error == 0 && rename(temporary.c_str(), target.c_str()) == -1) {
+			error = errno;
+		}
+
+		if (error != 0) {
+			unlink(temporary.c_str());
+		} else {
+			SyncDirectory(target);
+		}
+	}
+
+	close(plain);
+	return error;
+}
+}
+
+// Streams the buffer into a temporary file next to the original, syncs it
+// and renames it over the original, so that a crash or a full disk never
+// leaves a truncated file behind. Nothing is joined into one big string,
+// the rows are written from where they are.
+void
+Editor::Save()
+{
+	if (filename.empty()) {
+		SetStatusMessage("Can't save, no file name.");
+		statusmsgColor = 31;
+		return;
+	}
+
+	// Lines that were never looked at are part of the document too
+	if (!WaitForIndex("Save")) {
+		return;
+	}
+
+	auto  start = std::chrono::steady_clock::now();
+	Codec codec = rows.Compression();
+
+	// Saved as text, under the name without the compression suffix
+	if (codec != Codec::None && !recompress) {
+		std::string_view suffix = codec == Codec::Gzip ? ".gz" : ".zst";
+		if (filename.size() > suffix.size() &&
+		    std::string_view(filename).substr(filename.size() - suffix.size()) ==
+		      suffix) {
+			filename.resize(filename.size() - suffix.size());
+		}
+		codec = Codec::None;
+	}
+
+	// Replace the file behind a symbolic link instead of the link
+	std::string target = filename;
+	if (char* resolved = realpath(filename.c_str(), nullptr)) {
+		target = resolved;
+		free(resolved);
+	}
+
+	// Existing files keep their permissions, new ones follow the umask
+	mode_t      mode = 0666;
+	struct stat status {};
+	if (stat(target.c_str(), &status) == 0) {
+		mode = status.st_mode & 07777;
+	} else {
+		mode_t mask = umask(0);
+		umask(mask);
+		mode &= ~mask;
+	}
+
+	size_t written = 0;
+
+	// One save at a time, the journal follows them in order
+	if (pendingSave.valid()) {
+		pendingSave.wait();
+		FinishSave();
+	}
+
+	// The text goes to an unlinked file first and is compressed from there on
+	// the thread pool, so editing can go on meanwhile
+	if (codec != Codec::None) {
+		int plain = compression::TemporaryFile();
+		if (plain == -1 || rows.Write(plain, written) == -1) {
+			int error = errno;
+			if (plain != -1) {
+				close(plain);
+			}
+			SetStatusMessage("Can't save! I/O error: %s", strerror(error));
+			statusmsgColor = 31;
+			return;
+		}
+
+		history.MarkSaved();
+		// The records so far are in the file once it is compressed
+		pendingMark = journal.Mark();
+		pendingTarget = target;
+		pendingWritten = written;
+		pendingSave =
+		  ThreadPool::Shared().Submit([this, plain, target, mode, codec]() {
+			  int error = ReplaceCompressed(plain, target, mode, codec);
+			  wakeup.Notify();
+			  return error;
+		  });
+
+		SetStatusMessage("%zu bytes written, compressing", written);
+		return;
+	}
+
+	std::string temporary = target + ".kj-XXXXXX";
+
+	int fd = mkstemp(temporary.data());
+	if (fd == -1) {
+		SetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+		statusmsgColor = 31;
+		return;
+	}
+
+	int error = 0;
+	if (fchmod(fd, mode) == -1 || rows.Write(fd, written) == -1 ||
+	    fsync(fd) == -1) {
+		error = errno;
+	}
+	if (close(fd) == -1 && error == 0) {
+		error = errno;
+	}
+	if (error == 0 && rename(temporary.c_str(), target.c_str()) == -1) {
+		error = errno;
+	}
+
+	if (error != 0) {
+		unlink(temporary.c_str());
+		SetStatusMessage("Can't save! I/O error: %s", strerror(error));
+		statusmsgColor = 31;
+		return;
+	}
+
+	SyncDirectory(target);
+
+	// Nothing is unsaved, so the journal goes until the next edit, under
+	// the name the file was saved as
+	journal.Stop(false);
+	journalPath = Journal::PathOf(filename);
+	journalBase = Journal::BaseOf(target);
+	journalKept = 0;
+	journalFailed = false;
+
+	double seconds = std::chrono::duration<double>(
+	                   std::chrono::steady_clock::now() - start)
+	                   .count();
+
+	history.MarkSaved();
+
+	SetStatusMessage("%zu bytes written to disk (%.1f MB/s)",
+	                 written,
+	                 seconds > 0 ? static_cast<double>(written) / 1e6 / seconds
+	                             : 0.0);
+}
+
+// Reports how compressing the last save went
+void
+Editor::FinishSave()
+{
+	int error = pendingSave.get();
+
+	if (error != 0) {
+		// The file on disk does not hold the document after all
+		history.MarkUnsaved();
+		SetStatusMessage("Can't save! Compressing failed: %s", strerror(error));
+		statusmsgColor = 31;
+		return;
+	}
+
+	// Only now are the records up to the save in the file. Under a new name
+	// the journal starts over with the next edit.
+	journalBase = Journal::BaseOf(pendingTarget);
+	if (journal.Path() == Journal::PathOf(filename)) {
+		journal.Reset(journalBase, pendingMark);
+	} else {
+		journal.Stop(false);
+		journalPath = Journal::PathOf(filename);
+		journalKept = 0;
+		journalFailed = false;
+	}
+
+	struct stat status {};
+	SetStatusMessage("%zu bytes written to disk, compressed to %zu",
+	                 pendingWritten,
+	                 stat(pendingTarget.c_str(), &status) == 0
+	                   ? static_cast<size_t>(status.st_size)
+	                   : size_t{ 0 });
+}
+
+// Lets the file be indexed in the background while the screen keeps showing
+// how far it got, for `action`, which needs all of its lines. Escape gives up
+// waiting, Ctrl-Q quits. Returns whether the whole file is indexed.
+bool
+Editor::WaitForIndex(const char* action)
+{
+	// Nothing to draw to, or to cancel with
+	if (terminal == nullptr) {
+		rows.EnsureLines(SIZE_MAX);
+		return true;
+	}
+
+	// Progress wakes the loop up as well, so a lone escape byte is timed
+	// from when it arrived
+	auto partialSince = std::chrono::steady_clock::time_point{};
+
+	for (rows.Poll(); !rows.FullyIndexed(); rows.Poll()) {
+		SetStatusMessage("%s: loading %zu%%, ESC to cancel",
+		                 action,
+		                 rows.LoadProgress());
+		RefreshScreen();
+
+		events.RunOnce(input.HasPartial() ? escapeTimeout
+		                                  : kilojoule::defaults::progressInterval);
+
+		auto now = std::chrono::steady_clock::now();
+		if (!input.HasPartial()) {
+			partialSince = now;
+		}
+		bool complete =
+		  now - partialSince >= std::chrono::milliseconds(escapeTimeout);
+
+		while (input.Next(inputEvent, complete)) {
+			if (inputEvent.type != InputType::Key) {
+				continue;
+			}
+			if (inputEvent.key == '\x1b') {
+				SetStatusMessage("%s cancelled, the file is still loading", action);
+				return false;
+			}
+			if (inputEvent.key == CTRL_KEY('q')) {
+				ProcessKey(inputEvent.key, inputEvent.modifiers);
+				return false;
+			}
+		}
+	}
+
+	statusmsg.clear();
+	return true;
+}
+
+// Moves to a line number, or to a percentage of the file as loaded. Paged
+// files can only go as far as they are indexed.
+void
+Editor::GoTo()
+{
+	std::string target =
+	  Prompt("Go to line or percentage: %s (ESC to cancel)", nullptr);
+	if (target.empty()) {
+		return;
+	}
+
+	char*              end = nullptr;
+	unsigned long long value = std::strtoull(target.c_str(), &end, 10);
+	bool               percent = *end == '%';
+	if (end == target.c_str() || *end != (percent ? '%' : '\0')) {
+		SetStatusMessage("Not a line number or percentage: %s", target.c_str());
+		return;
+	}
+
+	size_t line = 0;
+
+	if (percent) {
+		if (!rows.Paged() && !WaitForIndex("Go to")) {
+			return;
+		}
+
+		size_t size = rows.OriginalBytes().size();
+		size_t offset =
+		  size / 100 * std::min<size_t>(value, 100) +
+		  size % 100 * std::min<size_t>(value, 100) / 100;
+
+		if (offset >= rows.IndexedBytes() && !rows.FullyIndexed()) {
+			SetStatusMessage("Only %zu%% of the file is indexed so far",
+			                 rows.IndexedBytes() * 100 / size);
+			offset = rows.IndexedBytes();
+		}
+
+		// The line of the file at `offset`, or the first one after it that
+		// was kept through the edits
+		std::vector<TextBuffer::Piece> pieces{};
+		size_t original = rows.OriginalLineCount() > 0
+		                    ? rows.OriginalLineAt(std::min(
+		                        offset, rows.IndexedBytes() - 1))
+		                    : 0;
+
+		rows.Pieces(pieces);
+		line = rows.LineCount();
+		for (const auto& piece : pieces) {
+			if (piece.original && original < piece.start + piece.count) {
+				line = piece.at +
+				       (original > piece.start ? original - piece.start : 0);
+				break;
+			}
+		}
+	} else {
+		line = value > 0 ? value - 1 : 0;
+
+		if (rows.Paged() && line >= rows.LineCount() && !rows.FullyIndexed()) {
+			SetStatusMessage("Only %zu lines are indexed so far",
+			                 rows.LineCount());
+		} else if (line >= rows.LineCount() && !WaitForIndex("Go to")) {
+			return;
+		}
+		rows.EnsureLines(line + 1);
+	}
+
+	cursorRow = std::min(line, rows.LineCount() > 0 ? rows.LineCount() - 1 : 0);
+	cursorColumn = 0;
+}
+
+// Searches for a string, or with `regex` for a regular expression
+void
+Editor::Find(bool regex)
+{
+	if (rows.Paged()) {
+		SetStatusMessage("Search is not available for paged files");
+		return;
+	}
+
+	size_t savedColumnOffset = columnOffset;
+	size_t savedRowOffset = rowOffset;
+
+	// Matches are numbered by line, so the whole file has to be indexed
+	if (!WaitForIndex("Search")) {
+		return;
+	}
+
+	findRow = cursorRow;
+	findColumn = cursorColumn;
+	findRegex = regex;
+
+	std::string query =
+	  Prompt(regex ? "Regex search: %s (Use ESC/Arrows/Enter)"
+	               : "Search: %s (Use ESC/Arrows/Enter)",
+	         [this](const char* text, int key) { FindCallback(text, key); });
+
+	if (query.empty()) {
+		cursorRow = findRow;
+		cursorColumn = findColumn;
+		columnOffset = savedColumnOffset;
+		rowOffset = savedRowOffset;
+	}
+}
+
+// Searches again for every change of the query, from where Find started, and
+// steps through the matches with the arrow keys. A search that is still
+// running when the next key arrives is abandoned for that key.
+void
+Editor::FindCallback(const char* query, int key)
+{
+	if (key == '\x1b') {
+		search.Clear();
+		return;
+	}
+
+	int direction = 0;
+	if (key == Key::ArrowRight || key == Key::ArrowDown) {
+		direction = 1;
+	} else if (key == Key::ArrowLeft || key == Key::ArrowUp) {
+		direction = -1;
+	}
+
+	// On Enter the cursor is already on the match, unless the last search was
+	// cut short
+	bool current = search.Valid() && search.Query() == query;
+
+	if (key != '\r' || !current) {
+		std::function<bool()> cancelled{};
+		if (key != '\r' && direction == 0) {
+			cancelled = [this]() {
+				events.RunOnce(0);
+				return input.Pending();
+			};
+		}
+
+		if (!search.Run(rows, query, findRegex, cancelled)) {
+			return;
+		}
+
+		size_t line = direction == 0 ? findRow : cursorRow;
+		size_t column = direction == 0 ? findColumn : cursorColumn;
+
+		if (search.Next(rows, line, column, direction)) {
+			cursorRow = line;
+			cursorColumn = column;
+			// Scroll brings the match to the top of the screen
+			rowOffset = rows.LineCount();
+		} else if (direction == 0) {
+			cursorRow = findRow;
+			cursorColumn = findColumn;
+		}
+	}
+
+	if (key == '\r') {
+		if (!search.Error().empty()) {
+			SetStatusMessage("Invalid expression: %s", search.Error().c_str());
+		}
+		search.Clear();
+	}
+}
+
+void
+Editor::SelectSyntaxHighlight()
+{
+	syntax = filename.empty() ? nullptr : Highlighter::Select(filename);
+	highlighter.Reset(syntax);
+}
+
+int
+Editor::SyntaxToColor(int hl)
+{
+	switch (hl) {
+		case HL_COMMENT:
+		case HL_MLCOMMENT:
+			return 36;
+		case HL_KEYWORD1:
+			return 33;
+		case HL_KEYWORD2:
+			return 32;
+		case HL_STRING:
+			return 35;
+		case HL_NUMBER:
+			return 31;
+		case HL_MATCH:
+			return 34;
+		default:
+			return 0;
 	}
 }
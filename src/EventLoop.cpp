@@ -0,0 +1,212 @@
+#include <algorithm> // min
+#include <array>
+#include <atomic>
+#include <cerrno>  // errno
+#include <csignal> // sigaction, NSIG
+#include <utility> // move
+
+#if defined(__linux__)
+#include <sys/epoll.h>   // for epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // for eventfd
+#include <unistd.h>      // for close, read, write
+#else
+#include <fcntl.h> // for fcntl, O_NONBLOCK
+#include <poll.h>  // for poll
+#include <unistd.h>
+#endif
+
+#include "EventLoop.hpp"
+
+namespace {
+// The wakeup of each signal that has a SignalEvent
+std::array<std::atomic<const Wakeup*>, NSIG> signalWakeups{};
+
+// Writing to a descriptor is all a signal handler can safely do
+void
+NotifySignal(int signal)
+{
+	int error = errno;
+
+	if (const Wakeup* wakeup = signalWakeups[signal]) {
+		wakeup->Notify();
+	}
+	errno = error;
+}
+}
+
+EventLoop::EventLoop()
+{
+#if defined(__linux__)
+	pollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (pollFd == -1) {
+		throw("epoll_create1: Could not create the event loop.");
+	}
+#endif
+}
+
+EventLoop::~EventLoop()
+{
+#if defined(__linux__)
+	close(pollFd);
+#endif
+}
+
+int
+EventLoop::Add(int fd, std::function<void()> onReadable)
+{
+#if defined(__linux__)
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if (epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		return -1;
+	}
+#endif
+
+	sources.push_back(Source{ fd, std::move(onReadable) });
+	return 0;
+}
+
+void
+EventLoop::Remove(int fd)
+{
+#if defined(__linux__)
+	epoll_ctl(pollFd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+
+	for (auto it = sources.begin(); it != sources.end(); ++it) {
+		if (it->fd == fd) {
+			sources.erase(it);
+			return;
+		}
+	}
+}
+
+int
+EventLoop::RunOnce(int timeout)
+{
+	std::array<int, 16> ready{};
+	int                 count = 0;
+
+#if defined(__linux__)
+	std::array<epoll_event, 16> events{};
+
+	count = epoll_wait(pollFd, events.data(), events.size(), timeout);
+	for (int i = 0; i < count; i++) {
+		ready[i] = events[i].data.fd;
+	}
+#else
+	std::array<pollfd, 16> fds{};
+	size_t                 watched = std::min(sources.size(), fds.size());
+
+	for (size_t i = 0; i < watched; i++) {
+		fds[i].fd = sources[i].fd;
+		fds[i].events = POLLIN;
+	}
+
+	count = poll(fds.data(), watched, timeout);
+	if (count > 0) {
+		count = 0;
+		for (size_t i = 0; i < watched; i++) {
+			if (fds[i].revents != 0) {
+				ready[count++] = fds[i].fd;
+			}
+		}
+	}
+#endif
+
+	// Interrupted by a signal, which is not the same as running out of time
+	if (count < 0) {
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		// A handler may remove sources, look each one up again and run a copy
+		for (const Source& source : sources) {
+			if (source.fd == ready[i]) {
+				std::function<void()> handler = source.onReadable;
+				handler();
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+Wakeup::Wakeup()
+{
+#if defined(__linux__)
+	readFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	writeFd = readFd;
+	if (readFd == -1) {
+		throw("eventfd: Could not create the wakeup descriptor.");
+	}
+#else
+	std::array<int, 2> fds{};
+	if (pipe(fds.data()) == -1) {
+		throw("pipe: Could not create the wakeup descriptor.");
+	}
+	readFd = fds[0];
+	writeFd = fds[1];
+	fcntl(readFd, F_SETFL, O_NONBLOCK);
+	fcntl(writeFd, F_SETFL, O_NONBLOCK);
+#endif
+}
+
+Wakeup::~Wakeup()
+{
+	close(readFd);
+	if (writeFd != readFd) {
+		close(writeFd);
+	}
+}
+
+void
+Wakeup::Notify() const
+{
+	uint64_t one = 1;
+
+	// A full pipe or counter means a wakeup is pending anyway
+	if (write(writeFd, &one, sizeof(one)) == -1) {
+		return;
+	}
+}
+
+void
+Wakeup::Drain() const
+{
+	std::array<uint64_t, 16> counts{};
+
+	while (read(readFd, counts.data(), sizeof(counts)) > 0) {
+	}
+}
+
+SignalEvent::SignalEvent(int signal)
+  : signal(signal)
+{
+	signalWakeups[signal] = &wakeup;
+
+	// Restarted, so that reads elsewhere are not cut short by a resize
+	struct sigaction action
+	{};
+	action.sa_handler = NotifySignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(signal, &action, nullptr) == -1) {
+		signalWakeups[signal] = nullptr;
+		throw("sigaction: Could not handle the signal.");
+	}
+}
+
+SignalEvent::~SignalEvent()
+{
+	struct sigaction action
+	{};
+	action.sa_handler = SIG_DFL;
+	sigemptyset(&action.sa_mask);
+	sigaction(signal, &action, nullptr);
+
+	signalWakeups[signal] = nullptr;
+}
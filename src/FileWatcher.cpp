@@ -0,0 +1,155 @@
+#include <array>
+#include <cerrno> // for EINTR, ENOSYS, errno
+
+#if defined(__linux__)
+#include <fcntl.h>       // for open, O_RDONLY, O_CLOEXEC
+#include <sys/inotify.h> // for inotify_init1, inotify_add_watch
+#include <sys/stat.h>    // for stat, fstat
+#include <unistd.h>      // for close, pread, read
+#endif
+
+#include "FileWatcher.hpp"
+
+namespace {
+// Bytes read per step while catching up with an append
+constexpr size_t readStep{ 1 << 20 };
+}
+
+FileWatcher::~FileWatcher()
+{
+	Stop();
+}
+
+int
+FileWatcher::Start(const char* filename, size_t from)
+{
+	Stop();
+
+#if defined(__linux__)
+	fileFd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fileFd == -1) {
+		return -1;
+	}
+
+	struct stat st
+	{};
+	notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notifyFd == -1 || fstat(fileFd, &st) == -1) {
+		int error = errno;
+		Stop();
+		errno = error;
+		return -1;
+	}
+
+	// The file for what is written to it, the directory for a new file
+	// showing up under its name after a rotation
+	path = filename;
+	size_t      slash = path.rfind('/');
+	std::string directory = slash == std::string::npos ? "."
+	                        : slash == 0               ? "/"
+	                                                   : path.substr(0, slash);
+
+	if (inotify_add_watch(notifyFd,
+	                      filename,
+	                      IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+	                        IN_DELETE_SELF) == -1 ||
+	    inotify_add_watch(
+	      notifyFd, directory.c_str(), IN_CREATE | IN_MOVED_TO) == -1) {
+		int error = errno;
+		Stop();
+		errno = error;
+		return -1;
+	}
+
+	device = st.st_dev;
+	inode = st.st_ino;
+	offset = from;
+	return 0;
+#else
+	(void)filename;
+	(void)from;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void
+FileWatcher::Stop()
+{
+#if defined(__linux__)
+	if (notifyFd != -1) {
+		close(notifyFd);
+	}
+	if (fileFd != -1) {
+		close(fileFd);
+	}
+#endif
+
+	notifyFd = -1;
+	fileFd = -1;
+	path.clear();
+	offset = 0;
+}
+
+FileWatcher::Change
+FileWatcher::Check(std::string& appended)
+{
+	appended.clear();
+
+	if (!Watching()) {
+		return Change::None;
+	}
+
+#if defined(__linux__)
+	// Which events arrived does not matter, the file is looked at anyway
+	std::array<char, 4096> events{};
+	while (read(notifyFd, events.data(), events.size()) > 0) {
+	}
+
+	// Gone without a replacement yet, the directory watch tells when one
+	// shows up
+	struct stat named
+	{};
+	if (stat(path.c_str(), &named) == -1) {
+		return Change::None;
+	}
+	if (named.st_dev != device || named.st_ino != inode) {
+		return Change::Replaced;
+	}
+
+	struct stat st
+	{};
+	if (fstat(fileFd, &st) == -1) {
+		return Change::None;
+	}
+
+	size_t size = static_cast<size_t>(st.st_size);
+	if (size < offset) {
+		return Change::Truncated;
+	}
+
+	while (offset < size) {
+		size_t  have = appended.size();
+		size_t  step = size - offset < readStep ? size - offset : readStep;
+		ssize_t count = 0;
+
+		appended.resize(have + step);
+		count = pread(fileFd, appended.data() + have, step, offset);
+		if (count == -1 && errno == EINTR) {
+			appended.resize(have);
+			continue;
+		}
+		if (count <= 0) {
+			appended.resize(have);
+			break;
+		}
+
+		appended.resize(have + static_cast<size_t>(count));
+		offset += static_cast<size_t>(count);
+	}
+
+	return appended.empty() ? Change::None : Change::Appended;
+#else
+	return Change::None;
+#endif
+}
@@ -0,0 +1,494 @@
+#include <algorithm> // fill_n, max, min, move, move_backward
+#include <cctype>    // isdigit, isspace
+#include <cstring>   // strchr, strlen
+
+#include "Highlighter.hpp"
+#include "TextBuffer.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+// Files with fewer lines are simply scanned when needed
+constexpr size_t backgroundLines{ 64 * 1024 };
+// Lines per background task, at least
+constexpr size_t minimumChunkLines{ 16 * 1024 };
+// Lines StateBefore scans itself while the background pass is running
+constexpr size_t scanBudget{ 16 * 1024 };
+// Room for lines made in the gap when it is full, at least
+constexpr size_t minimumGap{ 256 };
+
+const char* C_HL_extensions[] = { ".c", ".h", ".cpp", ".hpp", ".cc", nullptr };
+const char* C_HL_keywords[] = {
+	"switch",    "if",      "while",   "for",     "break",   "continue",
+	"return",    "else",    "struct",  "union",   "typedef", "static",
+	"enum",      "class",   "case",    "const",   "public",  "private",
+	"namespace", "include", "define",  "default", "do",      "goto",
+
+	"int|",      "long|",   "double|", "float|",  "char|",   "unsigned|",
+	"signed|",   "void|",   "bool|",   "auto|",   "size_t|", nullptr
+};
+
+editorSyntax HLDB[] = {
+	{ "c",
+	  C_HL_extensions,
+	  C_HL_keywords,
+	  "//",
+	  "/*",
+	  "*/",
+	  HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS },
+};
+
+constexpr uint8_t inComment{ 1 };
+
+bool
+IsSeparator(char c)
+{
+	return isspace(static_cast<unsigned char>(c)) != 0 || c == '\0' ||
+	       strchr(",.()+-/*=~%<>[];", c) != nullptr;
+}
+
+bool
+StartsWith(std::string_view text, size_t at, const char* prefix)
+{
+	return prefix != nullptr && prefix[0] != '\0' &&
+	       text.compare(at, strlen(prefix), prefix) == 0;
+}
+
+}
+
+const editorSyntax*
+Highlighter::Select(std::string_view filename)
+{
+	size_t dot = filename.rfind('.');
+
+	for (const editorSyntax& s : HLDB) {
+		for (const char** match = s.filematch; *match != nullptr; match++) {
+			bool isExtension = (*match)[0] == '.';
+
+			if ((isExtension && dot != std::string_view::npos &&
+			     filename.substr(dot) == *match) ||
+			    (!isExtension &&
+			     filename.find(*match) != std::string_view::npos)) {
+				return &s;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+Highlighter::~Highlighter()
+{
+	Stop();
+}
+
+void
+Highlighter::Stop()
+{
+	if (pass != nullptr) {
+		pass->cancelled = true;
+	}
+	for (std::future<void>& task : tasks) {
+		task.wait();
+	}
+	tasks.clear();
+	pass.reset();
+}
+
+// Forgets everything about the current buffer. Waits for the background
+// pass, which reads the buffer, so call it before loading another file.
+void
+Highlighter::Reset(const editorSyntax* newSyntax)
+{
+	Stop();
+
+	syntax = newSyntax;
+	states.clear();
+	gapBegin = 0;
+	gapEnd = 0;
+	validLines = 0;
+	started = false;
+	runEnd = 0;
+}
+
+void
+Highlighter::Start(const TextBuffer& rows, std::function<void()> onProgress)
+{
+	if (started || syntax == nullptr || !rows.FullyIndexed()) {
+		return;
+	}
+	started = true;
+
+	size_t lines = rows.OriginalLineCount();
+	if (lines < backgroundLines) {
+		return;
+	}
+
+	ThreadPool& pool = ThreadPool::Shared();
+
+	pass = std::make_shared<Pass>();
+	pass->lines = lines;
+	pass->chunkLines =
+	  std::max(minimumChunkLines, lines / (pool.Size() * 4) + 1);
+	pass->chunks = (lines + pass->chunkLines - 1) / pass->chunkLines;
+	pass->transitions.reset(new uint8_t[lines]);
+	pass->ready.reset(new std::atomic<bool>[pass->chunks]());
+
+	const editorSyntax* s = syntax;
+
+	for (size_t chunk = 0; chunk < pass->chunks; chunk++) {
+		tasks.push_back(pool.Submit([p = pass, &rows, s, chunk, onProgress]() {
+			size_t begin = chunk * p->chunkLines;
+			size_t end = std::min(p->lines, begin + p->chunkLines);
+
+			for (size_t i = begin; i < end; i++) {
+				if ((i & 1023) == 0 && p->cancelled.load()) {
+					return;
+				}
+
+				std::string_view line = rows.OriginalLine(i);
+				p->transitions[i] = static_cast<uint8_t>(
+				  Scan(*s, line, 0) | (Scan(*s, line, inComment) << 1));
+			}
+
+			p->ready[chunk].store(true, std::memory_order_release);
+			p->readyChunks++;
+
+			if (onProgress) {
+				onProgress();
+			}
+		}));
+	}
+}
+
+void
+Highlighter::MoveGap(size_t at)
+{
+	if (at < gapBegin) {
+		std::move_backward(states.begin() + at,
+		                   states.begin() + gapBegin,
+		                   states.begin() + gapEnd);
+		gapEnd -= gapBegin - at;
+	} else if (at > gapBegin) {
+		std::move(states.begin() + gapEnd,
+		          states.begin() + gapEnd + (at - gapBegin),
+		          states.begin() + gapBegin);
+		gapEnd += at - gapBegin;
+	}
+	gapBegin = at;
+}
+
+void
+Highlighter::Edited(size_t at)
+{
+	if (at < StateCount()) {
+		State(at) |= stale;
+	}
+	validLines = std::min(validLines, at);
+	runEnd = 0;
+}
+
+void
+Highlighter::Inserted(size_t at, size_t count)
+{
+	// Lines past the end are picked up as stale when they are first needed
+	if (at <= StateCount()) {
+		MoveGap(at);
+		if (gapEnd - gapBegin < count) {
+			// Grows with the lines, so filling it up again takes as long
+			size_t room = std::max(count, StateCount() / 8 + minimumGap);
+			states.insert(states.begin() + gapEnd, room, stale);
+			gapEnd += room;
+		}
+		std::fill_n(states.begin() + gapBegin, count, stale);
+		gapBegin += count;
+	}
+	validLines = std::min(validLines, at);
+	runEnd = 0;
+}
+
+void
+Highlighter::Erased(size_t at, size_t count)
+{
+	if (at < StateCount()) {
+		MoveGap(at);
+		gapEnd += std::min(count, states.size() - gapEnd);
+	}
+	// The line that moved up now follows a different one
+	Edited(at);
+}
+
+// Looks up the end state of line `at` in the background pass, if the line
+// is an unedited one and its chunk is ready.
+bool
+Highlighter::Transition(const TextBuffer& rows,
+                        size_t            at,
+                        uint8_t           before,
+                        uint8_t&          state)
+{
+	if (pass == nullptr) {
+		return false;
+	}
+
+	if (at < runBegin || at >= runEnd) {
+		size_t index = 0;
+		size_t run = rows.OriginalRun(at, index);
+
+		runBegin = at;
+		runEnd = at + std::max<size_t>(run, 1);
+		runIndex = run > 0 ? index : SIZE_MAX;
+	}
+	if (runIndex == SIZE_MAX) {
+		return false;
+	}
+
+	size_t index = runIndex + (at - runBegin);
+	if (!pass->ready[index / pass->chunkLines].load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	state = (pass->transitions[index] >> before) & 1;
+	return true;
+}
+
+// Makes the states of the first `count` lines valid, scanning at most
+// `budget` lines that the background pass has no answer for. Returns
+// whether it got there.
+bool
+Highlighter::Advance(const TextBuffer& rows, size_t count, size_t budget)
+{
+	// New lines at the end come after the gap
+	if (StateCount() < rows.LineCount()) {
+		states.resize(states.size() + (rows.LineCount() - StateCount()), stale);
+	}
+	count = std::min(count, StateCount());
+
+	while (validLines < count) {
+		uint8_t before = validLines == 0 ? 0 : State(validLines - 1);
+		uint8_t previous = State(validLines);
+		uint8_t state = 0;
+
+		if (!Transition(rows, validLines, before, state)) {
+			if (budget == 0) {
+				return false;
+			}
+			budget--;
+			state = Scan(*syntax, rows.Line(validLines), before);
+		}
+
+		State(validLines++) = state;
+
+		if (previous != state) {
+			// The next line was computed from the old state, remember that in
+			// case the frontier moves back before this one
+			if (validLines < StateCount()) {
+				State(validLines) |= stale;
+			}
+			continue;
+		}
+
+		// Converged, the following lines were computed from this very state
+		while (validLines < count && (State(validLines) & stale) == 0) {
+			validLines++;
+		}
+	}
+
+	return true;
+}
+
+bool
+Highlighter::StateBefore(const TextBuffer& rows, size_t at, uint8_t& state)
+{
+	state = 0;
+
+	if (syntax == nullptr || at == 0) {
+		return true;
+	}
+	if (!Advance(rows, at, Running() ? scanBudget : SIZE_MAX)) {
+		return false;
+	}
+
+	state = State(at - 1);
+	return true;
+}
+
+uint8_t
+Highlighter::Highlight(const editorSyntax& syntax,
+                       std::string_view    text,
+                       uint8_t             state,
+                       std::string&        hl)
+{
+	hl.assign(text.size(), HL_NORMAL);
+
+	const char* scs = syntax.singleline_comment_start;
+	const char* mcs = syntax.multiline_comment_start;
+	const char* mce = syntax.multiline_comment_end;
+	size_t      mcsLength = mcs != nullptr ? strlen(mcs) : 0;
+	size_t      mceLength = mce != nullptr ? strlen(mce) : 0;
+
+	bool prevSep = true;
+	char inString = 0;
+	bool inCommentBlock = state == inComment;
+
+	size_t i = 0;
+	while (i < text.size()) {
+		char    c = text[i];
+		uint8_t prevHl = i > 0 ? hl[i - 1] : 0;
+
+		if (inString == 0 && !inCommentBlock && StartsWith(text, i, scs)) {
+			std::fill(hl.begin() + i, hl.end(), HL_COMMENT);
+			break;
+		}
+
+		if (mcsLength != 0 && mceLength != 0 && inString == 0) {
+			if (inCommentBlock) {
+				hl[i] = HL_MLCOMMENT;
+				if (StartsWith(text, i, mce)) {
+					std::fill_n(hl.begin() + i, mceLength, HL_MLCOMMENT);
+					i += mceLength;
+					inCommentBlock = false;
+					prevSep = true;
+				} else {
+					i++;
+				}
+				continue;
+			}
+			if (StartsWith(text, i, mcs)) {
+				std::fill_n(hl.begin() + i, mcsLength, HL_MLCOMMENT);
+				i += mcsLength;
+				inCommentBlock = true;
+				continue;
+			}
+		}
+
+		if ((syntax.flags & HL_HIGHLIGHT_STRINGS) != 0) {
+			if (inString != 0) {
+				hl[i] = HL_STRING;
+				if (c == '\\' && i + 1 < text.size()) {
+					hl[i + 1] = HL_STRING;
+					i += 2;
+					continue;
+				}
+				if (c == inString) {
+					inString = 0;
+				}
+				i++;
+				prevSep = true;
+				continue;
+			}
+			if (c == '"' || c == '\'') {
+				inString = c;
+				hl[i] = HL_STRING;
+				i++;
+				continue;
+			}
+		}
+
+		if ((syntax.flags & HL_HIGHLIGHT_NUMBERS) != 0) {
+			if ((isdigit(static_cast<unsigned char>(c)) != 0 &&
+			     (prevSep || prevHl == HL_NUMBER)) ||
+			    (c == '.' && prevHl == HL_NUMBER)) {
+				hl[i] = HL_NUMBER;
+				i++;
+				prevSep = false;
+				continue;
+			}
+		}
+
+		if (prevSep) {
+			bool matched = false;
+
+			for (const char** keyword = syntax.keywords;
+			     keyword != nullptr && *keyword != nullptr;
+			     keyword++) {
+				size_t length = strlen(*keyword);
+				bool   secondary = (*keyword)[length - 1] == '|';
+				if (secondary) {
+					length--;
+				}
+
+				if (text.compare(i, length, *keyword, length) == 0 &&
+				    (i + length == text.size() || IsSeparator(text[i + length]))) {
+					std::fill_n(hl.begin() + i,
+					            length,
+					            secondary ? HL_KEYWORD2 : HL_KEYWORD1);
+					i += length;
+					matched = true;
+					break;
+				}
+			}
+
+			if (matched) {
+				prevSep = false;
+				continue;
+			}
+		}
+
+		prevSep = IsSeparator(c);
+		i++;
+	}
+
+	return inCommentBlock ? inComment : 0;
+}
+
+// Follows only what decides the state: strings, which hide comment markers,
+// and the comment markers themselves.
+uint8_t
+Highlighter::Scan(const editorSyntax& syntax,
+                  std::string_view    text,
+                  uint8_t             state)
+{
+	const char* scs = syntax.singleline_comment_start;
+	const char* mcs = syntax.multiline_comment_start;
+	const char* mce = syntax.multiline_comment_end;
+
+	if (mcs == nullptr || mce == nullptr || mcs[0] == '\0' || mce[0] == '\0') {
+		return 0;
+	}
+
+	bool strings = (syntax.flags & HL_HIGHLIGHT_STRINGS) != 0;
+	bool inCommentBlock = state == inComment;
+	char inString = 0;
+
+	size_t i = 0;
+	while (i < text.size()) {
+		if (inCommentBlock) {
+			size_t end = text.find(mce, i);
+			if (end == std::string_view::npos) {
+				return inComment;
+			}
+			i = end + strlen(mce);
+			inCommentBlock = false;
+			continue;
+		}
+
+		char c = text[i];
+
+		if (inString != 0) {
+			if (c == '\\' && i + 1 < text.size()) {
+				i += 2;
+				continue;
+			}
+			if (c == inString) {
+				inString = 0;
+			}
+			i++;
+			continue;
+		}
+
+		if (StartsWith(text, i, scs)) {
+			break;
+		}
+		if (StartsWith(text, i, mcs)) {
+			i += strlen(mcs);
+			inCommentBlock = true;
+			continue;
+		}
+		if (strings && (c == '"' || c == '\'')) {
+			inString = c;
+		}
+		i++;
+	}
+
+	return inCommentBlock ? inComment : 0;
+}
@@ -0,0 +1,358 @@
+#include <algorithm> // min
+#include <cerrno>    // for EAGAIN, EINTR, errno
+#include <utility>   // swap
+
+#if defined(__linux__)
+#include <unistd.h> // for read
+#endif
+
+#include "InputParser.hpp"
+#include "Terminal.hpp"
+
+namespace {
+
+constexpr char pasteEnd[] = "\x1b[201~";
+constexpr size_t pasteEndLength{ sizeof(pasteEnd) - 1 };
+
+void
+SetKey(InputEvent& event, int key, uint8_t modifiers)
+{
+	event.type = InputType::Key;
+	event.key = key;
+	event.modifiers = modifiers;
+}
+
+// xterm sends the modifiers as 1 + a bitmask in the second parameter
+uint8_t
+Modifiers(unsigned parameter)
+{
+	return parameter > 1 ? static_cast<uint8_t>((parameter - 1) & 0x7) : 0;
+}
+
+int
+TildeKey(unsigned code)
+{
+	switch (code) {
+		case 1:
+		case 7:
+			return Key::Home;
+		case 2:
+			return Key::Insert;
+		case 3:
+			return Key::Del;
+		case 4:
+		case 8:
+			return Key::End;
+		case 5:
+			return Key::PageUp;
+		case 6:
+			return Key::PageDown;
+		case 11:
+		case 12:
+		case 13:
+		case 14:
+		case 15:
+			return Key::F1 + (code - 11);
+		case 17:
+		case 18:
+		case 19:
+		case 20:
+		case 21:
+			return Key::F6 + (code - 17);
+		case 23:
+		case 24:
+			return Key::F11 + (code - 23);
+		default:
+			return 0;
+	}
+}
+
+int
+LetterKey(char final)
+{
+	switch (final) {
+		case 'A':
+			return Key::ArrowUp;
+		case 'B':
+			return Key::ArrowDown;
+		case 'C':
+			return Key::ArrowRight;
+		case 'D':
+			return Key::ArrowLeft;
+		case 'H':
+			return Key::Home;
+		case 'F':
+			return Key::End;
+		case 'P':
+			return Key::F1;
+		case 'Q':
+			return Key::F2;
+		case 'R':
+			return Key::F3;
+		case 'S':
+			return Key::F4;
+		default:
+			return 0;
+	}
+}
+
+}
+
+long
+InputParser::Fill(int fd)
+{
+	long total = 0;
+
+	while (Available() < capacity) {
+		size_t offset = tail & (capacity - 1);
+		size_t room = std::min(capacity - Available(), capacity - offset);
+
+		long nread = read(fd, &ring[offset], room);
+		if (nread == -1 && errno == EINTR) {
+			continue;
+		}
+		if (nread <= 0) {
+			// Readable but nothing to read means the terminal hung up
+			if (total == 0 && (nread == 0 || errno != EAGAIN)) {
+				return -1;
+			}
+			break;
+		}
+
+		tail += nread;
+		total += nread;
+
+		if (static_cast<size_t>(nread) < room) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+void
+InputParser::Feed(const char* data, size_t length)
+{
+	length = std::min(length, capacity - Available());
+
+	for (size_t i = 0; i < length; i++) {
+		ring[(tail + i) & (capacity - 1)] = data[i];
+	}
+	tail += length;
+}
+
+void
+InputParser::MoveTo(std::string& out, size_t count)
+{
+	size_t offset = head & (capacity - 1);
+	size_t first = std::min(count, capacity - offset);
+
+	out.append(&ring[offset], first);
+	out.append(ring.data(), count - first);
+	Consume(count);
+}
+
+bool
+InputParser::Next(InputEvent& event, bool timedOut)
+{
+	while (inPaste || Available() > 0) {
+		Result result{ Result::Skipped };
+
+		if (inPaste) {
+			result = ParsePaste(event);
+		} else if (Peek(0) != '\x1b') {
+			SetKey(event, static_cast<unsigned char>(Peek(0)), 0);
+			Consume(1);
+			result = Result::Event;
+		} else {
+			result = ParseEscape(event, timedOut);
+		}
+
+		if (result == Result::Event) {
+			return true;
+		}
+		if (result == Result::Incomplete) {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+InputParser::Result
+InputParser::ParseEscape(InputEvent& event, bool timedOut)
+{
+	if (Available() < 2) {
+		if (!timedOut) {
+			return Result::Incomplete;
+		}
+		SetKey(event, '\x1b', 0);
+		Consume(1);
+		return Result::Event;
+	}
+
+	char next = Peek(1);
+
+	if (next == '[') {
+		return ParseCsi(event, timedOut);
+	}
+	if (next == 'O') {
+		return ParseSs3(event, timedOut);
+	}
+	if (next == '\x1b') {
+		SetKey(event, '\x1b', 0);
+		Consume(1);
+		return Result::Event;
+	}
+
+	// Escape followed by a key is how terminals send Alt+key
+	SetKey(event, static_cast<unsigned char>(next), Modifier::Alt);
+	Consume(2);
+	return Result::Event;
+}
+
+InputParser::Result
+InputParser::ParseCsi(InputEvent& event, bool timedOut)
+{
+	std::array<unsigned, 4> parameters{};
+	size_t                  parameter = 0;
+	char                    prefix = 0;
+	char                    final = 0;
+	size_t                  i = 2;
+
+	if (i < Available() && (Peek(i) == '<' || Peek(i) == '?')) {
+		prefix = Peek(i++);
+	}
+
+	for (; final == 0; i++) {
+		if (i >= Available()) {
+			if (!timedOut) {
+				return Result::Incomplete;
+			}
+			SetKey(event, '[', Modifier::Alt);
+			Consume(2);
+			return Result::Event;
+		}
+		if (i >= maxSequence) {
+			Consume(i);
+			return Result::Skipped;
+		}
+
+		char c = Peek(i);
+
+		if (c >= '0' && c <= '9') {
+			parameters[parameter] = parameters[parameter] * 10 + (c - '0');
+		} else if (c == ';') {
+			parameter = std::min(parameter + 1, parameters.size() - 1);
+		} else if (c >= 0x40 && c <= 0x7e) {
+			final = c;
+		} else if (c < 0x20 || c > 0x2f) {
+			// Neither parameter, intermediate nor final byte
+			Consume(i);
+			return Result::Skipped;
+		}
+	}
+
+	Consume(i);
+
+	if (prefix == '<' && (final == 'M' || final == 'm')) {
+		unsigned code = parameters[0];
+
+		event.type = InputType::Mouse;
+		event.modifiers = ((code & 4) != 0 ? Modifier::Shift : 0) |
+		                  ((code & 8) != 0 ? Modifier::Alt : 0) |
+		                  ((code & 16) != 0 ? Modifier::Control : 0);
+		event.button = static_cast<int>(code & ~(4U | 8U | 16U | 32U));
+		event.pressed = final == 'M';
+		event.column = parameters[1];
+		event.row = parameters[2];
+		return Result::Event;
+	}
+	if (prefix != 0) {
+		return Result::Skipped;
+	}
+
+	if (final == '~') {
+		if (parameters[0] == 200) {
+			inPaste = true;
+			paste.clear();
+			return Result::Skipped;
+		}
+
+		int key = TildeKey(parameters[0]);
+		if (key == 0) {
+			return Result::Skipped;
+		}
+		SetKey(event, key, Modifiers(parameters[1]));
+		return Result::Event;
+	}
+
+	if (final == 'Z') {
+		SetKey(event, '\t', Modifier::Shift);
+		return Result::Event;
+	}
+
+	int key = LetterKey(final);
+	if (key == 0) {
+		return Result::Skipped;
+	}
+	SetKey(event, key, Modifiers(parameters[1]));
+	return Result::Event;
+}
+
+InputParser::Result
+InputParser::ParseSs3(InputEvent& event, bool timedOut)
+{
+	if (Available() < 3) {
+		if (!timedOut) {
+			return Result::Incomplete;
+		}
+		SetKey(event, 'O', Modifier::Alt);
+		Consume(2);
+		return Result::Event;
+	}
+
+	int key = LetterKey(Peek(2));
+	Consume(3);
+
+	if (key == 0) {
+		return Result::Skipped;
+	}
+	SetKey(event, key, 0);
+	return Result::Event;
+}
+
+// Collects pasted bytes until the closing marker, which may arrive split
+// over several reads.
+InputParser::Result
+InputParser::ParsePaste(InputEvent& event)
+{
+	size_t available = Available();
+	size_t matched = 0;
+	size_t i = 0;
+
+	for (; i < available && matched < pasteEndLength; i++) {
+		if (Peek(i) == pasteEnd[matched]) {
+			matched++;
+		} else {
+			matched = Peek(i) == pasteEnd[0] ? 1 : 0;
+		}
+	}
+
+	if (matched < pasteEndLength) {
+		// Keep a possible beginning of the marker for the next read
+		MoveTo(paste, available - matched);
+		return Result::Incomplete;
+	}
+
+	MoveTo(paste, i - pasteEndLength);
+	Consume(pasteEndLength);
+	inPaste = false;
+
+	event.type = InputType::Paste;
+	event.key = 0;
+	event.modifiers = 0;
+	// Swapping hands the previous event's buffer back for the next paste
+	std::swap(event.text, paste);
+	return Result::Event;
+}
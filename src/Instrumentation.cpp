@@ -0,0 +1,280 @@
+#include "Instrumentation.hpp"
+
+#if defined(KJ_INSTRUMENT)
+
+#include <algorithm> // max, min
+#include <array>
+#include <cstdio> // fopen, fprintf, snprintf
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Bucket i counts the samples below 2^i, and at least 2^(i-1), microseconds
+// or keystrokes
+constexpr size_t buckets{ 32 };
+
+constexpr std::array<const char*, static_cast<size_t>(Phase::Count)>
+  phaseNames{
+	  "scroll", "draw_rows", "draw_status_bar", "draw_message_bar",
+	  "flush",  "write",
+  };
+
+double
+Microseconds(Clock::duration duration)
+{
+	return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+struct Histogram
+{
+	std::array<size_t, buckets> counts{};
+	size_t                      samples{ 0 };
+	double                      total{ 0 };
+	double                      max{ 0 };
+	double                      last{ 0 };
+
+	void Add(double microseconds)
+	{
+		size_t bucket = 0;
+		while (bucket + 1 < buckets &&
+		       microseconds >= static_cast<double>(size_t{ 1 } << bucket)) {
+			bucket++;
+		}
+
+		counts[bucket]++;
+		samples++;
+		total += microseconds;
+		max = std::max(max, microseconds);
+		last = microseconds;
+	}
+
+	// Upper bound of the bucket holding the `quantile` sample
+	[[nodiscard]] double Quantile(double quantile) const
+	{
+		auto   wanted = static_cast<size_t>(quantile * samples);
+		size_t seen = 0;
+
+		for (size_t bucket = 0; bucket < buckets; bucket++) {
+			seen += counts[bucket];
+			if (seen > wanted) {
+				return std::min(max, static_cast<double>(size_t{ 1 } << bucket));
+			}
+		}
+		return max;
+	}
+
+	[[nodiscard]] double Mean() const
+	{
+		return samples > 0 ? total / static_cast<double>(samples) : 0;
+	}
+};
+
+struct Totals
+{
+	double total{ 0 };
+	double max{ 0 };
+	double last{ 0 };
+
+	void Add(double value)
+	{
+		total += value;
+		max = std::max(max, value);
+		last = value;
+	}
+};
+
+// Only touched by the UI thread
+struct State
+{
+	Histogram latency{}; // key read to frame written
+	Histogram frames{};
+	Histogram keystrokes{}; // per frame that handled input
+
+	std::array<Totals, static_cast<size_t>(Phase::Count)> phases{};
+	Totals                                                bytes{};
+	Totals                                                writes{};
+	Totals                                                allocations{};
+	Totals                                                changedCells{};
+	Totals                                                runs{};
+
+	// Of the frame being drawn
+	size_t frameWrites{ 0 };
+
+	bool              inputPending{ false };
+	Clock::time_point inputAt{};
+};
+
+State state{};
+
+void
+Print(FILE* out, const char* name, const Histogram& histogram)
+{
+	std::fprintf(out,
+	             "  \"%s\": {\n"
+	             "    \"samples\": %zu,\n"
+	             "    \"mean\": %.1f,\n"
+	             "    \"p50\": %.0f,\n"
+	             "    \"p90\": %.0f,\n"
+	             "    \"p99\": %.0f,\n"
+	             "    \"max\": %.1f,\n"
+	             "    \"buckets\": [",
+	             name,
+	             histogram.samples,
+	             histogram.Mean(),
+	             histogram.Quantile(0.5),
+	             histogram.Quantile(0.9),
+	             histogram.Quantile(0.99),
+	             histogram.max);
+
+	const char* separator = "";
+	for (size_t bucket = 0; bucket < buckets; bucket++) {
+		if (histogram.counts[bucket] > 0) {
+			std::fprintf(out,
+			             "%s { \"below\": %zu, \"count\": %zu }",
+			             separator,
+			             size_t{ 1 } << bucket,
+			             histogram.counts[bucket]);
+			separator = ",";
+		}
+	}
+	std::fprintf(out, " ]\n  },\n");
+}
+
+void
+Print(FILE* out, const char* name, const Totals& totals, size_t frames)
+{
+	std::fprintf(out,
+	             "    \"%s\": { \"total\": %.1f, \"mean\": %.1f, \"max\": %.1f }",
+	             name,
+	             totals.total,
+	             frames > 0 ? totals.total / static_cast<double>(frames) : 0,
+	             totals.max);
+}
+}
+
+Instrumentation::Frame::Frame()
+  : start(Clock::now())
+  , lap(start)
+  , allocations(AllocationCounter::Allocations())
+{
+}
+
+void
+Instrumentation::Frame::Lap(Phase phase)
+{
+	Clock::time_point now = Clock::now();
+
+	state.phases[static_cast<size_t>(phase)].Add(Microseconds(now - lap));
+	lap = now;
+}
+
+void
+Instrumentation::Frame::Done(FrameStats& stats)
+{
+	Clock::time_point now = Clock::now();
+
+	stats.microseconds = Microseconds(now - start);
+	stats.allocations = AllocationCounter::Allocations() - allocations;
+
+	state.frames.Add(stats.microseconds);
+	state.bytes.Add(static_cast<double>(stats.bytes));
+	state.writes.Add(static_cast<double>(state.frameWrites));
+	state.allocations.Add(static_cast<double>(stats.allocations));
+	state.changedCells.Add(static_cast<double>(stats.changedCells));
+	state.runs.Add(static_cast<double>(stats.runs));
+	state.frameWrites = 0;
+
+	if (state.inputPending) {
+		state.latency.Add(Microseconds(now - state.inputAt));
+		state.inputPending = false;
+	}
+	if (stats.keystrokes > 0) {
+		state.keystrokes.Add(static_cast<double>(stats.keystrokes));
+	}
+}
+
+void
+Instrumentation::InputRead()
+{
+	if (!state.inputPending) {
+		state.inputPending = true;
+		state.inputAt = Clock::now();
+	}
+}
+
+void
+Instrumentation::Wrote()
+{
+	state.frameWrites++;
+}
+
+void
+Instrumentation::Overlay(std::string& out)
+{
+	auto last = [](Phase phase) {
+		return state.phases[static_cast<size_t>(phase)].last;
+	};
+
+	std::array<char, 256> line{};
+	int                   length = std::snprintf(
+	  line.data(),
+	  line.size(),
+	  "key p50 %.0fus p99 %.0fus, %.0f/frame | frame %.0fus: scroll %.0f "
+	  "rows %.0f status %.0f flush %.0f write %.0f | %.0f cells in %.0f runs, "
+	  "%.0f B in %.0f writes | %.0f allocs",
+	  state.latency.Quantile(0.5),
+	  state.latency.Quantile(0.99),
+	  state.keystrokes.last,
+	  state.frames.last,
+	  last(Phase::Scroll),
+	  last(Phase::DrawRows),
+	  last(Phase::DrawStatusBar),
+	  last(Phase::Flush),
+	  last(Phase::Write),
+	  state.changedCells.last,
+	  state.runs.last,
+	  state.bytes.last,
+	  state.writes.last,
+	  state.allocations.last);
+
+	// Cut to the buffer, like snprintf did
+	auto written = static_cast<size_t>(std::max(length, 0));
+	out.assign(line.data(), std::min(line.size() - 1, written));
+}
+
+int
+Instrumentation::Dump(const char* filename)
+{
+	FILE* out = std::fopen(filename, "w");
+	if (out == nullptr) {
+		return -1;
+	}
+
+	size_t frames = state.frames.samples;
+
+	std::fprintf(out, "{\n  \"frames\": %zu,\n", frames);
+	Print(out, "frame_us", state.frames);
+	Print(out, "key_to_frame_us", state.latency);
+	Print(out, "keystrokes_per_frame", state.keystrokes);
+
+	std::fprintf(out, "  \"phases_us\": {\n");
+	for (size_t i = 0; i < phaseNames.size(); i++) {
+		Print(out, phaseNames[i], state.phases[i], frames);
+		std::fprintf(out, "%s\n", i + 1 < phaseNames.size() ? "," : "");
+	}
+	std::fprintf(out, "  },\n  \"per_frame\": {\n");
+	Print(out, "bytes", state.bytes, frames);
+	std::fprintf(out, ",\n");
+	Print(out, "writes", state.writes, frames);
+	std::fprintf(out, ",\n");
+	Print(out, "allocations", state.allocations, frames);
+	std::fprintf(out, ",\n");
+	Print(out, "changed_cells", state.changedCells, frames);
+	std::fprintf(out, ",\n");
+	Print(out, "runs", state.runs, frames);
+	std::fprintf(out, "\n  }\n}\n");
+
+	return std::fclose(out);
+}
+
+#endif
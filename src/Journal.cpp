@@ -0,0 +1,432 @@
+#include <algorithm> // min
+#include <array>
+#include <cerrno> // for EINTR, ENOSYS, ESTALE, errno
+#include <chrono>
+#include <cstring> // memcpy
+
+#if defined(__linux__)
+#include <fcntl.h>    // for open, O_CLOEXEC, O_CREAT, O_RDWR
+#include <sys/stat.h> // for stat
+#include <unistd.h> // for close, fdatasync, ftruncate, pread, pwrite, read
+#endif
+
+#include "constants.hpp"
+#include "Journal.hpp"
+
+namespace {
+constexpr std::string_view magic{ "kjjrnl01" };
+constexpr size_t           headerSize{ magic.size() + 4 * sizeof(uint64_t) };
+
+void
+PutVarint(std::string& out, uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+// Reads a varint at `at`, false if the data ends before it does
+bool
+GetVarint(std::string_view data, size_t& at, uint64_t& value)
+{
+	value = 0;
+	for (unsigned shift = 0; at < data.size() && shift < 64; shift += 7) {
+		auto byte = static_cast<unsigned char>(data[at++]);
+
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// FNV-1a, enough to tell a record written in full from one cut short
+uint32_t
+Checksum(std::string_view data)
+{
+	uint32_t hash = 2166136261U;
+	for (char c : data) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619U;
+	}
+	return hash;
+}
+
+std::string
+Header(const Journal::Base& base)
+{
+	std::string header{ magic };
+
+	for (uint64_t field :
+	     { base.size, base.seconds, base.nanoseconds, base.inode }) {
+		std::array<char, sizeof(uint64_t)> bytes{};
+		std::memcpy(bytes.data(), &field, bytes.size());
+		header.append(bytes.data(), bytes.size());
+	}
+	return header;
+}
+
+#if defined(__linux__)
+int
+WriteAt(int fd, std::string_view data, size_t offset)
+{
+	while (!data.empty()) {
+		ssize_t count =
+		  pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset));
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data.remove_prefix(static_cast<size_t>(count));
+		offset += static_cast<size_t>(count);
+	}
+	return 0;
+}
+
+int
+ReadAt(int fd, std::string& data, size_t offset)
+{
+	for (size_t at = 0; at < data.size();) {
+		ssize_t count = pread(fd, data.data() + at, data.size() - at,
+		                      static_cast<off_t>(offset + at));
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return -1;
+		}
+		at += static_cast<size_t>(count);
+	}
+	return 0;
+}
+#endif
+}
+
+Journal::~Journal()
+{
+	Stop(false);
+}
+
+std::string
+Journal::PathOf(const std::string& filename)
+{
+	size_t slash = filename.rfind('/');
+	size_t name = slash == std::string::npos ? 0 : slash + 1;
+
+	return filename.substr(0, name) + "." + filename.substr(name) +
+	       ".kj-journal";
+}
+
+Journal::Base
+Journal::BaseOf(const std::string& filename)
+{
+	Base base{};
+
+#if defined(__linux__)
+	struct stat st
+	{};
+	if (stat(filename.c_str(), &st) == 0) {
+		base.size = static_cast<uint64_t>(st.st_size);
+		base.seconds = static_cast<uint64_t>(st.st_mtim.tv_sec);
+		base.nanoseconds = static_cast<uint64_t>(st.st_mtim.tv_nsec);
+		base.inode = static_cast<uint64_t>(st.st_ino);
+	}
+#else
+	(void)filename;
+#endif
+
+	return base;
+}
+
+long
+Journal::Replay(const std::string&                         path,
+                const Base&                                current,
+                const std::function<bool(const Record&)>& apply)
+{
+#if defined(__linux__)
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+
+	// Journals are as large as the edits, so they are simply read whole
+	std::string            data{};
+	std::array<char, 4096> buffer{};
+	for (;;) {
+		ssize_t count = read(fd, buffer.data(), buffer.size());
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			break;
+		}
+		data.append(buffer.data(), static_cast<size_t>(count));
+	}
+	close(fd);
+
+	if (data.size() < headerSize ||
+	    std::string_view(data).substr(0, magic.size()) != magic) {
+		errno = ESTALE;
+		return -1;
+	}
+	if (data.compare(0, headerSize, Header(current)) != 0) {
+		// Nothing is lost by dropping a journal without records
+		if (data.size() == headerSize) {
+			return 0;
+		}
+		errno = ESTALE;
+		return -1;
+	}
+
+	size_t applied = headerSize;
+
+	for (size_t at = applied; at < data.size(); applied = at) {
+		uint64_t length = 0;
+		if (!GetVarint(data, at, length) ||
+		    length + sizeof(uint32_t) > data.size() - at) {
+			break;
+		}
+
+		std::string_view payload = std::string_view(data).substr(at, length);
+		uint32_t         checksum = 0;
+		std::memcpy(&checksum, data.data() + at + length, sizeof(checksum));
+		if (checksum != Checksum(payload)) {
+			break;
+		}
+		at += length + sizeof(checksum);
+
+		Record   record{};
+		size_t   field = 1;
+		uint64_t value = 0;
+		if (payload.empty()) {
+			break;
+		}
+		record.edit = static_cast<Edit>(payload[0]);
+
+		bool read = GetVarint(payload, field, value);
+		record.row = value;
+		read = read && GetVarint(payload, field, value);
+		record.column = value;
+		if (read && record.edit == Edit::Delete) {
+			read = GetVarint(payload, field, value);
+			record.endRow = value;
+			read = read && GetVarint(payload, field, value);
+			record.endColumn = value;
+		}
+		record.text = payload.substr(std::min(field, payload.size()));
+
+		if (!read || !apply(record)) {
+			break;
+		}
+	}
+
+	return static_cast<long>(applied);
+#else
+	(void)path;
+	(void)current;
+	(void)apply;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+Journal::Start(const std::string& path, const Base& current, size_t keep)
+{
+	Stop(true);
+
+#if defined(__linux__)
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		return -1;
+	}
+
+	// What was not replayed goes, and so does a journal of another version
+	if (keep >= headerSize) {
+		offset = keep;
+	} else {
+		offset = headerSize;
+		keep = 0;
+	}
+	if (ftruncate(fd, static_cast<off_t>(keep)) == -1 ||
+	    (keep == 0 && WriteAt(fd, Header(current), 0) == -1)) {
+		int error = errno;
+		close(fd);
+		fd = -1;
+		errno = error;
+		return -1;
+	}
+
+	this->path = path;
+	added = keep == 0 ? 0 : keep - headerSize;
+	pending.clear();
+	reset = false;
+	dropped = 0;
+	base = current;
+	stopping = false;
+	writer = std::thread([this]() { Run(); });
+	return 0;
+#else
+	(void)path;
+	(void)current;
+	(void)keep;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void
+Journal::Stop(bool keep)
+{
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		writer.join();
+	}
+
+#if defined(__linux__)
+	if (fd != -1) {
+		close(fd);
+		if (!keep) {
+			unlink(path.c_str());
+		}
+	}
+#endif
+
+	fd = -1;
+	path.clear();
+}
+
+void
+Journal::Reset(const Base& saved, size_t mark)
+{
+	if (!Active()) {
+		return;
+	}
+
+	added -= mark;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		reset = true;
+		dropped += mark;
+		base = saved;
+	}
+	wake.notify_one();
+}
+
+// Encodes `record` as: varint payload length, payload, checksum of the
+// payload. The payload is the kind, the position and then the text of an
+// insert or the end of a delete.
+void
+Journal::Add(const Record& record)
+{
+	if (!Active()) {
+		return;
+	}
+
+	std::string& payload = encoding;
+
+	payload.clear();
+	payload.push_back(static_cast<char>(record.edit));
+	PutVarint(payload, record.row);
+	PutVarint(payload, record.column);
+	if (record.edit == Edit::Delete) {
+		PutVarint(payload, record.endRow);
+		PutVarint(payload, record.endColumn);
+	} else if (record.edit == Edit::Insert) {
+		payload.append(record.text);
+	}
+
+	uint32_t                           checksum = Checksum(payload);
+	std::array<char, sizeof(checksum)> bytes{};
+	std::memcpy(bytes.data(), &checksum, bytes.size());
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t                      before = pending.size();
+		PutVarint(pending, payload.size());
+		pending.append(payload);
+		pending.append(bytes.data(), bytes.size());
+		added += pending.size() - before;
+	}
+	wake.notify_one();
+}
+
+// Writes whatever was added as soon as it was, and syncs a sync interval
+// after the first write that is not synced yet. A reset rewrites the
+// journal as the new header and the records that were not dropped.
+void
+Journal::Run()
+{
+#if defined(__linux__)
+	using Clock = std::chrono::steady_clock;
+
+	auto interval =
+	  std::chrono::milliseconds(kilojoule::defaults::journalSyncInterval);
+	bool              unsynced = false;
+	Clock::time_point syncAt{};
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		if (pending.empty() && !reset && !stopping) {
+			if (unsynced) {
+				wake.wait_until(lock, syncAt);
+			} else {
+				wake.wait(lock);
+			}
+		}
+
+		writing.swap(pending);
+		bool   header = reset;
+		size_t drop = dropped;
+		bool   stop = stopping;
+		Base   current = base;
+		reset = false;
+		dropped = 0;
+		lock.unlock();
+
+		if (header) {
+			size_t written = offset - headerSize;
+
+			if (drop >= written) {
+				writing.erase(0, drop - written);
+			} else {
+				std::string kept(written - drop, '\0');
+				if (ReadAt(fd, kept, headerSize + drop) == 0) {
+					writing.insert(0, kept);
+				}
+			}
+			if (ftruncate(fd, 0) == 0) {
+				offset = headerSize;
+			}
+			WriteAt(fd, Header(current), 0);
+		}
+		if (!writing.empty() && WriteAt(fd, writing, offset) == 0) {
+			offset += writing.size();
+		}
+
+		if (!unsynced && (header || !writing.empty())) {
+			unsynced = true;
+			syncAt = Clock::now() + interval;
+		}
+		if (unsynced && (stop || Clock::now() >= syncAt)) {
+			fdatasync(fd);
+			unsynced = false;
+		}
+		writing.clear();
+
+		lock.lock();
+		if (stop && pending.empty()) {
+			return;
+		}
+	}
+#endif
+}
@@ -0,0 +1,259 @@
+#include <algorithm> // max, min
+#include <cstring>   // memchr
+#include <memory>    // make_shared
+#include <utility>   // move
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KJ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "LineIndexer.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+constexpr size_t minimumChunkSize{ 1 << 20 };
+
+struct Chunk
+{
+	std::vector<size_t> newlines{};
+	size_t              crlfLines{ 0 };
+	size_t              longestInner{ 0 }; // between two newlines of the chunk
+};
+
+using ScanFunction = void (*)(const char*,
+                              size_t,
+                              size_t,
+                              std::vector<size_t>&);
+
+void
+ScanScalar(const char*          data,
+           size_t               begin,
+           size_t               end,
+           std::vector<size_t>& positions)
+{
+	while (begin < end) {
+		const void* newline = memchr(data + begin, '\n', end - begin);
+		if (newline == nullptr) {
+			return;
+		}
+		size_t at = static_cast<const char*>(newline) - data;
+		positions.push_back(at);
+		begin = at + 1;
+	}
+}
+
+#if defined(KJ_X86_SIMD)
+__attribute__((target("sse2"))) void
+ScanSse2(const char*          data,
+         size_t               begin,
+         size_t               end,
+         std::vector<size_t>& positions)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	size_t i = begin;
+	for (; i + 16 <= end; i += 16) {
+		__m128i block =
+		  _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		auto mask = static_cast<unsigned>(
+		  _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+
+		while (mask != 0) {
+			positions.push_back(i + __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	ScanScalar(data, i, end, positions);
+}
+
+__attribute__((target("avx2"))) void
+ScanAvx2(const char*          data,
+         size_t               begin,
+         size_t               end,
+         std::vector<size_t>& positions)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	size_t i = begin;
+	for (; i + 64 <= end; i += 64) {
+		__m256i low =
+		  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i high =
+		  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+
+		auto lowMask = static_cast<uint32_t>(
+		  _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)));
+		auto highMask = static_cast<uint32_t>(
+		  _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)));
+
+		// Long lines skip whole blocks without touching the bitmask loop
+		uint64_t mask = (static_cast<uint64_t>(highMask) << 32) | lowMask;
+		while (mask != 0) {
+			positions.push_back(i + __builtin_ctzll(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	ScanSse2(data, i, end, positions);
+}
+#endif
+
+ScanFunction
+SelectScanner(const char** name)
+{
+#if defined(KJ_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return ScanAvx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		return ScanSse2;
+	}
+#endif
+	*name = "scalar";
+	return ScanScalar;
+}
+
+const char*  scannerName{ nullptr };
+ScanFunction scanner = SelectScanner(&scannerName);
+
+Chunk
+ScanChunk(const char* data, size_t begin, size_t end)
+{
+	Chunk chunk{};
+	chunk.newlines.reserve((end - begin) / 64);
+
+	scanner(data, begin, end, chunk.newlines);
+
+	for (size_t i = 0; i < chunk.newlines.size(); i++) {
+		size_t at = chunk.newlines[i];
+
+		if (at > 0 && data[at - 1] == '\r') {
+			chunk.crlfLines++;
+		}
+		if (i > 0) {
+			chunk.longestInner =
+			  std::max(chunk.longestInner, at - chunk.newlines[i - 1] - 1);
+		}
+	}
+
+	return chunk;
+}
+
+LineIndex
+MergeChunks(std::vector<std::future<Chunk>>& pending,
+            const char*                      data,
+            size_t                           size)
+{
+	std::vector<Chunk> chunks{};
+	chunks.reserve(pending.size());
+
+	size_t total = 0;
+	for (std::future<Chunk>& future : pending) {
+		chunks.push_back(future.get());
+		total += chunks.back().newlines.size();
+	}
+
+	LineIndex index{};
+	index.lineStarts.reserve(total + 1);
+
+	if (size > 0) {
+		index.lineStarts.push_back(0);
+	}
+
+	for (Chunk& chunk : chunks) {
+		if (!chunk.newlines.empty()) {
+			// The line that crosses into this chunk from the previous one
+			size_t lineStart = index.lineStarts.back();
+			index.longestLine =
+			  std::max(index.longestLine, chunk.newlines.front() - lineStart);
+		}
+		index.longestLine = std::max(index.longestLine, chunk.longestInner);
+		index.crlfLines += chunk.crlfLines;
+
+		for (size_t newline : chunk.newlines) {
+			if (newline + 1 < size) {
+				index.lineStarts.push_back(newline + 1);
+			}
+		}
+
+		chunk.newlines = std::vector<size_t>{};
+	}
+
+	// The last line, whether it ends with a newline or not
+	if (!index.lineStarts.empty()) {
+		size_t tail = size - index.lineStarts.back();
+		if (data[size - 1] == '\n') {
+			tail--;
+		}
+		index.longestLine = std::max(index.longestLine, tail);
+	}
+
+	return index;
+}
+
+}
+
+const char*
+LineIndexer::Implementation()
+{
+	return scannerName;
+}
+
+void
+LineIndexer::FindNewlines(const char*          data,
+                          size_t               begin,
+                          size_t               end,
+                          std::vector<size_t>& positions)
+{
+	scanner(data, begin, end, positions);
+}
+
+std::future<LineIndex>
+LineIndexer::BuildAsync(const char*                          data,
+                        size_t                               size,
+                        std::function<void()>                onDone,
+                        std::shared_ptr<std::atomic<size_t>> scanned)
+{
+	ThreadPool& pool = ThreadPool::Shared();
+
+	size_t chunkSize = std::max(minimumChunkSize, size / (pool.Size() * 4) + 1);
+
+	auto pending = std::make_shared<std::vector<std::future<Chunk>>>();
+	for (size_t begin = 0; begin < size; begin += chunkSize) {
+		size_t end = std::min(size, begin + chunkSize);
+		pending->push_back(pool.Submit([data, begin, end, scanned]() {
+			Chunk chunk = ScanChunk(data, begin, end);
+			if (scanned) {
+				*scanned += end - begin;
+			}
+			return chunk;
+		}));
+	}
+
+	// The promise is fulfilled before `onDone` runs, so whoever it wakes up
+	// finds the index ready
+	auto                   promise = std::make_shared<std::promise<LineIndex>>();
+	std::future<LineIndex> result = promise->get_future();
+
+	// Submitted last, so every chunk has been picked up by the time it runs
+	pool.Submit([pending, data, size, promise, onDone]() {
+		promise->set_value(MergeChunks(*pending, data, size));
+		if (onDone) {
+			onDone();
+		}
+	});
+
+	return result;
+}
+
+LineIndex
+LineIndexer::Build(const char* data, size_t size)
+{
+	return BuildAsync(data, size).get();
+}
@@ -0,0 +1,130 @@
+#include <utility> // swap
+
+#include "LineStore.hpp"
+
+namespace {
+// Lines longer than a quarter block get a block of their own, so at most a
+// quarter of a block is left unused when starting the next one
+constexpr size_t blockSize{ 1 << 16 };
+
+// A heap block of std::string, as glibc malloc hands them out
+size_t
+StringBytes(size_t length)
+{
+	constexpr size_t shortString{ 15 };
+
+	size_t bytes = sizeof(std::string);
+	if (length > shortString) {
+		bytes += (length + 1 + sizeof(size_t) + 15) & ~size_t{ 15 };
+	}
+	return bytes;
+}
+}
+
+char*
+LineStore::Allocate(size_t length)
+{
+	if (length > blockSize / 4) {
+		blocks.push_back(std::make_unique<char[]>(length));
+		arenaBytes += length;
+
+		// Keep filling the current block, which is now the one before last
+		if (blocks.size() > 1) {
+			std::swap(blocks[blocks.size() - 1], blocks[blocks.size() - 2]);
+			return blocks[blocks.size() - 2].get();
+		}
+		blockUsed = blockBytes = length;
+		return blocks.back().get();
+	}
+
+	if (blocks.empty() || blockBytes - blockUsed < length) {
+		blocks.push_back(std::make_unique<char[]>(blockSize));
+		arenaBytes += blockSize;
+		blockBytes = blockSize;
+		blockUsed = 0;
+	}
+
+	char* at = blocks.back().get() + blockUsed;
+	blockUsed += length;
+	return at;
+}
+
+size_t
+LineStore::Add(std::string_view chars)
+{
+	Entry entry{};
+
+	entry.length = static_cast<uint32_t>(chars.size());
+	if (chars.size() <= inlineBytes) {
+		chars.copy(entry.bytes, chars.size());
+	} else {
+		char* at = Allocate(chars.size());
+		chars.copy(at, chars.size());
+		entry.data = at;
+	}
+
+	entries.push_back(entry);
+	stringBytes += StringBytes(chars.size());
+	return entries.size() - 1;
+}
+
+std::string_view
+LineStore::Get(size_t index) const
+{
+	const Entry& entry = entries[index];
+
+	if (entry.edited != 0) {
+		return edits[entry.edited - 1].chars;
+	}
+	if (entry.length <= inlineBytes) {
+		return std::string_view(entry.bytes, entry.length);
+	}
+	return std::string_view(entry.data, entry.length);
+}
+
+erow&
+LineStore::Edit(size_t index)
+{
+	Entry& entry = entries[index];
+
+	if (entry.edited == 0) {
+		// Counted as the erow it now is instead
+		stringBytes -= StringBytes(entry.length);
+
+		erow row{};
+		row.chars = Get(index);
+		edits.push_back(std::move(row));
+		entry.edited = static_cast<uint32_t>(edits.size());
+	}
+	return edits[entry.edited - 1];
+}
+
+LineStore::Usage
+LineStore::Measure() const
+{
+	Usage usage{};
+
+	usage.lines = entries.size();
+	usage.edited = edits.size();
+	usage.bytes = entries.size() * sizeof(Entry) + arenaBytes +
+	              blocks.capacity() * sizeof(blocks[0]);
+	usage.stringBytes = stringBytes;
+
+	for (const erow& row : edits) {
+		usage.bytes += StringBytes(row.chars.capacity());
+		usage.stringBytes += StringBytes(row.chars.capacity());
+	}
+	return usage;
+}
+
+void
+LineStore::Clear()
+{
+	entries.clear();
+	blocks.clear();
+	blockBytes = 0;
+	blockUsed = 0;
+	arenaBytes = 0;
+	edits.clear();
+	stringBytes = 0;
+}
@@ -0,0 +1,145 @@
+#include <algorithm> // min
+#include <cerrno>    // for ENOSYS, errno
+#include <cstdio>    // fopen, fread
+
+#if defined(__linux__)
+#include <fcntl.h>    // for open, O_RDONLY
+#include <sys/mman.h> // for mmap, munmap, madvise
+#include <sys/stat.h> // for fstat
+#include <unistd.h>   // for close, sysconf
+#endif
+
+#include "MappedFile.hpp"
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+int
+MappedFile::Open(const char* filename)
+{
+	Close();
+
+#if defined(__linux__)
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct stat st
+	{};
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+
+	// mmap refuses empty mappings, an empty file simply has no data
+	if (size > 0) {
+		void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			close(fd);
+			size = 0;
+			return -1;
+		}
+		madvise(addr, size, MADV_SEQUENTIAL);
+		data = static_cast<const char*>(addr);
+	}
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+#else
+	FILE* file = fopen(filename, "rb");
+	if (file == nullptr) {
+		return -1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = static_cast<size_t>(ftell(file));
+	fseek(file, 0, SEEK_SET);
+
+	if (size > 0) {
+		char* buffer = new char[size];
+		if (fread(buffer, 1, size, file) != size) {
+			delete[] buffer;
+			fclose(file);
+			size = 0;
+			return -1;
+		}
+		data = buffer;
+	}
+
+	fclose(file);
+#endif
+
+	mapped = true;
+	return 0;
+}
+
+int
+MappedFile::Reserve(int fd, size_t capacity)
+{
+	Close();
+
+#if defined(__linux__)
+	// Pages past the end of the file must not be read, but mapping them is
+	// fine, and once the file reaches them they show what was written
+	void* addr = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		return -1;
+	}
+
+	data = static_cast<const char*>(addr);
+	reserved = capacity;
+	mapped = true;
+	return 0;
+#else
+	(void)fd;
+	(void)capacity;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void
+MappedFile::Close()
+{
+	if (data != nullptr) {
+#if defined(__linux__)
+		munmap(const_cast<char*>(data), reserved > 0 ? reserved : size);
+#else
+		delete[] data;
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+	reserved = 0;
+	mapped = false;
+}
+
+void
+MappedFile::Advise(size_t offset, size_t length, bool needed) const
+{
+#if defined(__linux__)
+	if (data == nullptr || offset >= size) {
+		return;
+	}
+
+	// madvise works on whole pages
+	static const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+	size_t begin = offset - offset % page;
+	size_t end = std::min(size, offset + length);
+
+	madvise(const_cast<char*>(data) + begin,
+	        end - begin,
+	        needed ? MADV_WILLNEED : MADV_DONTNEED);
+#else
+	(void)offset;
+	(void)length;
+	(void)needed;
+#endif
+}
@@ -0,0 +1,829 @@
+#include <algorithm> // sort, max
+#include <cstring>   // memcpy
+
+#include "Regex.hpp"
+
+namespace {
+
+// Limits that keep a hostile pattern from taking the editor down with it
+constexpr int    maxDepth{ 256 };
+constexpr int    maxRepeat{ 1000 };
+constexpr size_t maxNfaStates{ 100000 };
+// DFA states cached per direction before the cache is started over
+constexpr size_t maxDfaStates{ 2048 };
+
+template<typename Set>
+void
+Add(Set& set, uint8_t byte)
+{
+	set[byte / 64] |= uint64_t{ 1 } << (byte % 64);
+}
+
+template<typename Set>
+bool
+Has(const Set& set, uint8_t byte)
+{
+	return (set[byte / 64] >> (byte % 64) & 1) != 0;
+}
+
+template<typename Set>
+void
+AddRange(Set& set, uint8_t first, uint8_t last)
+{
+	for (int byte = first; byte <= last; byte++) {
+		Add(set, static_cast<uint8_t>(byte));
+	}
+}
+
+template<typename Set>
+void
+Negate(Set& set)
+{
+	for (uint64_t& word : set) {
+		word = ~word;
+	}
+}
+
+// The byte of a set holding exactly one, -1 otherwise
+template<typename Set>
+int
+SingleByte(const Set& set)
+{
+	int bits = 0;
+	int byte = -1;
+
+	for (size_t i = 0; i < set.size(); i++) {
+		if (set[i] != 0) {
+			bits += __builtin_popcountll(set[i]);
+			byte = static_cast<int>(i * 64) + __builtin_ctzll(set[i]);
+		}
+	}
+
+	return bits == 1 ? byte : -1;
+}
+
+}
+
+bool
+Regex::Compile(std::string_view pattern)
+{
+	*this = Regex();
+
+	size_t at = 0;
+	root = Parse(pattern, at, 0);
+	if (root >= 0 && at < pattern.size()) {
+		error = "unmatched )";
+	}
+	if (!error.empty()) {
+		return false;
+	}
+
+	std::string run{};
+	literal = RequiredLiteral(root, run);
+
+	ByteSet any{};
+	Negate(any);
+	int anySet = AddSet(any);
+
+	BuildClasses();
+
+	for (Automaton* automaton : { &forward, &backward }) {
+		AddState(*automaton, State{ State::Match }); // matchState
+
+		automaton->anchored =
+		  Emit(*automaton, root, matchState, automaton == &backward);
+
+		// Unanchored: skip any number of bytes before the pattern
+		int loop = AddState(*automaton, State{ State::Split });
+		int skip = AddState(*automaton, State{ State::Byte, anySet, loop });
+		automaton->states[loop].out = automaton->anchored;
+		automaton->states[loop].out1 = skip;
+		automaton->unanchored = loop;
+	}
+
+	if (!error.empty()) {
+		root = -1;
+		return false;
+	}
+
+	return true;
+}
+
+int
+Regex::AddNode(Node node)
+{
+	nodes.push_back(std::move(node));
+	return static_cast<int>(nodes.size()) - 1;
+}
+
+int
+Regex::AddSet(const ByteSet& set)
+{
+	sets.push_back(set);
+	return static_cast<int>(sets.size()) - 1;
+}
+
+// alternation := concatenation ('|' concatenation)*
+int
+Regex::Parse(std::string_view pattern, size_t& at, int depth)
+{
+	if (depth > maxDepth) {
+		error = "pattern nested too deeply";
+		return -1;
+	}
+
+	Node alternate{ Node::Alternate };
+
+	while (true) {
+		Node concat{ Node::Concat };
+
+		while (at < pattern.size() && pattern[at] != '|' && pattern[at] != ')') {
+			int child = ParseRepeat(pattern, at, depth);
+			if (child < 0) {
+				return -1;
+			}
+			concat.children.push_back(child);
+		}
+		alternate.children.push_back(AddNode(std::move(concat)));
+
+		if (at < pattern.size() && pattern[at] == '|') {
+			at++;
+			continue;
+		}
+		break;
+	}
+
+	if (alternate.children.size() == 1) {
+		return alternate.children[0];
+	}
+	return AddNode(std::move(alternate));
+}
+
+// repetition := atom ('*' | '+' | '?' | '{m}' | '{m,}' | '{m,n}')*
+int
+Regex::ParseRepeat(std::string_view pattern, size_t& at, int depth)
+{
+	int atom = ParseAtom(pattern, at, depth);
+
+	while (atom >= 0 && at < pattern.size()) {
+		Node repeat{ Node::Repeat };
+
+		switch (pattern[at]) {
+			case '*':
+				repeat.min = 0;
+				repeat.max = -1;
+				at++;
+				break;
+			case '+':
+				repeat.min = 1;
+				repeat.max = -1;
+				at++;
+				break;
+			case '?':
+				repeat.min = 0;
+				repeat.max = 1;
+				at++;
+				break;
+			case '{': {
+				auto number = [&pattern, &at]() {
+					int value = -1;
+					while (at < pattern.size() && pattern[at] >= '0' &&
+					       pattern[at] <= '9' && value <= maxRepeat) {
+						value = (value < 0 ? 0 : value * 10) + (pattern[at] - '0');
+						at++;
+					}
+					return value;
+				};
+
+				at++;
+				repeat.min = number();
+				repeat.max = repeat.min;
+				if (at < pattern.size() && pattern[at] == ',') {
+					at++;
+					repeat.max = number();
+				}
+				if (at >= pattern.size() || pattern[at] != '}' || repeat.min < 0) {
+					error = "bad repetition";
+					return -1;
+				}
+				at++;
+				break;
+			}
+			default:
+				return atom;
+		}
+
+		if (repeat.min > maxRepeat || repeat.max > maxRepeat ||
+		    (repeat.max >= 0 && repeat.max < repeat.min)) {
+			error = "bad repetition count";
+			return -1;
+		}
+
+		repeat.children.push_back(atom);
+		atom = AddNode(std::move(repeat));
+	}
+
+	return atom;
+}
+
+int
+Regex::ParseAtom(std::string_view pattern, size_t& at, int depth)
+{
+	char    c = pattern[at++];
+	ByteSet set{};
+
+	switch (c) {
+		case '(': {
+			int inner = Parse(pattern, at, depth + 1);
+			if (inner < 0) {
+				return -1;
+			}
+			if (at >= pattern.size() || pattern[at] != ')') {
+				error = "missing )";
+				return -1;
+			}
+			at++;
+			return inner;
+		}
+		case '[':
+			if (!ParseClass(pattern, at, set)) {
+				return -1;
+			}
+			break;
+		case '.':
+			Negate(set);
+			break;
+		case '^':
+			return AddNode(Node{ Node::Begin });
+		case '$':
+			return AddNode(Node{ Node::End });
+		case '\\':
+			if (!ParseEscape(pattern, at, set)) {
+				return -1;
+			}
+			break;
+		case '*':
+		case '+':
+		case '?':
+			error = "nothing to repeat";
+			return -1;
+		default:
+			Add(set, static_cast<uint8_t>(c));
+			break;
+	}
+
+	Node node{ Node::Set };
+	node.set = AddSet(set);
+	return AddNode(std::move(node));
+}
+
+// Called after the '[', consumes up to and including the ']'
+bool
+Regex::ParseClass(std::string_view pattern, size_t& at, ByteSet& set)
+{
+	bool negate = at < pattern.size() && pattern[at] == '^';
+	if (negate) {
+		at++;
+	}
+
+	// A ']' right at the start is taken literally
+	bool first = true;
+
+	while (at < pattern.size() && (pattern[at] != ']' || first)) {
+		first = false;
+
+		auto low = static_cast<uint8_t>(pattern[at++]);
+		if (low == '\\') {
+			ByteSet escaped{};
+			if (!ParseEscape(pattern, at, escaped)) {
+				return false;
+			}
+			// \d and friends cannot start a range
+			int byte = SingleByte(escaped);
+			if (byte < 0) {
+				for (size_t i = 0; i < set.size(); i++) {
+					set[i] |= escaped[i];
+				}
+				continue;
+			}
+			low = static_cast<uint8_t>(byte);
+		}
+
+		if (at + 1 < pattern.size() && pattern[at] == '-' &&
+		    pattern[at + 1] != ']') {
+			auto high = static_cast<uint8_t>(pattern[at + 1]);
+			at += 2;
+			if (high == '\\') {
+				ByteSet escaped{};
+				if (!ParseEscape(pattern, at, escaped)) {
+					return false;
+				}
+				if (SingleByte(escaped) < 0) {
+					error = "bad range in []";
+					return false;
+				}
+				high = static_cast<uint8_t>(SingleByte(escaped));
+			}
+			if (high < low) {
+				error = "bad range in []";
+				return false;
+			}
+			AddRange(set, low, high);
+		} else {
+			Add(set, low);
+		}
+	}
+
+	if (at >= pattern.size()) {
+		error = "missing ]";
+		return false;
+	}
+	at++;
+
+	if (negate) {
+		Negate(set);
+	}
+	return true;
+}
+
+// Called after the '\'
+bool
+Regex::ParseEscape(std::string_view pattern, size_t& at, ByteSet& set)
+{
+	if (at >= pattern.size()) {
+		error = "trailing \\";
+		return false;
+	}
+
+	char c = pattern[at++];
+
+	switch (c) {
+		case 'd':
+		case 'D':
+			AddRange(set, '0', '9');
+			break;
+		case 'w':
+		case 'W':
+			AddRange(set, '0', '9');
+			AddRange(set, 'A', 'Z');
+			AddRange(set, 'a', 'z');
+			Add(set, '_');
+			break;
+		case 's':
+		case 'S':
+			for (char space : { ' ', '\t', '\r', '\n', '\f', '\v' }) {
+				Add(set, static_cast<uint8_t>(space));
+			}
+			break;
+		case 't':
+			Add(set, '\t');
+			return true;
+		case 'n':
+			Add(set, '\n');
+			return true;
+		case 'r':
+			Add(set, '\r');
+			return true;
+		case 'f':
+			Add(set, '\f');
+			return true;
+		case 'v':
+			Add(set, '\v');
+			return true;
+		default:
+			if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+			    (c >= 'a' && c <= 'z')) {
+				error = std::string("unsupported escape \\") + c;
+				return false;
+			}
+			Add(set, static_cast<uint8_t>(c));
+			return true;
+	}
+
+	if (c >= 'A' && c <= 'Z') {
+		Negate(set);
+	}
+	return true;
+}
+
+// The longest run of bytes that every match contains. `run` is the run the
+// node continues, the best one that ended inside the node is returned.
+std::string
+Regex::RequiredLiteral(int node, std::string& run) const
+{
+	const Node& n = nodes[node];
+	std::string best{};
+
+	auto keep = [&best](const std::string& candidate) {
+		if (candidate.size() > best.size()) {
+			best = candidate;
+		}
+	};
+
+	switch (n.kind) {
+		case Node::Empty:
+		case Node::Begin:
+		case Node::End:
+			// Zero width, the run carries on
+			break;
+		case Node::Set: {
+			int byte = SingleByte(sets[n.set]);
+
+			if (byte >= 0 && byte != '\n') {
+				run.push_back(static_cast<char>(byte));
+			} else {
+				keep(run);
+				run.clear();
+			}
+			break;
+		}
+		case Node::Concat:
+			for (int child : n.children) {
+				keep(RequiredLiteral(child, run));
+			}
+			break;
+		case Node::Repeat:
+			keep(run);
+			run.clear();
+			if (n.min > 0) {
+				std::string inner{};
+				keep(RequiredLiteral(n.children[0], inner));
+				keep(inner);
+			}
+			break;
+		case Node::Alternate:
+			keep(run);
+			run.clear();
+			break;
+	}
+
+	if (node == root) {
+		keep(run);
+	}
+	return best;
+}
+
+int
+Regex::AddState(Automaton& automaton, State state)
+{
+	if (automaton.states.size() >= maxNfaStates) {
+		error = "pattern too large";
+		return 0;
+	}
+	automaton.states.push_back(state);
+	return static_cast<int>(automaton.states.size()) - 1;
+}
+
+// Builds the states for `node` backwards from `out`, the state that follows
+// it, and returns its start. Read backwards, a concatenation runs in the
+// opposite order and the two anchors trade places.
+int
+Regex::Emit(Automaton& automaton, int node, int out, bool reversed)
+{
+	if (!error.empty()) {
+		return out;
+	}
+
+	const Node& n = nodes[node];
+
+	switch (n.kind) {
+		case Node::Empty:
+			return out;
+		case Node::Set:
+			return AddState(automaton, State{ State::Byte, n.set, out });
+		case Node::Begin:
+		case Node::End: {
+			bool begin = (n.kind == Node::Begin) != reversed;
+			return AddState(automaton,
+			                State{ begin ? State::Begin : State::End, -1, out });
+		}
+		case Node::Concat:
+			if (reversed) {
+				for (int child : n.children) {
+					out = Emit(automaton, child, out, reversed);
+				}
+			} else {
+				for (auto child = n.children.rbegin(); child != n.children.rend();
+				     ++child) {
+					out = Emit(automaton, *child, out, reversed);
+				}
+			}
+			return out;
+		case Node::Alternate: {
+			int start = Emit(automaton, n.children.back(), out, reversed);
+			for (size_t i = n.children.size() - 1; i-- > 0;) {
+				int branch = Emit(automaton, n.children[i], out, reversed);
+				start = AddState(automaton, State{ State::Split, -1, branch, start });
+			}
+			return start;
+		}
+		case Node::Repeat: {
+			int child = n.children[0];
+			int start = out;
+
+			if (n.max < 0) {
+				int loop = AddState(automaton, State{ State::Split });
+				int body = Emit(automaton, child, loop, reversed);
+				automaton.states[loop].out = body;
+				automaton.states[loop].out1 = out;
+				start = loop;
+			} else {
+				for (int i = n.min; i < n.max && error.empty(); i++) {
+					int body = Emit(automaton, child, start, reversed);
+					start = AddState(automaton, State{ State::Split, -1, body, out });
+				}
+			}
+
+			for (int i = 0; i < n.min && error.empty(); i++) {
+				start = Emit(automaton, child, start, reversed);
+			}
+			return start;
+		}
+	}
+
+	return out;
+}
+
+// Bytes that are in exactly the same sets behave the same and share a column
+void
+Regex::BuildClasses()
+{
+	std::unordered_map<std::string, uint8_t> columns{};
+	std::string                              signature(sets.size(), '\0');
+
+	for (int byte = 0; byte < 256; byte++) {
+		for (size_t i = 0; i < sets.size(); i++) {
+			signature[i] = Has(sets[i], static_cast<uint8_t>(byte)) ? '1' : '0';
+		}
+
+		auto [column, added] =
+		  columns.try_emplace(signature, static_cast<uint8_t>(columns.size()));
+		classes[byte] = column->second;
+	}
+
+	classCount = columns.size();
+}
+
+// Adds the states reachable from `state` without reading a byte. Begin only
+// holds at the start of the text, End is kept in the set and resolved there.
+void
+Regex::Closure(const Automaton&      automaton,
+               int                   state,
+               bool                  atBegin,
+               std::vector<int>&     out,
+               std::vector<uint8_t>& visited) const
+{
+	std::vector<int> stack{ state };
+
+	while (!stack.empty()) {
+		int s = stack.back();
+		stack.pop_back();
+
+		if (visited[s] != 0) {
+			continue;
+		}
+		visited[s] = 1;
+
+		const State& st = automaton.states[s];
+		switch (st.kind) {
+			case State::Byte:
+			case State::End:
+			case State::Match:
+				out.push_back(s);
+				break;
+			case State::Split:
+				stack.push_back(st.out1);
+				stack.push_back(st.out);
+				break;
+			case State::Begin:
+				if (atBegin) {
+					stack.push_back(st.out);
+				}
+				break;
+		}
+	}
+}
+
+// Whether a match is reached from `nfa` once every End in it holds, at the
+// end of the text. With `atBegin` that is also its start, an empty text, so
+// a Begin after an End holds as well, as in `$^`.
+bool
+Regex::ReachesMatch(const Automaton&        automaton,
+                    const std::vector<int>& nfa,
+                    bool                    atBegin) const
+{
+	std::vector<uint8_t> visited(automaton.states.size(), 0);
+	std::vector<int>     stack(nfa);
+
+	while (!stack.empty()) {
+		int s = stack.back();
+		stack.pop_back();
+
+		if (visited[s] != 0) {
+			continue;
+		}
+		visited[s] = 1;
+
+		const State& st = automaton.states[s];
+		if (st.kind == State::Match) {
+			return true;
+		}
+		if (st.kind == State::Split) {
+			stack.push_back(st.out);
+			stack.push_back(st.out1);
+		} else if (st.kind == State::End ||
+		           (st.kind == State::Begin && atBegin)) {
+			stack.push_back(st.out);
+		}
+	}
+
+	return false;
+}
+
+int
+Regex::Intern(Automaton& automaton, std::vector<int>& nfa)
+{
+	std::sort(nfa.begin(), nfa.end());
+
+	std::string key(nfa.size() * sizeof(int), '\0');
+	if (!nfa.empty()) {
+		memcpy(key.data(), nfa.data(), key.size());
+	}
+
+	auto found = automaton.known.find(key);
+	if (found != automaton.known.end()) {
+		return found->second;
+	}
+
+	DfaState state{};
+	state.nfa = nfa;
+	state.dead = nfa.empty();
+	state.match = !nfa.empty() && nfa[0] == matchState;
+
+	state.matchAtEnd = ReachesMatch(automaton, nfa, false);
+	state.matchAtEmpty = ReachesMatch(automaton, nfa, true);
+
+	auto index = static_cast<int>(automaton.dfa.size());
+	automaton.dfa.push_back(std::move(state));
+	automaton.next.resize(automaton.next.size() + classCount, -1);
+	automaton.known.emplace(std::move(key), index);
+
+	return index;
+}
+
+int
+Regex::Start(Automaton& automaton, bool unanchored, bool atBegin)
+{
+	int& start = automaton.starts[(unanchored ? 2 : 0) + (atBegin ? 1 : 0)];
+
+	if (start < 0) {
+		scratch.clear();
+		seen.assign(automaton.states.size(), 0);
+		Closure(automaton,
+		        unanchored ? automaton.unanchored : automaton.anchored,
+		        atBegin,
+		        scratch,
+		        seen);
+		start = Intern(automaton, scratch);
+	}
+
+	return start;
+}
+
+void
+Regex::Flush(Automaton& automaton)
+{
+	automaton.dfa.clear();
+	automaton.next.clear();
+	automaton.known.clear();
+	automaton.starts.fill(-1);
+}
+
+// The state after reading `byte` in state `from`, building it if it is new
+int
+Regex::Step(Automaton& automaton, int from, uint8_t byte)
+{
+	int32_t to = automaton.next[from * classCount + classes[byte]];
+	if (to >= 0) {
+		return to;
+	}
+
+	if (automaton.dfa.size() >= maxDfaStates) {
+		std::vector<int> current = automaton.dfa[from].nfa;
+		Flush(automaton);
+		from = Intern(automaton, current);
+	}
+
+	scratch.clear();
+	seen.assign(automaton.states.size(), 0);
+	for (int s : automaton.dfa[from].nfa) {
+		const State& st = automaton.states[s];
+		if (st.kind == State::Byte && Has(sets[st.set], byte)) {
+			Closure(automaton, st.out, false, scratch, seen);
+		}
+	}
+
+	to = Intern(automaton, scratch);
+	automaton.next[from * classCount + classes[byte]] = to;
+
+	return to;
+}
+
+bool
+Regex::Matches(std::string_view text)
+{
+	if (root < 0) {
+		return false;
+	}
+
+	int state = Start(forward, true, true);
+
+	for (char c : text) {
+		if (forward.dfa[state].match) {
+			return true;
+		}
+		state = Step(forward, state, static_cast<uint8_t>(c));
+	}
+
+	const DfaState& end = forward.dfa[state];
+	return end.match || (text.empty() ? end.matchAtEmpty : end.matchAtEnd);
+}
+
+// Runs the reversed pattern from the end of the text to its start; wherever
+// it is in a matching state, a match of the pattern starts.
+void
+Regex::Scan(std::string_view text)
+{
+	size_t size = text.size();
+
+	startsAt.assign(size + 1, 0);
+	if (root < 0) {
+		return;
+	}
+
+	int state = Start(backward, true, true);
+	if (backward.dfa[state].match ||
+	    (size == 0 && backward.dfa[state].matchAtEmpty)) {
+		startsAt[size] = 1;
+	}
+
+	for (size_t p = size; p-- > 0;) {
+		state = Step(backward, state, static_cast<uint8_t>(text[p]));
+
+		const DfaState& s = backward.dfa[state];
+		if (s.match || (p == 0 && s.matchAtEnd)) {
+			startsAt[p] = 1;
+		}
+	}
+}
+
+size_t
+Regex::StartAfter(size_t from) const
+{
+	for (size_t p = from; p < startsAt.size(); p++) {
+		if (startsAt[p] != 0) {
+			return p;
+		}
+	}
+	return npos;
+}
+
+size_t
+Regex::StartBefore(size_t before) const
+{
+	for (size_t p = std::min(before, startsAt.size()); p-- > 0;) {
+		if (startsAt[p] != 0) {
+			return p;
+		}
+	}
+	return npos;
+}
+
+size_t
+Regex::Length(std::string_view text, size_t start)
+{
+	if (root < 0 || start > text.size()) {
+		return npos;
+	}
+
+	int    state = Start(forward, false, start == 0);
+	size_t longest = forward.dfa[state].match ? 0 : npos;
+	size_t p = start;
+
+	for (; p < text.size(); p++) {
+		state = Step(forward, state, static_cast<uint8_t>(text[p]));
+		if (forward.dfa[state].dead) {
+			break;
+		}
+		if (forward.dfa[state].match) {
+			longest = p + 1 - start;
+		}
+	}
+
+	const DfaState& end = forward.dfa[state];
+	if (p == text.size() && (p == 0 ? end.matchAtEmpty : end.matchAtEnd)) {
+		longest = text.size() - start;
+	}
+
+	return longest;
+}
@@ -0,0 +1,223 @@
+#include <cstring> // memchr
+
+#include "constants.hpp"
+#include "RenderCache.hpp"
+#include "Utf8.hpp"
+
+namespace {
+constexpr size_t npos{ SIZE_MAX };
+}
+
+RenderCache::RenderCache(size_t capacity)
+{
+	entries.reserve(capacity);
+
+	size_t slotCount = 1;
+	while (slotCount < capacity * 2) {
+		slotCount <<= 1;
+	}
+	slots.assign(slotCount, none);
+}
+
+size_t
+RenderCache::Slot(uint64_t key) const
+{
+	return static_cast<size_t>(key * 0x9e3779b97f4a7c15ULL >> 32) &
+	       (slots.size() - 1);
+}
+
+size_t
+RenderCache::Find(uint64_t key) const
+{
+	size_t mask = slots.size() - 1;
+
+	for (size_t i = Slot(key); slots[i] != none; i = (i + 1) & mask) {
+		if (entries[slots[i]].key == key) {
+			return i;
+		}
+	}
+	return npos;
+}
+
+void
+RenderCache::Unlink(uint32_t entry)
+{
+	Entry& e = entries[entry];
+
+	if (e.newer != none) {
+		entries[e.newer].older = e.older;
+	} else {
+		newest = e.older;
+	}
+	if (e.older != none) {
+		entries[e.older].newer = e.newer;
+	} else {
+		oldest = e.newer;
+	}
+
+	e.newer = none;
+	e.older = none;
+}
+
+void
+RenderCache::PushNewest(uint32_t entry)
+{
+	entries[entry].older = newest;
+	entries[entry].newer = none;
+
+	if (newest != none) {
+		entries[newest].newer = entry;
+	}
+	newest = entry;
+
+	if (oldest == none) {
+		oldest = entry;
+	}
+}
+
+// Removes a slot from the linear probing table, shifting back the entries
+// that were displaced past it.
+void
+RenderCache::EraseSlot(size_t slot)
+{
+	size_t mask = slots.size() - 1;
+
+	slots[slot] = none;
+
+	for (size_t next = (slot + 1) & mask; slots[next] != none;
+	     next = (next + 1) & mask) {
+		size_t home = Slot(entries[slots[next]].key);
+
+		bool stays = slot <= next ? (slot < home && home <= next)
+		                          : (slot < home || home <= next);
+		if (!stays) {
+			slots[slot] = slots[next];
+			slots[next] = none;
+			slot = next;
+		}
+	}
+}
+
+void
+RenderCache::Expand(std::string_view chars, std::string& render)
+{
+	render.clear();
+
+	// Tab stops are counted in columns, which UTF-8 characters take as many
+	// of as they are wide rather than as they have bytes
+	const size_t tabStop = kilojoule::defaults::tabStop;
+
+	size_t column = 0;
+	size_t from = 0;
+	for (size_t at = utf8::SkipPlain(chars, 0); at < chars.size();
+	     at = utf8::SkipPlain(chars, from)) {
+		render.append(chars.substr(from, at - from));
+		column += at - from;
+
+		if (chars[at] == '\t') {
+			size_t width = tabStop - column % tabStop;
+			render.append(width, ' ');
+			column += width;
+			from = at + 1;
+		} else {
+			char32_t codepoint = 0;
+			size_t   length = utf8::Decode(chars, at, codepoint);
+			render.append(chars.substr(at, length));
+			column += utf8::Width(codepoint);
+			from = at + length;
+		}
+	}
+
+	render.append(chars.substr(from));
+}
+
+std::string_view
+RenderCache::Get(uint64_t key, std::string_view chars)
+{
+	// Nothing to expand, the line renders as itself
+	if (memchr(chars.data(), '\t', chars.size()) == nullptr) {
+		return chars;
+	}
+
+	size_t slot = Find(key);
+	if (slot != npos) {
+		uint32_t entry = slots[slot];
+		Unlink(entry);
+		PushNewest(entry);
+		hits++;
+		return entries[entry].render;
+	}
+
+	misses++;
+
+	uint32_t entry{ none };
+	if (entries.size() < entries.capacity()) {
+		entry = static_cast<uint32_t>(entries.size());
+		entries.emplace_back();
+	} else {
+		entry = oldest;
+		Unlink(entry);
+
+		// Invalidated entries are no longer in the table
+		size_t old = Find(entries[entry].key);
+		if (old != npos && slots[old] == entry) {
+			EraseSlot(old);
+		}
+	}
+
+	entries[entry].key = key;
+	Expand(chars, entries[entry].render);
+
+	size_t i = Slot(key);
+	while (slots[i] != none) {
+		i = (i + 1) & (slots.size() - 1);
+	}
+	slots[i] = entry;
+	PushNewest(entry);
+
+	return entries[entry].render;
+}
+
+void
+RenderCache::Invalidate(uint64_t key)
+{
+	size_t slot = Find(key);
+	if (slot == npos) {
+		return;
+	}
+
+	uint32_t entry = slots[slot];
+	EraseSlot(slot);
+
+	// First in line to be reused
+	Unlink(entry);
+	entries[entry].newer = oldest;
+	if (oldest != none) {
+		entries[oldest].older = entry;
+	}
+	oldest = entry;
+	if (newest == none) {
+		newest = entry;
+	}
+}
+
+void
+RenderCache::Clear()
+{
+	for (uint32_t& slot : slots) {
+		slot = none;
+	}
+	for (Entry& entry : entries) {
+		entry.render.clear();
+	}
+
+	// Keep the entries and their capacity, all of them are free again
+	newest = none;
+	oldest = none;
+	for (uint32_t entry = 0; entry < entries.size(); entry++) {
+		entries[entry].key = UINT64_MAX;
+		entries[entry].newer = none;
+		entries[entry].older = none;
+		PushNewest(entry);
+	}
+}
@@ -0,0 +1,320 @@
+#include <algorithm> // min
+#include <array>
+#include <charconv> // to_chars
+#include <utility>  // swap
+
+#include "constants.hpp"
+#include "Screen.hpp"
+#include "Terminal.hpp"
+#include "Utf8.hpp"
+
+namespace {
+// Unchanged cells shorter than this are rewritten instead of jumped over,
+// a cursor jump costs about as many bytes
+constexpr size_t mergeGap{ 6 };
+}
+
+void
+Screen::Resize(size_t rows, size_t columns)
+{
+	this->rows = rows;
+	this->columns = columns;
+
+	current.assign(rows * columns, Cell{});
+	next.assign(rows * columns, Cell{});
+
+	// Room for a full redraw with a style change and a jump on every row
+	output.clear();
+	output.reserve(rows * (columns * 4 + 32) + 64);
+
+	cursorRow = 0;
+	cursorColumn = 0;
+	invalid = true;
+}
+
+void
+Screen::Clear()
+{
+	for (Cell& cell : next) {
+		cell = Cell{};
+	}
+}
+
+// Writes `text` into the next frame starting at the given cell, clipped to
+// the row. Control characters are shown the kilo way, as a reversed '@' + c
+// or '?', and so are bytes that are not valid UTF-8. A wide character takes
+// its cell and a continuation cell after it, or a blank if only one is left.
+// Combining marks are added to the cell before them while its glyph has room.
+// Returns the number of cells written.
+size_t
+Screen::Put(size_t row, size_t column, std::string_view text, Style style)
+{
+	if (row >= rows || column >= columns) {
+		return 0;
+	}
+
+	Cell*  cell = &next[row * columns];
+	size_t x = column;
+
+	for (size_t i = 0; i < text.size() && x < columns;) {
+		auto c = static_cast<unsigned char>(text[i]);
+
+		if (c < 0x80) {
+			if (c < 32 || c == 127) {
+				cell[x].glyph = c <= 26 ? '@' + c : '?';
+				cell[x].style = Style{ style.foreground, !style.reverse };
+			} else {
+				cell[x].glyph = c;
+				cell[x].style = style;
+			}
+			x++;
+			i++;
+			continue;
+		}
+
+		char32_t codepoint = 0;
+		size_t   length = utf8::Decode(text, i, codepoint);
+		int      width = utf8::Width(codepoint);
+
+		uint32_t glyph = 0;
+		for (size_t j = length; j > 0; j--) {
+			glyph = glyph << 8 | static_cast<unsigned char>(text[i + j - 1]);
+		}
+		i += length;
+
+		if (codepoint == utf8::invalid || codepoint < 0xa0) {
+			cell[x].glyph = '?';
+			cell[x].style = Style{ style.foreground, !style.reverse };
+			x++;
+		} else if (width == 0) {
+			size_t base = x;
+			while (base > 0 && cell[base - 1].glyph == 0) {
+				base--;
+			}
+			if (base > 0 && cell[base - 1].glyph < 1U << (8 * (4 - length))) {
+				uint32_t& previous = cell[base - 1].glyph;
+				int       used = previous < 1U << 8 ? 1 : previous < 1U << 16 ? 2 : 3;
+				previous |= glyph << (8 * used);
+			}
+		} else if (width == 2 && x + 1 == columns) {
+			cell[x].glyph = ' ';
+			cell[x].style = style;
+			x++;
+		} else {
+			cell[x].glyph = glyph;
+			cell[x].style = style;
+			if (width == 2) {
+				cell[x + 1].glyph = 0; // covered by the one before
+				cell[x + 1].style = style;
+			}
+			x += width;
+		}
+	}
+
+	return x - column;
+}
+
+size_t
+Screen::PutNumber(size_t row, size_t column, size_t number, Style style)
+{
+	std::array<char, 24> digits{};
+
+	char* end =
+	  std::to_chars(digits.data(), digits.data() + digits.size(), number).ptr;
+
+	return Put(
+	  row, column, std::string_view(digits.data(), end - digits.data()), style);
+}
+
+void
+Screen::Fill(size_t row, size_t column, size_t count, char c, Style style)
+{
+	if (row >= rows || column >= columns) {
+		return;
+	}
+
+	count = std::min(count, columns - column);
+	Cell* cell = &next[row * columns + column];
+
+	for (size_t i = 0; i < count; i++) {
+		cell[i].glyph = static_cast<unsigned char>(c);
+		cell[i].style = style;
+	}
+}
+
+void
+Screen::SetCursor(size_t row, size_t column)
+{
+	cursorRow = row;
+	cursorColumn = column;
+}
+
+void
+Screen::MoveTo(size_t row, size_t column)
+{
+	if (outputRow == row && outputColumn == column) {
+		return;
+	}
+
+	Terminal::SetCursorPositionEscapeSequence(output, row + 1, column + 1);
+	outputRow = row;
+	outputColumn = column;
+}
+
+void
+Screen::SetStyle(Style style)
+{
+	if (style == outputStyle) {
+		return;
+	}
+
+	output.append(escapeSequences::color::reset);
+	if (style.reverse) {
+		output.append(escapeSequences::color::reverse);
+	}
+	if (style.foreground != 0) {
+		escapeSequences::color::appendEscapeSequence(output, style.foreground);
+	}
+	outputStyle = style;
+}
+
+void
+Screen::EmitRun(size_t row, size_t begin, size_t end)
+{
+	const Cell* cell = &next[row * columns];
+
+	// Wide characters are written whole, from their first cell
+	while (begin > 0 && cell[begin].glyph == 0) {
+		begin--;
+	}
+	while (end < columns && cell[end].glyph == 0) {
+		end++;
+	}
+
+	MoveTo(row, begin);
+	for (size_t x = begin; x < end; x++) {
+		SetStyle(cell[x].style);
+
+		for (uint32_t glyph = cell[x].glyph; glyph != 0; glyph >>= 8) {
+			output.push_back(static_cast<char>(glyph & 0xff));
+		}
+	}
+
+	// Writing into the last column leaves the cursor in a pending wrap state
+	// that terminals disagree on, so forget where it is
+	if (end < columns) {
+		outputColumn = end;
+	} else {
+		outputRow = SIZE_MAX;
+		outputColumn = SIZE_MAX;
+	}
+}
+
+const std::string&
+Screen::Flush(FrameStats& stats)
+{
+	output.clear();
+
+	stats.changedCells = 0;
+	stats.runs = 0;
+
+	if (invalid) {
+		output.append(escapeSequences::hideCursor);
+		output.append(escapeSequences::color::reset);
+		output.append(escapeSequences::clearEntireScreen);
+
+		for (Cell& cell : current) {
+			cell = Cell{};
+		}
+		outputStyle = Style{};
+		outputRow = SIZE_MAX;
+		outputColumn = SIZE_MAX;
+		shownCursorRow = SIZE_MAX;
+		invalid = false;
+	}
+
+	const Cell blank{};
+	size_t     hideAt = output.size();
+	bool       hidden = !output.empty();
+
+	for (size_t y = 0; y < rows; y++) {
+		const Cell* n = &next[y * columns];
+		const Cell* c = &current[y * columns];
+
+		size_t nextEnd = columns;
+		while (nextEnd > 0 && n[nextEnd - 1] == blank) {
+			nextEnd--;
+		}
+		size_t currentEnd = columns;
+		while (currentEnd > 0 && c[currentEnd - 1] == blank) {
+			currentEnd--;
+		}
+
+		size_t x = 0;
+		while (x < nextEnd) {
+			if (n[x] == c[x]) {
+				x++;
+				continue;
+			}
+
+			size_t begin = x;
+			size_t end = x + 1;
+			for (size_t j = end; j < nextEnd && j - end < mergeGap; j++) {
+				if (n[j] != c[j]) {
+					end = j + 1;
+				}
+			}
+
+			if (!hidden) {
+				output.insert(hideAt, escapeSequences::hideCursor);
+				hidden = true;
+			}
+
+			if (outputRow != y || outputColumn != begin) {
+				stats.runs++;
+			}
+			EmitRun(y, begin, end);
+			x = end;
+		}
+
+		for (size_t i = 0; i < columns; i++) {
+			if (n[i] != c[i]) {
+				stats.changedCells++;
+			}
+		}
+
+		// Whatever the old frame had past the new content
+		if (currentEnd > nextEnd) {
+			if (!hidden) {
+				output.insert(hideAt, escapeSequences::hideCursor);
+				hidden = true;
+			}
+			if (outputRow != y || outputColumn != nextEnd) {
+				stats.runs++;
+			}
+			MoveTo(y, nextEnd);
+			SetStyle(Style{});
+			output.append(escapeSequences::eraseInLine);
+		}
+	}
+
+	SetStyle(Style{});
+
+	if (hidden || shownCursorRow != cursorRow ||
+	    shownCursorColumn != cursorColumn) {
+		Terminal::SetCursorPositionEscapeSequence(
+		  output, cursorRow + 1, cursorColumn + 1);
+		outputRow = cursorRow;
+		outputColumn = cursorColumn;
+		shownCursorRow = cursorRow;
+		shownCursorColumn = cursorColumn;
+	}
+	if (hidden) {
+		output.append(escapeSequences::showCursor);
+	}
+
+	std::swap(current, next);
+
+	stats.bytes = output.size();
+	return output;
+}
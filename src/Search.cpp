@@ -0,0 +1,345 @@
+#include <algorithm> // max, min
+#include <utility>   // move
+
+#include "constants.hpp"
+#include "Search.hpp"
+
+namespace {
+
+void
+Mark(std::vector<uint64_t>& bits, size_t line)
+{
+	bits[line / 64] |= uint64_t{ 1 } << (line % 64);
+}
+
+}
+
+bool
+Search::Run(const TextBuffer&            rows,
+            std::string_view             newQuery,
+            bool                         newRegex,
+            const std::function<bool()>& cancelled)
+{
+	if (valid && newQuery == query && newRegex == regex &&
+	    lines == rows.LineCount()) {
+		return true;
+	}
+
+	// A longer expression can match more, a longer string only less
+	bool refine = valid && !regex && !newRegex && lines == rows.LineCount() &&
+	              !query.empty() && newQuery.size() > query.size() &&
+	              newQuery.substr(0, query.size()) == query;
+
+	Searcher previousSearcher = std::move(searcher);
+	Regex    previousPattern = std::move(pattern);
+	bool     previousRegex = regex;
+	bool     compiled = true;
+
+	if (newRegex) {
+		compiled = pattern.Compile(newQuery);
+		searcher = Searcher(pattern.Literal());
+	} else {
+		pattern = Regex();
+		searcher = Searcher(newQuery);
+	}
+	regex = newRegex;
+	scratch.assign((rows.LineCount() + 63) / 64, 0);
+
+	bool done = !compiled || newQuery.empty() ||
+	            (refine ? Refine(rows, cancelled) : Scan(rows, cancelled));
+	if (!done) {
+		// Keep the last complete result, it still describes `query`
+		searcher = std::move(previousSearcher);
+		pattern = std::move(previousPattern);
+		regex = previousRegex;
+		return false;
+	}
+
+	query = newQuery;
+	valid = true;
+	lines = rows.LineCount();
+	matches.swap(scratch);
+
+	count = 0;
+	for (uint64_t word : matches) {
+		count += __builtin_popcountll(word);
+	}
+
+	return true;
+}
+
+bool
+Search::LineMatches(std::string_view text) const
+{
+	if (searcher.Size() > 0 && searcher.Find(text) == Searcher::npos) {
+		return false;
+	}
+	return !regex || pattern.Matches(text);
+}
+
+bool
+Search::Scan(const TextBuffer& rows, const std::function<bool()>& cancelled)
+{
+	std::string_view bytes = rows.OriginalBytes();
+	size_t           overlap = searcher.Size() > 0 ? searcher.Size() - 1 : 0;
+	size_t           work = 0;
+
+	// Input is checked for every searchWindow bytes or so
+	auto giveUp = [&work, &cancelled](size_t done) {
+		work += done;
+		if (work < kilojoule::defaults::searchWindow) {
+			return false;
+		}
+		work = 0;
+		return cancelled && cancelled();
+	};
+
+	pieces.clear();
+	rows.Pieces(pieces);
+
+	for (const TextBuffer::Piece& piece : pieces) {
+		if (!piece.original || searcher.Size() == 0) {
+			// Edited lines, or an expression without a literal to look for
+			for (size_t i = 0; i < piece.count; i++) {
+				std::string_view text = piece.original
+				                          ? rows.OriginalLine(piece.start + i)
+				                          : rows.Line(piece.at + i);
+				if (giveUp(text.size() + 1)) {
+					return false;
+				}
+				if (LineMatches(text)) {
+					Mark(scratch, piece.at + i);
+				}
+			}
+			continue;
+		}
+
+		size_t at = rows.OriginalOffset(piece.start);
+		size_t end = rows.OriginalOffset(piece.start + piece.count);
+
+		while (at < end) {
+			if (giveUp(0)) {
+				return false;
+			}
+
+			size_t windowEnd =
+			  std::min(end, at + kilojoule::defaults::searchWindow + overlap);
+			size_t hit = searcher.Find(bytes.data() + at, windowEnd - at);
+
+			if (hit == Searcher::npos) {
+				work += windowEnd - at;
+				at = windowEnd == end ? end : windowEnd - overlap;
+				continue;
+			}
+
+			// Lines do not span newlines, so carry on at the next line
+			size_t line = rows.OriginalLineAt(at + hit);
+			if (!regex || pattern.Matches(rows.OriginalLine(line))) {
+				Mark(scratch, piece.at + (line - piece.start));
+			}
+
+			size_t next = rows.OriginalOffset(line + 1);
+			work += next - at;
+			at = next;
+		}
+	}
+
+	return true;
+}
+
+bool
+Search::Refine(const TextBuffer& rows, const std::function<bool()>& cancelled)
+{
+	size_t work = 0;
+
+	for (size_t line = NextSet(0); line != Searcher::npos;
+	     line = NextSet(line + 1)) {
+		std::string_view text = rows.Line(line);
+
+		work += text.size() + 1;
+		if (work >= kilojoule::defaults::searchWindow) {
+			if (cancelled && cancelled()) {
+				return false;
+			}
+			work = 0;
+		}
+
+		if (LineMatches(text)) {
+			Mark(scratch, line);
+		}
+	}
+
+	return true;
+}
+
+void
+Search::Clear()
+{
+	query.clear();
+	regex = false;
+	valid = false;
+	searcher = Searcher();
+	pattern = Regex();
+	matches.clear();
+	scratch.clear();
+	lines = 0;
+	count = 0;
+}
+
+size_t
+Search::NextSet(size_t line) const
+{
+	if (line >= lines) {
+		return Searcher::npos;
+	}
+
+	size_t   index = line / 64;
+	uint64_t word = matches[index] & (~uint64_t{ 0 } << (line % 64));
+
+	while (word == 0) {
+		if (++index == matches.size()) {
+			return Searcher::npos;
+		}
+		word = matches[index];
+	}
+
+	return index * 64 + __builtin_ctzll(word);
+}
+
+size_t
+Search::PreviousSet(size_t line) const
+{
+	if (lines == 0) {
+		return Searcher::npos;
+	}
+	line = std::min(line, lines - 1);
+
+	size_t   index = line / 64;
+	uint64_t word = matches[index] & (~uint64_t{ 0 } >> (63 - line % 64));
+
+	while (word == 0) {
+		if (index-- == 0) {
+			return Searcher::npos;
+		}
+		word = matches[index];
+	}
+
+	return index * 64 + 63 - __builtin_clzll(word);
+}
+
+// Start of the first match in `text` at or after `from`
+size_t
+Search::First(std::string_view text, size_t from) const
+{
+	if (regex) {
+		pattern.Scan(text);
+		return pattern.StartAfter(from);
+	}
+
+	size_t hit = searcher.Find(text.substr(from));
+	return hit != Searcher::npos ? from + hit : hit;
+}
+
+// Start of the last match in `text` before `before`
+size_t
+Search::Last(std::string_view text, size_t before) const
+{
+	if (regex) {
+		pattern.Scan(text);
+		return pattern.StartBefore(before);
+	}
+
+	size_t last = Searcher::npos;
+	size_t from = 0;
+
+	while (from <= text.size()) {
+		size_t hit = searcher.Find(text.substr(from));
+		if (hit == Searcher::npos || from + hit >= before) {
+			break;
+		}
+		last = from + hit;
+		from = last + 1;
+	}
+
+	return last;
+}
+
+void
+Search::Spans(std::string_view                         text,
+              std::vector<std::pair<size_t, size_t>>& out) const
+{
+	out.clear();
+
+	if (!valid || count == 0) {
+		return;
+	}
+
+	if (regex) {
+		pattern.Scan(text);
+		for (size_t at = pattern.StartAfter(0); at != Regex::npos;) {
+			size_t length = pattern.Length(text, at);
+			out.emplace_back(at, length);
+			at = pattern.StartAfter(at + std::max<size_t>(length, 1));
+		}
+		return;
+	}
+
+	for (size_t at = First(text, 0); at != Searcher::npos;) {
+		out.emplace_back(at, searcher.Size());
+		at = at + searcher.Size() <= text.size()
+		       ? First(text, at + searcher.Size())
+		       : Searcher::npos;
+	}
+}
+
+bool
+Search::Next(const TextBuffer& rows,
+             size_t&           line,
+             size_t&           column,
+             int               direction) const
+{
+	if (!valid || count == 0 || lines != rows.LineCount()) {
+		return false;
+	}
+
+	if (direction >= 0) {
+		// The rest of the current line first
+		size_t from = direction > 0 ? column + 1 : column;
+		if (Test(line)) {
+			std::string_view text = rows.Line(line);
+			if (from <= text.size()) {
+				size_t hit = First(text, from);
+				if (hit != Searcher::npos) {
+					column = hit;
+					return true;
+				}
+			}
+		}
+
+		size_t found = NextSet(line + 1);
+		if (found == Searcher::npos) {
+			found = NextSet(0);
+		}
+
+		line = found;
+		column = First(rows.Line(found), 0);
+		return true;
+	}
+
+	if (Test(line)) {
+		size_t hit = Last(rows.Line(line), column);
+		if (hit != Searcher::npos) {
+			column = hit;
+			return true;
+		}
+	}
+
+	size_t found = line > 0 ? PreviousSet(line - 1) : Searcher::npos;
+	if (found == Searcher::npos) {
+		found = PreviousSet(lines - 1);
+	}
+
+	line = found;
+	column = Last(rows.Line(found), Searcher::npos);
+	return true;
+}
@@ -0,0 +1,134 @@
+#include <cstdint> // uint32_t
+#include <cstring> // memchr, memcmp, memmem
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KJ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "Searcher.hpp"
+
+namespace {
+
+using FindFunction = size_t (*)(const char*, size_t, const char*, size_t);
+
+size_t
+FindScalar(const char* data, size_t size, const char* needle, size_t length)
+{
+#if defined(__GLIBC__)
+	const void* found = memmem(data, size, needle, length);
+	return found != nullptr ? static_cast<const char*>(found) - data
+	                        : Searcher::npos;
+#else
+	return std::string_view(data, size).find(std::string_view(needle, length));
+#endif
+}
+
+#if defined(KJ_X86_SIMD)
+__attribute__((target("sse2"))) size_t
+FindSse2(const char* data, size_t size, const char* needle, size_t length)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[length - 1]);
+
+	size_t i = 0;
+	for (; i + length - 1 + 16 <= size; i += 16) {
+		__m128i blockFirst =
+		  _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		__m128i blockLast =
+		  _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + length - 1));
+
+		auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+		  _mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+
+		while (mask != 0) {
+			size_t at = i + __builtin_ctz(mask);
+			if (memcmp(data + at + 1, needle + 1, length - 2) == 0) {
+				return at;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	size_t rest = FindScalar(data + i, size - i, needle, length);
+	return rest != Searcher::npos ? i + rest : rest;
+}
+
+__attribute__((target("avx2"))) size_t
+FindAvx2(const char* data, size_t size, const char* needle, size_t length)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+
+	size_t i = 0;
+	for (; i + length - 1 + 32 <= size; i += 32) {
+		__m256i blockFirst =
+		  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i blockLast = _mm256_loadu_si256(
+		  reinterpret_cast<const __m256i*>(data + i + length - 1));
+
+		__m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+		                                _mm256_cmpeq_epi8(last, blockLast));
+		auto    mask = static_cast<uint32_t>(_mm256_movemask_epi8(both));
+
+		while (mask != 0) {
+			size_t at = i + __builtin_ctz(mask);
+			if (memcmp(data + at + 1, needle + 1, length - 2) == 0) {
+				return at;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	size_t rest = FindSse2(data + i, size - i, needle, length);
+	return rest != Searcher::npos ? i + rest : rest;
+}
+#endif
+
+FindFunction
+SelectFinder(const char** name)
+{
+#if defined(KJ_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return FindAvx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		return FindSse2;
+	}
+#endif
+	*name = "scalar";
+	return FindScalar;
+}
+
+const char*  finderName{ nullptr };
+FindFunction finder = SelectFinder(&finderName);
+
+}
+
+const char*
+Searcher::Implementation()
+{
+	return finderName;
+}
+
+size_t
+Searcher::Find(const char* data, size_t size) const
+{
+	size_t length = needle.size();
+
+	if (length == 0) {
+		return 0;
+	}
+	if (length > size) {
+		return npos;
+	}
+	if (length == 1) {
+		const void* found = memchr(data, needle[0], size);
+		return found != nullptr ? static_cast<const char*>(found) - data : npos;
+	}
+
+	return finder(data, size, needle.data(), length);
+}
@@ -0,0 +1,289 @@
+#include <algorithm> // find_if, max, min, upper_bound
+#include <cerrno>    // for EINTR, errno
+#include <utility>   // move
+
+#if defined(__linux__)
+#include <fcntl.h>  // for open, posix_fadvise, O_RDONLY
+#include <unistd.h> // for close, pread
+#endif
+
+#include "LineIndexer.hpp"
+#include "SparseLineIndex.hpp"
+#include "WindowPager.hpp"
+
+namespace {
+// Bytes read per step of the scan
+constexpr size_t scanBuffer{ 1 << 20 };
+// Bytes scanned between two publications of the progress
+constexpr size_t publishEvery{ 64 << 20 };
+// Bytes looked at per step when finding the lines of a block
+constexpr size_t blockScanStep{ 64 * 1024 };
+}
+
+SparseLineIndex::~SparseLineIndex()
+{
+	Stop();
+}
+
+int
+SparseLineIndex::Start(const char*           filename,
+                       size_t                size,
+                       size_t                every,
+                       std::function<void()> onProgress)
+{
+	Stop();
+
+	interval = std::max<size_t>(every, 1);
+
+#if defined(__linux__)
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	cancelled = false;
+	adopted = Scan{};
+	published = Scan{};
+	scanner = std::thread([this, fd, size, onProgress = std::move(onProgress)]() {
+		Run(fd, size, onProgress);
+	});
+	return 0;
+#else
+	(void)filename;
+	(void)size;
+	(void)onProgress;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void
+SparseLineIndex::Stop()
+{
+	if (scanner.joinable()) {
+		cancelled = true;
+		scanner.join();
+	}
+
+	// Nothing is being scanned, so there is nothing to wait for
+	adopted = Scan{};
+	adopted.done = true;
+	published = adopted;
+
+	for (Block& block : blocks) {
+		block.number = SIZE_MAX;
+		block.starts.clear();
+	}
+}
+
+// Scans the file on the scanning thread. Checkpoints found since the last
+// publication are kept in `scan` and handed over in one go.
+void
+SparseLineIndex::Run(int fd, size_t size, std::function<void()> onProgress)
+{
+#if defined(__linux__)
+	std::vector<char>   buffer(scanBuffer);
+	std::vector<size_t> found{};
+	Scan                scan{};
+
+	if (size > 0) {
+		scan.checkpoints.push_back(0);
+	}
+
+	auto publish = [this, &scan, &onProgress]() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			published.checkpoints.insert(published.checkpoints.end(),
+			                             scan.checkpoints.begin(),
+			                             scan.checkpoints.end());
+			published.lines = scan.lines;
+			published.bytes = scan.bytes;
+			published.crlfLines = scan.crlfLines;
+			published.longestLine = scan.longestLine;
+			published.done = scan.done;
+		}
+		scan.checkpoints.clear();
+
+		progress.notify_all();
+		if (onProgress) {
+			onProgress();
+		}
+	};
+
+	size_t offset = 0;
+	size_t lastPublished = 0;
+	char   previous = '\n';
+
+	while (offset < size && !cancelled) {
+		ssize_t count =
+		  pread(fd, buffer.data(), std::min(buffer.size(), size - offset), offset);
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			break; // the file got shorter, or cannot be read any further
+		}
+
+		found.clear();
+		LineIndexer::FindNewlines(buffer.data(), 0, count, found);
+
+		for (size_t at : found) {
+			size_t newline = offset + at;
+
+			if ((at > 0 ? buffer[at - 1] : previous) == '\r') {
+				scan.crlfLines++;
+			}
+			scan.longestLine = std::max(scan.longestLine, newline - scan.bytes);
+
+			scan.lines++;
+			scan.bytes = newline + 1;
+			if (scan.lines % interval == 0 && scan.bytes < size) {
+				scan.checkpoints.push_back(scan.bytes);
+			}
+		}
+
+		previous = buffer[count - 1];
+		offset += count;
+
+		// The first block right away, so the first screen can be shown
+		if (lastPublished == 0 || offset - lastPublished >= publishEvery) {
+			lastPublished = offset;
+			publish();
+		}
+	}
+
+	close(fd);
+
+	// A last line without a newline, if the whole file was read
+	if (offset == size && scan.bytes < size) {
+		scan.longestLine = std::max(scan.longestLine, size - scan.bytes);
+		scan.lines++;
+		scan.bytes = size;
+	}
+
+	scan.done = true;
+	publish();
+#else
+	(void)fd;
+	(void)size;
+	(void)onProgress;
+#endif
+}
+
+bool
+SparseLineIndex::Poll()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (published.lines == adopted.lines && published.done == adopted.done) {
+		return false;
+	}
+
+	adopted.checkpoints.insert(
+	  adopted.checkpoints.end(),
+	  published.checkpoints.begin() +
+	    static_cast<std::ptrdiff_t>(adopted.checkpoints.size()),
+	  published.checkpoints.end());
+
+	bool more = published.lines > adopted.lines;
+
+	adopted.lines = published.lines;
+	adopted.bytes = published.bytes;
+	adopted.crlfLines = published.crlfLines;
+	adopted.longestLine = published.longestLine;
+	adopted.done = published.done;
+
+	return more;
+}
+
+void
+SparseLineIndex::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	progress.wait(lock, [this]() {
+		return published.lines > adopted.lines || published.done;
+	});
+}
+
+// The line starts between checkpoint `number` and the next one, as far as
+// the file is indexed
+const SparseLineIndex::Block&
+SparseLineIndex::BlockOf(const char*  data,
+                         WindowPager* pager,
+                         size_t       number) const
+{
+	size_t count = std::min(interval, adopted.lines - number * interval);
+
+	auto cached = std::find_if(
+	  blocks.begin(), blocks.end(), [number, count](const Block& block) {
+		  return block.number == number && block.starts.size() >= count;
+	  });
+	if (cached != blocks.end()) {
+		return *cached;
+	}
+
+	Block& block = blocks[nextBlock];
+	nextBlock = (nextBlock + 1) % blocks.size();
+
+	block.number = number;
+	block.starts.clear();
+	block.starts.push_back(adopted.checkpoints[number]);
+
+	size_t from = block.starts.front();
+	while (block.starts.size() < count && from < adopted.bytes) {
+		size_t end = std::min(adopted.bytes, from + blockScanStep);
+
+		if (pager != nullptr) {
+			pager->Touch(from, end - from);
+		}
+
+		newlines.clear();
+		LineIndexer::FindNewlines(data, from, end, newlines);
+		for (size_t newline : newlines) {
+			if (block.starts.size() == count) {
+				break;
+			}
+			block.starts.push_back(newline + 1);
+		}
+		from = end;
+	}
+
+	return block;
+}
+
+size_t
+SparseLineIndex::LineStart(const char*  data,
+                           WindowPager* pager,
+                           size_t       index) const
+{
+	if (index >= adopted.lines) {
+		return adopted.bytes;
+	}
+
+	const Block& block = BlockOf(data, pager, index / interval);
+	return block.starts[index % interval];
+}
+
+size_t
+SparseLineIndex::LineAt(const char*  data,
+                        WindowPager* pager,
+                        size_t       offset) const
+{
+	if (adopted.lines == 0) {
+		return 0;
+	}
+
+	auto after = std::upper_bound(
+	  adopted.checkpoints.begin(), adopted.checkpoints.end(), offset);
+	size_t number = static_cast<size_t>(after - adopted.checkpoints.begin()) - 1;
+
+	const Block& block = BlockOf(data, pager, number);
+	auto         within =
+	  std::upper_bound(block.starts.begin(), block.starts.end(), offset);
+
+	return number * interval +
+	       static_cast<size_t>(within - block.starts.begin()) - 1;
+}
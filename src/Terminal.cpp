@@ -1,15 +1,22 @@
 #include <array>
+#include <charconv> // to_chars
 #include <cstdio>  // sscanf
-#include <cerrno>  // for EAGAIN, errno
 #include <cstdlib> // for atexit
 
 #if defined(__linux__) || defined(__ANDROID__)
 #include <unistd.h>    // for read, write, STDIN_FILENO, ...
+#include <poll.h>      // for poll, pollfd, POLLIN
 #include <sys/ioctl.h> // for winsize, ioctl, TIOCGWINSZ
 #endif
 
 #include "Terminal.hpp"
 #include "constants.hpp"
+#include "Instrumentation.hpp"
+
+namespace {
+// Milliseconds a terminal gets to answer a cursor position request
+constexpr int cursorReportTimeout{ 1000 };
+}
 
 Terminal::Terminal()
 {
@@ -80,20 +87,24 @@ Terminal::SetMode(TerminalMode newMode)
 			currentFlags.c_oflag &= ~(OPOST);
 			currentFlags.c_cflag |= (CS8);
 			currentFlags.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-			// set the minimum number of bytes of input needed before read() can
-			// return setting to 0 means, that read() returns as soon as there is any
-			// input
+			// read() never blocks, the event loop waits for input instead and
+			// then reads everything that is there at once
 			currentFlags.c_cc[VMIN] = 0;
-			// set the maximum amount of time to wait before read() return to 100 ms
-			currentFlags.c_cc[VTIME] = 1;
+			currentFlags.c_cc[VTIME] = 0;
 
 			if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &currentFlags) == -1) {
 				throw("tcsetattr: Could not set the raw terminal mode.");
 			}
 #endif
+			Write(escapeSequences::enableBracketedPaste);
+			Write(escapeSequences::enableMouse);
 			isCookedModeRestoredProperly = false;
 			break;
 		case TerminalMode::Cbreak:
+			if (currentMode == TerminalMode::Raw) {
+				Write(escapeSequences::disableMouse);
+				Write(escapeSequences::disableBracketedPaste);
+			}
 #if defined(_WIN32)
 #else
 			// TODO
@@ -105,6 +116,10 @@ Terminal::SetMode(TerminalMode newMode)
 			break;
 		case TerminalMode::Cooked:
 			// Return to the original mode
+			if (currentMode == TerminalMode::Raw) {
+				Write(escapeSequences::disableMouse);
+				Write(escapeSequences::disableBracketedPaste);
+			}
 #if defined(_WIN32)
 #else
 			if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &initFlags) == -1) {
@@ -172,11 +187,18 @@ Terminal::GetCursorPosition()
 	}
 
 	while (true) {
+#if defined(__linux__)
+		// read() returns at once in raw mode, give the terminal time to answer
+		pollfd input{ STDIN_FILENO, POLLIN, 0 };
+		if (poll(&input, 1, cursorReportTimeout) != 1) {
+			break;
+		}
+#endif
 		if (read(STDIN_FILENO, &tmp, 1) != 1) {
 			break;
 		}
 
-		buf.append(&tmp);
+		buf.push_back(tmp);
 
 		if (buf.back() == 'R') {
 			break;
@@ -199,6 +221,9 @@ Terminal::ForceCookedMode()
 	// In case of an improperly closed program force the pre-configured cooked
 	// mode:
 	if (!isCookedModeRestoredProperly) {
+		Write(escapeSequences::disableMouse);
+		Write(escapeSequences::disableBracketedPaste);
+
 		// TODO: Compare the default values of the most popular emulators.
 
 #if defined(__linux__)
@@ -226,101 +251,44 @@ Terminal::ForceCookedMode()
 std::string
 Terminal::SetCursorPositionEscapeSequence(unsigned int row, unsigned int column)
 {
-	return std::string("\x1b[" + std::to_string(row) + ";" +
-	                   std::to_string(column) + "H");
+	std::string sequence{};
+	SetCursorPositionEscapeSequence(sequence, row, column);
+	return sequence;
+}
+
+// Appends the sequence to `out`, formatting the numbers in place so that no
+// temporary strings are allocated.
+void
+Terminal::SetCursorPositionEscapeSequence(std::string& out,
+                                          unsigned int row,
+                                          unsigned int column)
+{
+	// An unsigned int has at most 10 digits
+	std::array<char, 32> sequence{ '\x1b', '[' };
+
+	char* at = std::to_chars(sequence.data() + 2, sequence.data() + 12, row).ptr;
+	*at++ = ';';
+	at = std::to_chars(at, at + 10, column).ptr;
+	*at++ = 'H';
+
+	out.append(sequence.data(), at - sequence.data());
 }
 
 void
 Terminal::Write(const std::string& content)
 {
-	write(STDOUT_FILENO, content.c_str(), content.length());
+	Write(content.c_str(), content.length());
 }
 
 void
 Terminal::Write(const char* content, size_t length)
 {
 	write(STDOUT_FILENO, content, length);
+	Instrumentation::Wrote();
 }
 
 void
 Terminal::Write(const char* content)
 {
-	write(STDOUT_FILENO, content, std::char_traits<char>::length(content));
-}
-
-int
-Terminal::Read()
-{
-	int  nread;
-	char c;
-
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-		// in Cygwin, when read() times out it returns -1 with an errno
-		// of EAGAIN, instead of just returning 0
-		if (nread == -1 && errno != EAGAIN) {
-			// die("read");
-		}
-	}
-
-	if (c == '\x1b') {
-		std::array<char, 3> seq;
-
-		if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-			return '\x1b';
-		}
-
-		if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-			return '\x1b';
-		}
-
-		if (seq[0] == '[') {
-			if (seq[1] >= '0' && seq[1] <= '9') {
-				if (read(STDIN_FILENO, &seq[2], 1) != 1) {
-					return '\x1b';
-				}
-				if (seq[2] == '~') {
-					switch (seq[1]) {
-						case '1':
-							return Key::Home;
-						case '3':
-							return Key::Del;
-						case '4':
-							return Key::End;
-						case '5':
-							return Key::PageUp;
-						case '6':
-							return Key::PageDown;
-						case '7':
-							return Key::Home;
-						case '8':
-							return Key::End;
-					}
-				}
-			} else {
-				switch (seq[1]) {
-					case 'A':
-						return Key::ArrowUp;
-					case 'B':
-						return Key::ArrowDown;
-					case 'C':
-						return Key::ArrowRight;
-					case 'D':
-						return Key::ArrowLeft;
-					case 'H':
-						return Key::Home;
-					case 'F':
-						return Key::End;
-				}
-			}
-		} else if (seq[0] == 'O') {
-			switch (seq[1]) {
-				case 'H':
-					return Key::Home;
-				case 'F':
-					return Key::End;
-			}
-		}
-		return '\x1b';
-	}
-	return static_cast<int>(c);
+	Write(content, std::char_traits<char>::length(content));
 }
@@ -0,0 +1,833 @@
+#include <algorithm> // max, min, upper_bound
+#include <array>
+#include <cerrno> // for EINTR, errno
+#include <chrono>
+#include <cstring> // memchr
+#include <utility> // move
+
+#if defined(__linux__)
+#include <sys/uio.h> // for iovec, writev
+#include <unistd.h>  // for write
+#endif
+
+#include "constants.hpp"
+#include "TextBuffer.hpp"
+
+namespace {
+// Bytes looked at per step of the lazy scan
+constexpr size_t lazyScanBlock{ 64 * 1024 };
+// Asking for more lines than this waits for the background index instead
+constexpr size_t lazyScanLines{ 64 * 1024 };
+// Buffers handed to a single writev, IOV_MAX on Linux
+constexpr size_t writeBatch{ 1024 };
+}
+
+#if !defined(__linux__)
+struct iovec
+{
+	void*  iov_base;
+	size_t iov_len;
+};
+#endif
+
+// Gathers pointers to the buffers that make up a file and writes them with
+// as few system calls as possible, without copying them anywhere first.
+class VectorWriter
+{
+private:
+	std::array<iovec, writeBatch> vectors{};
+	size_t                        used{ 0 };
+	int                           fd{ -1 };
+
+public:
+	size_t written{ 0 };
+
+	explicit VectorWriter(int fd)
+	  : fd(fd)
+	{
+	}
+
+	int Add(const char* data, size_t length)
+	{
+		if (length == 0) {
+			return 0;
+		}
+		if (used == vectors.size() && Flush() == -1) {
+			return -1;
+		}
+
+		vectors[used++] = iovec{ const_cast<char*>(data), length };
+		return 0;
+	}
+
+	int Flush()
+	{
+		iovec* next = vectors.data();
+		size_t left = used;
+
+		used = 0;
+
+		while (left > 0) {
+#if defined(__linux__)
+			long count = writev(fd, next, static_cast<int>(left));
+#else
+			long count = write(fd, next->iov_base, next->iov_len);
+#endif
+			if (count == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+
+			written += count;
+
+			// Skip what went out, a short write can end inside a buffer
+			size_t done = count;
+			while (left > 0 && done >= next->iov_len) {
+				done -= next->iov_len;
+				next++;
+				left--;
+			}
+			if (left > 0) {
+				next->iov_base = static_cast<char*>(next->iov_base) + done;
+				next->iov_len -= done;
+			}
+		}
+
+		return 0;
+	}
+};
+
+TextBuffer::~TextBuffer()
+{
+	// Wait for the indexer before the mapping it reads goes away
+	Clear();
+}
+
+TextBuffer::NodeId
+TextBuffer::NewNode(Source   source,
+                    size_t   start,
+                    size_t   count,
+                    uint32_t priority)
+{
+	NodeId id{ nil };
+
+	if (!freeNodes.empty()) {
+		id = freeNodes.back();
+		freeNodes.pop_back();
+	} else {
+		id = static_cast<NodeId>(nodes.size());
+		nodes.emplace_back();
+	}
+
+	nodes[id] = Node{ start, count, count, priority, nil, nil, source };
+	return id;
+}
+
+TextBuffer::NodeId
+TextBuffer::NewNode(Source source, size_t start, size_t count)
+{
+	// xorshift32, the priorities only have to be well spread
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return NewNode(source, start, count, seed);
+}
+
+void
+TextBuffer::FreeTree(NodeId t)
+{
+	if (t == nil) {
+		return;
+	}
+
+	FreeTree(nodes[t].left);
+	FreeTree(nodes[t].right);
+	freeNodes.push_back(t);
+}
+
+void
+TextBuffer::Update(NodeId t)
+{
+	Node& n = nodes[t];
+	n.lines = nodes[n.left].lines + n.count + nodes[n.right].lines;
+}
+
+// Splits the tree `t` so that `l` holds its first `k` lines and `r` the rest.
+// A piece straddling the boundary is cut in two.
+void
+TextBuffer::Split(NodeId t, size_t k, NodeId& l, NodeId& r)
+{
+	if (t == nil) {
+		l = nil;
+		r = nil;
+		return;
+	}
+
+	size_t leftLines = nodes[nodes[t].left].lines;
+
+	if (k <= leftLines) {
+		NodeId subRight{ nil };
+		Split(nodes[t].left, k, l, subRight);
+		nodes[t].left = subRight;
+		Update(t);
+		r = t;
+	} else if (k >= leftLines + nodes[t].count) {
+		NodeId subLeft{ nil };
+		Split(nodes[t].right, k - leftLines - nodes[t].count, subLeft, r);
+		nodes[t].right = subLeft;
+		Update(t);
+		l = t;
+	} else {
+		size_t offset = k - leftLines;
+
+		// The tail keeps the priority of its parent, so the heap order still
+		// holds for the right subtree it adopts.
+		NodeId tail = NewNode(nodes[t].source,
+		                      nodes[t].start + offset,
+		                      nodes[t].count - offset,
+		                      nodes[t].priority);
+		nodes[tail].right = nodes[t].right;
+		Update(tail);
+
+		nodes[t].count = offset;
+		nodes[t].right = nil;
+		Update(t);
+
+		l = t;
+		r = tail;
+	}
+}
+
+TextBuffer::NodeId
+TextBuffer::Merge(NodeId l, NodeId r)
+{
+	if (l == nil) {
+		return r;
+	}
+	if (r == nil) {
+		return l;
+	}
+
+	if (nodes[l].priority > nodes[r].priority) {
+		nodes[l].right = Merge(nodes[l].right, r);
+		Update(l);
+		return l;
+	}
+
+	nodes[r].left = Merge(l, nodes[r].left);
+	Update(r);
+	return r;
+}
+
+// Adds a piece at the end of the document. Lines appended one after another
+// keep growing the same piece, so indexing a file or loading it line by line
+// builds a single node instead of one per line.
+void
+TextBuffer::Append(Source source, size_t start, size_t count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	NodeId last = root;
+	while (last != nil && nodes[last].right != nil) {
+		last = nodes[last].right;
+	}
+
+	if (last != nil && nodes[last].source == source &&
+	    nodes[last].start + nodes[last].count == start) {
+		nodes[last].count += count;
+		for (NodeId t = root; t != nil; t = nodes[t].right) {
+			nodes[t].lines += count;
+		}
+		return;
+	}
+
+	root = Merge(root, NewNode(source, start, count));
+}
+
+TextBuffer::Location
+TextBuffer::Locate(size_t at) const
+{
+	NodeId t = root;
+
+	while (t != nil) {
+		const Node& n = nodes[t];
+		size_t      leftLines = nodes[n.left].lines;
+
+		if (at < leftLines) {
+			t = n.left;
+		} else if (at < leftLines + n.count) {
+			return Location{ n.source, n.start + (at - leftLines) };
+		} else {
+			at -= leftLines + n.count;
+			t = n.right;
+		}
+	}
+
+	throw("TextBuffer: line index out of range.");
+}
+
+void
+TextBuffer::CollectPieces(NodeId t, size_t at, std::vector<Piece>& out) const
+{
+	if (t == nil) {
+		return;
+	}
+
+	const Node& n = nodes[t];
+	size_t      leftLines = nodes[n.left].lines;
+
+	CollectPieces(n.left, at, out);
+	out.push_back(Piece{
+	  at + leftLines, n.count, n.source == Source::Original, n.start });
+	CollectPieces(n.right, at + leftLines + n.count, out);
+}
+
+void
+TextBuffer::Pieces(std::vector<Piece>& out) const
+{
+	CollectPieces(root, 0, out);
+}
+
+size_t
+TextBuffer::OriginalOffset(size_t index) const
+{
+	if (paged) {
+		return sparse.LineStart(file.Data(), &pager, index);
+	}
+	return index < lineStarts.size() ? lineStarts[index] : indexedBytes;
+}
+
+size_t
+TextBuffer::OriginalLineAt(size_t offset) const
+{
+	if (paged) {
+		return sparse.LineAt(file.Data(), &pager, offset);
+	}
+
+	auto after = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+
+	return static_cast<size_t>(after - lineStarts.begin()) - 1;
+}
+
+size_t
+TextBuffer::OriginalRun(size_t at, size_t& index) const
+{
+	NodeId t = root;
+
+	while (t != nil) {
+		const Node& n = nodes[t];
+		size_t      leftLines = nodes[n.left].lines;
+
+		if (at < leftLines) {
+			t = n.left;
+		} else if (at < leftLines + n.count) {
+			if (n.source != Source::Original) {
+				return 0;
+			}
+			index = n.start + (at - leftLines);
+			return n.count - (at - leftLines);
+		} else {
+			at -= leftLines + n.count;
+			t = n.right;
+		}
+	}
+
+	return 0;
+}
+
+std::string_view
+TextBuffer::OriginalLine(size_t index) const
+{
+	size_t begin = OriginalOffset(index);
+	size_t end = OriginalOffset(index + 1);
+
+	if (paged) {
+		pager.Touch(begin, end - begin);
+	}
+
+	if (end > begin && file.Data()[end - 1] == '\n') {
+		end--;
+	}
+	if (lineEnding == LineEnding::CRLF && end > begin &&
+	    file.Data()[end - 1] == '\r') {
+		end--;
+	}
+
+	return std::string_view(file.Data() + begin, end - begin);
+}
+
+int
+TextBuffer::Load(const char* filename)
+{
+	Clear();
+
+	Codec format = compression::Detect(filename);
+	if (format != Codec::None) {
+		return LoadCompressed(filename, format);
+	}
+
+	if (file.Open(filename) == -1) {
+		return -1;
+	}
+
+	const char* base = file.Data();
+	size_t      size = file.Size();
+
+	// The first line break decides how the file is shown and saved. Paged
+	// files are only looked at for as far as the first window goes.
+	size_t probe =
+	  size > hugeThreshold ? std::min(size, kilojoule::defaults::pageWindow)
+	                       : size;
+	const void* newline = probe > 0 ? memchr(base, '\n', probe) : nullptr;
+	if (newline != nullptr && newline != base &&
+	    static_cast<const char*>(newline)[-1] == '\r') {
+		lineEnding = LineEnding::CRLF;
+	}
+
+	// Only the start of the file is shown until the scan has found more
+	if (size > hugeThreshold &&
+	    sparse.Start(filename,
+	                 size,
+	                 kilojoule::defaults::checkpointInterval,
+	                 onIndexed) == 0) {
+		paged = true;
+		pager.Attach(&file, kilojoule::defaults::pageWindow, pageBudget);
+
+		sparse.Wait();
+		Poll();
+	} else if (size > kilojoule::defaults::backgroundIndexThreshold) {
+		// The index is ready before onIndexed runs, so the callback is waited
+		// for on its own before whatever it uses can go away
+		auto notified = std::make_shared<std::promise<void>>();
+		indexNotified = notified->get_future();
+
+		pendingScanned = std::make_shared<std::atomic<size_t>>(0);
+		pendingIndex = LineIndexer::BuildAsync(
+		  base,
+		  size,
+		  [onIndexed = onIndexed, notified]() {
+			  if (onIndexed) {
+				  onIndexed();
+			  }
+			  notified->set_value();
+		  },
+		  pendingScanned);
+	} else {
+		Adopt(LineIndexer::Build(base, size));
+	}
+
+	return 0;
+}
+
+// Shows the first lines as soon as there are any, the rest comes in through
+// Poll.
+int
+TextBuffer::LoadCompressed(const char* filename, Codec format)
+{
+	if (stream.Start(filename,
+	                 format,
+	                 kilojoule::defaults::streamReserve,
+	                 onIndexed) == -1 ||
+	    file.Reserve(stream.Fd(), kilojoule::defaults::streamReserve) == -1) {
+		int error = errno;
+		stream.Stop();
+		errno = error;
+		return -1;
+	}
+
+	codec = format;
+	streaming = true;
+
+	stream.Wait(0);
+	PollStream();
+
+	const char* base = file.Data();
+	const void* newline =
+	  file.Size() > 0 ? memchr(base, '\n', file.Size()) : nullptr;
+	if (newline != nullptr && newline != base &&
+	    static_cast<const char*>(newline)[-1] == '\r') {
+		lineEnding = LineEnding::CRLF;
+	}
+
+	return 0;
+}
+
+// Indexes what was decompressed since the last call. Returns whether there
+// are more lines.
+bool
+TextBuffer::PollStream()
+{
+	// Whatever was written before it was done is in Bytes then
+	bool done = stream.Done();
+	file.Grow(stream.Bytes());
+
+	const char* base = file.Data();
+	size_t      size = file.Size();
+	size_t      first = lineStarts.size();
+
+	newlines.clear();
+	LineIndexer::FindNewlines(base, indexedBytes, size, newlines);
+
+	for (size_t newline : newlines) {
+		if (newline > indexedBytes && base[newline - 1] == '\r') {
+			crlfLines++;
+		}
+		longestLine = std::max(longestLine, newline - indexedBytes);
+
+		lineStarts.push_back(indexedBytes);
+		indexedBytes = newline + 1;
+	}
+
+	if (done) {
+		// A last line without a newline
+		if (indexedBytes < size) {
+			longestLine = std::max(longestLine, size - indexedBytes);
+			lineStarts.push_back(indexedBytes);
+			indexedBytes = size;
+		}
+
+		streamError = stream.Error();
+		streaming = false;
+		stream.Stop();
+	}
+
+	Append(Source::Original, first, lineStarts.size() - first);
+	return lineStarts.size() > first;
+}
+
+size_t
+TextBuffer::LoadProgress() const
+{
+	if (streaming) {
+		return stream.Progress();
+	}
+
+	size_t size = file.Size();
+	if (size == 0 || FullyIndexed()) {
+		return 100;
+	}
+
+	size_t done = IndexedBytes();
+	if (pendingScanned) {
+		done = std::max(done, pendingScanned->load());
+	}
+	return done * 100 / size;
+}
+
+// Replaces the lazily built prefix of the line index with the complete one.
+void
+TextBuffer::Adopt(LineIndex index)
+{
+	size_t first = lineStarts.size();
+
+	lineStarts = std::move(index.lineStarts);
+	indexedBytes = file.Size();
+	crlfLines = index.crlfLines;
+	longestLine = index.longestLine;
+
+	Append(Source::Original, first, lineStarts.size() - first);
+}
+
+// Adopts the background index if it is ready. Returns whether it did.
+bool
+TextBuffer::Poll()
+{
+	if (streaming) {
+		return PollStream();
+	}
+
+	if (paged) {
+		size_t first = sparse.Lines();
+		bool   more = sparse.Poll();
+
+		crlfLines = sparse.CrlfLines();
+		longestLine = sparse.LongestLine();
+		if (more) {
+			Append(Source::Original, first, sparse.Lines() - first);
+		}
+		return more;
+	}
+
+	if (!pendingIndex.valid() ||
+	    pendingIndex.wait_for(std::chrono::seconds(0)) !=
+	      std::future_status::ready) {
+		return false;
+	}
+
+	Adopt(pendingIndex.get());
+	return true;
+}
+
+// Indexes the original file until the document holds at least `count` lines
+// or the whole file is indexed.
+void
+TextBuffer::EnsureLines(size_t count)
+{
+	size_t have = LineCount();
+
+	if (have >= count || FullyIndexed()) {
+		return;
+	}
+
+	// Paged files are only scanned in the background
+	if (paged) {
+		while (LineCount() < count && !FullyIndexed()) {
+			sparse.Wait();
+			Poll();
+		}
+		return;
+	}
+
+	// Compressed ones as they are decompressed
+	if (streaming) {
+		while (LineCount() < count && streaming) {
+			stream.Wait(file.Size());
+			PollStream();
+		}
+		return;
+	}
+
+	if (pendingIndex.valid() && count - have > lazyScanLines) {
+		Adopt(pendingIndex.get());
+		return;
+	}
+
+	const char* base = file.Data();
+	size_t      size = file.Size();
+	size_t      first = lineStarts.size();
+
+	while (have + (lineStarts.size() - first) < count && indexedBytes < size) {
+		size_t end = std::min(size, indexedBytes + lazyScanBlock);
+
+		newlines.clear();
+		LineIndexer::FindNewlines(base, indexedBytes, end, newlines);
+
+		for (size_t newline : newlines) {
+			lineStarts.push_back(indexedBytes);
+			indexedBytes = newline + 1;
+		}
+
+		// A last line without a newline
+		if (end == size && indexedBytes < size) {
+			lineStarts.push_back(indexedBytes);
+			indexedBytes = size;
+		}
+	}
+
+	Append(Source::Original, first, lineStarts.size() - first);
+}
+
+std::string_view
+TextBuffer::Line(size_t at) const
+{
+	Location location = Locate(at);
+
+	if (location.source == Source::Original) {
+		return OriginalLine(location.index);
+	}
+	return store.Get(location.index);
+}
+
+uint64_t
+TextBuffer::Id(size_t at) const
+{
+	Location location = Locate(at);
+
+	return (static_cast<uint64_t>(location.index) << 1) |
+	       static_cast<uint64_t>(location.source);
+}
+
+// Returns the line for editing. A line still viewed from the original file is
+// copied into the store first and its piece is swapped for one pointing there.
+erow&
+TextBuffer::Row(size_t at)
+{
+	Location location = Locate(at);
+
+	if (location.source == Source::Added) {
+		return store.Edit(location.index);
+	}
+
+	size_t index = store.Add({});
+	erow&  row = store.Edit(index);
+	row.chars = OriginalLine(location.index);
+
+	NodeId l{ nil };
+	NodeId rest{ nil };
+	NodeId line{ nil };
+	NodeId r{ nil };
+
+	Split(root, at, l, rest);
+	Split(rest, 1, line, r);
+
+	nodes[line].source = Source::Added;
+	nodes[line].start = index;
+
+	root = Merge(Merge(l, line), r);
+
+	return row;
+}
+
+void
+TextBuffer::InsertLine(size_t at, std::string_view chars)
+{
+	// Whatever is not indexed yet goes after the new line
+	EnsureLines(at + 1);
+
+	if (at > LineCount()) {
+		return;
+	}
+	if (at == LineCount()) {
+		PushBack(chars);
+		return;
+	}
+
+	size_t index = store.Add(chars);
+
+	NodeId l{ nil };
+	NodeId r{ nil };
+	Split(root, at, l, r);
+	root = Merge(Merge(l, NewNode(Source::Added, index, 1)), r);
+}
+
+void
+TextBuffer::EraseLines(size_t at, size_t count)
+{
+	if (at >= LineCount()) {
+		return;
+	}
+	count = std::min(count, LineCount() - at);
+
+	NodeId l{ nil };
+	NodeId rest{ nil };
+	NodeId lines{ nil };
+	NodeId r{ nil };
+
+	Split(root, at, l, rest);
+	Split(rest, count, lines, r);
+	FreeTree(lines);
+
+	// The lines themselves are left behind, the piece table never reuses them.
+	root = Merge(l, r);
+}
+
+void
+TextBuffer::PushBack(std::string_view chars)
+{
+	EnsureLines(static_cast<size_t>(-1));
+
+	Append(Source::Added, store.Add(chars), 1);
+}
+
+void
+TextBuffer::Clear()
+{
+	if (pendingIndex.valid()) {
+		pendingIndex.wait();
+		pendingIndex = std::future<LineIndex>{};
+	}
+	if (indexNotified.valid()) {
+		indexNotified.wait();
+		indexNotified = std::future<void>{};
+	}
+	pendingScanned.reset();
+
+	sparse.Stop();
+	pager.Detach();
+	paged = false;
+
+	stream.Stop();
+	codec = Codec::None;
+	streaming = false;
+	streamError = 0;
+
+	file.Close();
+	lineStarts.clear();
+	indexedBytes = 0;
+	lineEnding = LineEnding::LF;
+	crlfLines = 0;
+	longestLine = 0;
+
+	store.Clear();
+	nodes.resize(1);
+	freeNodes.clear();
+	root = nil;
+}
+
+TextBuffer::Memory
+TextBuffer::MemoryUsage() const
+{
+	Memory memory{};
+
+	memory.indexBytes =
+	  (lineStarts.capacity() + newlines.capacity()) * sizeof(size_t);
+	memory.pieceBytes =
+	  nodes.capacity() * sizeof(Node) + freeNodes.capacity() * sizeof(NodeId);
+	memory.store = store.Measure();
+	return memory;
+}
+
+// Writes the pieces of the subtree `t` in document order. Runs of original
+// lines are written straight from the mapping, line breaks included.
+int
+TextBuffer::WritePieces(NodeId t, VectorWriter& out) const
+{
+	if (t == nil) {
+		return 0;
+	}
+
+	const Node& n = nodes[t];
+	const char* ending = lineEnding == LineEnding::CRLF ? "\r\n" : "\n";
+	size_t      endingLength = lineEnding == LineEnding::CRLF ? 2 : 1;
+
+	if (WritePieces(n.left, out) == -1) {
+		return -1;
+	}
+
+	if (n.source == Source::Original) {
+		size_t begin = OriginalOffset(n.start);
+		size_t end = OriginalOffset(n.start + n.count);
+
+		if (out.Add(file.Data() + begin, end - begin) == -1) {
+			return -1;
+		}
+		// The last line of the file may lack a line break
+		if (file.Data()[end - 1] != '\n' &&
+		    out.Add(ending, endingLength) == -1) {
+			return -1;
+		}
+	} else {
+		for (size_t i = n.start; i < n.start + n.count; i++) {
+			std::string_view line = store.Get(i);
+
+			if (out.Add(line.data(), line.size()) == -1 ||
+			    out.Add(ending, endingLength) == -1) {
+				return -1;
+			}
+		}
+	}
+
+	return WritePieces(n.right, out);
+}
+
+int
+TextBuffer::Write(int fd, size_t& written)
+{
+	// Lines that were never looked at are part of the document too
+	EnsureLines(static_cast<size_t>(-1));
+
+	VectorWriter out{ fd };
+
+	int result = WritePieces(root, out);
+	if (result == 0) {
+		result = out.Flush();
+	}
+
+	written = out.written;
+	return result;
+}
@@ -0,0 +1,56 @@
+#include <algorithm> // max
+#include <utility>   // move
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	threadCount = std::max<size_t>(threadCount, 1);
+
+	for (size_t i = 0; i < threadCount; i++) {
+		workers.emplace_back(&ThreadPool::Work, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	available.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool&
+ThreadPool::Shared()
+{
+	static ThreadPool pool{ std::thread::hardware_concurrency() };
+	return pool;
+}
+
+void
+ThreadPool::Work()
+{
+	while (true) {
+		std::function<void()> task{};
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			// Drain the queue before leaving, somebody may wait on it
+			if (tasks.empty()) {
+				return;
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
@@ -0,0 +1,214 @@
+#include <algorithm> // max
+#include <cstring>   // memcpy
+
+#include "UndoLog.hpp"
+
+namespace {
+
+// Typed text and small edits share blocks of this size, a larger span gets
+// a block of its own
+constexpr size_t blockSize{ 64 << 10 };
+
+}
+
+void
+UndoLog::Clear()
+{
+	operations.clear();
+	blocks.clear();
+	firstBlock = 0;
+	dropped = 0;
+	position = 0;
+	saved = 0;
+	memory = 0;
+}
+
+void
+UndoLog::SetLimit(size_t bytes)
+{
+	limit = bytes;
+	Evict();
+}
+
+void
+UndoLog::Store(std::string_view text, Operation& operation)
+{
+	if (blocks.empty() ||
+	    blocks.back().capacity - blocks.back().used < text.size()) {
+		Block block{};
+		block.capacity = std::max(blockSize, text.size());
+		block.data = std::make_unique<char[]>(block.capacity);
+
+		memory += block.capacity;
+		blocks.push_back(std::move(block));
+	}
+
+	Block& block = blocks.back();
+
+	operation.block = firstBlock + blocks.size() - 1;
+	operation.offset = block.used;
+	operation.length = text.size();
+
+	if (!text.empty()) {
+		memcpy(block.data.get() + block.used, text.data(), text.size());
+	}
+	block.used += text.size();
+}
+
+// Drops the operations that were undone, and the text only they used
+void
+UndoLog::Truncate()
+{
+	if (position == operations.size()) {
+		return;
+	}
+
+	if (saved > dropped + position) {
+		saved = unreachable;
+	}
+
+	operations.resize(position);
+
+	if (operations.empty()) {
+		memory = 0;
+		firstBlock += blocks.size();
+		blocks.clear();
+		return;
+	}
+
+	const Operation& last = operations.back();
+	while (firstBlock + blocks.size() - 1 > last.block) {
+		memory -= blocks.back().capacity;
+		blocks.pop_back();
+	}
+	blocks.back().used = last.offset + last.length;
+}
+
+// Frees the blocks before the one the oldest operation uses
+void
+UndoLog::FreeBlocks()
+{
+	size_t oldest =
+	  operations.empty() ? firstBlock + blocks.size() : operations.front().block;
+
+	while (!blocks.empty() && firstBlock < oldest) {
+		memory -= blocks.front().capacity;
+		blocks.pop_front();
+		firstBlock++;
+	}
+}
+
+// Drops the oldest operations while over the limit, a whole group at a time
+void
+UndoLog::Evict()
+{
+	while (Memory() > limit && position > 0) {
+		size_t group = 1;
+		while (group < position && operations[group].withPrevious) {
+			group++;
+		}
+		if (group == position) {
+			break; // the latest edit stays
+		}
+
+		operations.erase(operations.begin(), operations.begin() + group);
+		position -= group;
+		dropped += group;
+
+		FreeBlocks();
+	}
+}
+
+void
+UndoLog::Record(Operation operation, std::string_view text)
+{
+	Truncate();
+
+	if (!operations.empty()) {
+		operations.back().open = false;
+	}
+
+	Store(text, operation);
+
+	operations.push_back(operation);
+	position++;
+
+	Evict();
+}
+
+bool
+UndoLog::Extend(size_t row, size_t column, char c)
+{
+	if (position != operations.size() || operations.empty()) {
+		return false;
+	}
+
+	Operation& last = operations.back();
+	if (!last.open || last.endRow != row || last.endColumn != column) {
+		return false;
+	}
+
+	// Only while the text is at the end of the last block and there is room
+	Block& block = blocks.back();
+	if (last.block != firstBlock + blocks.size() - 1 ||
+	    last.offset + last.length != block.used || block.used == block.capacity) {
+		return false;
+	}
+
+	block.data[block.used++] = c;
+	last.length++;
+	last.endColumn++;
+
+	return true;
+}
+
+void
+UndoLog::Seal()
+{
+	if (!operations.empty()) {
+		operations.back().open = false;
+	}
+}
+
+const UndoLog::Operation*
+UndoLog::Undo()
+{
+	if (position == 0) {
+		return nullptr;
+	}
+
+	Seal();
+	return &operations[--position];
+}
+
+const UndoLog::Operation*
+UndoLog::Redo(bool grouped)
+{
+	if (position == operations.size() ||
+	    (grouped && !operations[position].withPrevious)) {
+		return nullptr;
+	}
+
+	return &operations[position++];
+}
+
+std::string_view
+UndoLog::Text(const Operation& operation) const
+{
+	if (operation.length == 0) {
+		return {};
+	}
+
+	const Block& block = blocks[operation.block - firstBlock];
+
+	return std::string_view(block.data.get() + operation.offset,
+	                        operation.length);
+}
+
+void
+UndoLog::MarkSaved()
+{
+	// Typing on would move the saved state into the middle of an operation
+	Seal();
+	saved = dropped + position;
+}
@@ -0,0 +1,479 @@
+#include <algorithm> // upper_bound
+#include <array>
+#include <cstdint> // uint8_t, uint16_t, uint32_t
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KJ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "Utf8.hpp"
+
+namespace {
+
+struct Range
+{
+	char32_t first;
+	char32_t last;
+};
+
+// Generated from the Unicode 14.0 character database. Zero width are the
+// categories Mn, Me and Cf (but the soft hyphen and the prepended
+// concatenation marks), Hangul medial and final jamo and U+200B. Double width
+// are East Asian Wide and Fullwidth, with unassigned code points between two
+// such ranges merged into them, the planes of ideographs, and the circled
+// numbers and hexagrams glibc counts as wide. Zero width takes precedence.
+constexpr Range zeroWidth[]{
+	{ 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+	{ 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 },
+	{ 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x061C, 0x061C },
+	{ 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC },
+	{ 0x06DF, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED },
+	{ 0x0711, 0x0711 }, { 0x0730, 0x074A }, { 0x07A6, 0x07B0 },
+	{ 0x07EB, 0x07F3 }, { 0x07FD, 0x07FD }, { 0x0816, 0x0819 },
+	{ 0x081B, 0x0823 }, { 0x0825, 0x0827 }, { 0x0829, 0x082D },
+	{ 0x0859, 0x085B }, { 0x0898, 0x089F }, { 0x08CA, 0x08E1 },
+	{ 0x08E3, 0x0902 }, { 0x093A, 0x093A }, { 0x093C, 0x093C },
+	{ 0x0941, 0x0948 }, { 0x094D, 0x094D }, { 0x0951, 0x0957 },
+	{ 0x0962, 0x0963 }, { 0x0981, 0x0981 }, { 0x09BC, 0x09BC },
+	{ 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 },
+	{ 0x09FE, 0x0A02 }, { 0x0A3C, 0x0A3C }, { 0x0A41, 0x0A51 },
+	{ 0x0A70, 0x0A71 }, { 0x0A75, 0x0A75 }, { 0x0A81, 0x0A82 },
+	{ 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC8 }, { 0x0ACD, 0x0ACD },
+	{ 0x0AE2, 0x0AE3 }, { 0x0AFA, 0x0B01 }, { 0x0B3C, 0x0B3C },
+	{ 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B44 }, { 0x0B4D, 0x0B56 },
+	{ 0x0B62, 0x0B63 }, { 0x0B82, 0x0B82 }, { 0x0BC0, 0x0BC0 },
+	{ 0x0BCD, 0x0BCD }, { 0x0C00, 0x0C00 }, { 0x0C04, 0x0C04 },
+	{ 0x0C3C, 0x0C3C }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C56 },
+	{ 0x0C62, 0x0C63 }, { 0x0C81, 0x0C81 }, { 0x0CBC, 0x0CBC },
+	{ 0x0CBF, 0x0CBF }, { 0x0CC6, 0x0CC6 }, { 0x0CCC, 0x0CCD },
+	{ 0x0CE2, 0x0CE3 }, { 0x0D00, 0x0D01 }, { 0x0D3B, 0x0D3C },
+	{ 0x0D41, 0x0D44 }, { 0x0D4D, 0x0D4D }, { 0x0D62, 0x0D63 },
+	{ 0x0D81, 0x0D81 }, { 0x0DCA, 0x0DCA }, { 0x0DD2, 0x0DD6 },
+	{ 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
+	{ 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EBC }, { 0x0EC8, 0x0ECD },
+	{ 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 },
+	{ 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E }, { 0x0F80, 0x0F84 },
+	{ 0x0F86, 0x0F87 }, { 0x0F8D, 0x0FBC }, { 0x0FC6, 0x0FC6 },
+	{ 0x102D, 0x1030 }, { 0x1032, 0x1037 }, { 0x1039, 0x103A },
+	{ 0x103D, 0x103E }, { 0x1058, 0x1059 }, { 0x105E, 0x1060 },
+	{ 0x1071, 0x1074 }, { 0x1082, 0x1082 }, { 0x1085, 0x1086 },
+	{ 0x108D, 0x108D }, { 0x109D, 0x109D }, { 0x1160, 0x11FF },
+	{ 0x135D, 0x135F }, { 0x1712, 0x1714 }, { 0x1732, 0x1733 },
+	{ 0x1752, 0x1753 }, { 0x1772, 0x1773 }, { 0x17B4, 0x17B5 },
+	{ 0x17B7, 0x17BD }, { 0x17C6, 0x17C6 }, { 0x17C9, 0x17D3 },
+	{ 0x17DD, 0x17DD }, { 0x180B, 0x180F }, { 0x1885, 0x1886 },
+	{ 0x18A9, 0x18A9 }, { 0x1920, 0x1922 }, { 0x1927, 0x1928 },
+	{ 0x1932, 0x1932 }, { 0x1939, 0x193B }, { 0x1A17, 0x1A18 },
+	{ 0x1A1B, 0x1A1B }, { 0x1A56, 0x1A56 }, { 0x1A58, 0x1A60 },
+	{ 0x1A62, 0x1A62 }, { 0x1A65, 0x1A6C }, { 0x1A73, 0x1A7F },
+	{ 0x1AB0, 0x1B03 }, { 0x1B34, 0x1B34 }, { 0x1B36, 0x1B3A },
+	{ 0x1B3C, 0x1B3C }, { 0x1B42, 0x1B42 }, { 0x1B6B, 0x1B73 },
+	{ 0x1B80, 0x1B81 }, { 0x1BA2, 0x1BA5 }, { 0x1BA8, 0x1BA9 },
+	{ 0x1BAB, 0x1BAD }, { 0x1BE6, 0x1BE6 }, { 0x1BE8, 0x1BE9 },
+	{ 0x1BED, 0x1BED }, { 0x1BEF, 0x1BF1 }, { 0x1C2C, 0x1C33 },
+	{ 0x1C36, 0x1C37 }, { 0x1CD0, 0x1CD2 }, { 0x1CD4, 0x1CE0 },
+	{ 0x1CE2, 0x1CE8 }, { 0x1CED, 0x1CED }, { 0x1CF4, 0x1CF4 },
+	{ 0x1CF8, 0x1CF9 }, { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F },
+	{ 0x202A, 0x202E }, { 0x2060, 0x206F }, { 0x20D0, 0x20F0 },
+	{ 0x2CEF, 0x2CF1 }, { 0x2D7F, 0x2D7F }, { 0x2DE0, 0x2DFF },
+	{ 0x302A, 0x302D }, { 0x3099, 0x309A }, { 0xA66F, 0xA672 },
+	{ 0xA674, 0xA67D }, { 0xA69E, 0xA69F }, { 0xA6F0, 0xA6F1 },
+	{ 0xA802, 0xA802 }, { 0xA806, 0xA806 }, { 0xA80B, 0xA80B },
+	{ 0xA825, 0xA826 }, { 0xA82C, 0xA82C }, { 0xA8C4, 0xA8C5 },
+	{ 0xA8E0, 0xA8F1 }, { 0xA8FF, 0xA8FF }, { 0xA926, 0xA92D },
+	{ 0xA947, 0xA951 }, { 0xA980, 0xA982 }, { 0xA9B3, 0xA9B3 },
+	{ 0xA9B6, 0xA9B9 }, { 0xA9BC, 0xA9BD }, { 0xA9E5, 0xA9E5 },
+	{ 0xAA29, 0xAA2E }, { 0xAA31, 0xAA32 }, { 0xAA35, 0xAA36 },
+	{ 0xAA43, 0xAA43 }, { 0xAA4C, 0xAA4C }, { 0xAA7C, 0xAA7C },
+	{ 0xAAB0, 0xAAB0 }, { 0xAAB2, 0xAAB4 }, { 0xAAB7, 0xAAB8 },
+	{ 0xAABE, 0xAABF }, { 0xAAC1, 0xAAC1 }, { 0xAAEC, 0xAAED },
+	{ 0xAAF6, 0xAAF6 }, { 0xABE5, 0xABE5 }, { 0xABE8, 0xABE8 },
+	{ 0xABED, 0xABED }, { 0xD7B0, 0xD7FF }, { 0xFB1E, 0xFB1E },
+	{ 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF },
+	{ 0xFFF9, 0xFFFB }, { 0x101FD, 0x101FD }, { 0x102E0, 0x102E0 },
+	{ 0x10376, 0x1037A }, { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F },
+	{ 0x10AE5, 0x10AE6 }, { 0x10D24, 0x10D27 }, { 0x10EAB, 0x10EAC },
+	{ 0x10F46, 0x10F50 }, { 0x10F82, 0x10F85 }, { 0x11001, 0x11001 },
+	{ 0x11038, 0x11046 }, { 0x11070, 0x11070 }, { 0x11073, 0x11074 },
+	{ 0x1107F, 0x11081 }, { 0x110B3, 0x110B6 }, { 0x110B9, 0x110BA },
+	{ 0x110C2, 0x110C2 }, { 0x11100, 0x11102 }, { 0x11127, 0x1112B },
+	{ 0x1112D, 0x11134 }, { 0x11173, 0x11173 }, { 0x11180, 0x11181 },
+	{ 0x111B6, 0x111BE }, { 0x111C9, 0x111CC }, { 0x111CF, 0x111CF },
+	{ 0x1122F, 0x11231 }, { 0x11234, 0x11234 }, { 0x11236, 0x11237 },
+	{ 0x1123E, 0x1123E }, { 0x112DF, 0x112DF }, { 0x112E3, 0x112EA },
+	{ 0x11300, 0x11301 }, { 0x1133B, 0x1133C }, { 0x11340, 0x11340 },
+	{ 0x11366, 0x11374 }, { 0x11438, 0x1143F }, { 0x11442, 0x11444 },
+	{ 0x11446, 0x11446 }, { 0x1145E, 0x1145E }, { 0x114B3, 0x114B8 },
+	{ 0x114BA, 0x114BA }, { 0x114BF, 0x114C0 }, { 0x114C2, 0x114C3 },
+	{ 0x115B2, 0x115B5 }, { 0x115BC, 0x115BD }, { 0x115BF, 0x115C0 },
+	{ 0x115DC, 0x115DD }, { 0x11633, 0x1163A }, { 0x1163D, 0x1163D },
+	{ 0x1163F, 0x11640 }, { 0x116AB, 0x116AB }, { 0x116AD, 0x116AD },
+	{ 0x116B0, 0x116B5 }, { 0x116B7, 0x116B7 }, { 0x1171D, 0x1171F },
+	{ 0x11722, 0x11725 }, { 0x11727, 0x1172B }, { 0x1182F, 0x11837 },
+	{ 0x11839, 0x1183A }, { 0x1193B, 0x1193C }, { 0x1193E, 0x1193E },
+	{ 0x11943, 0x11943 }, { 0x119D4, 0x119DB }, { 0x119E0, 0x119E0 },
+	{ 0x11A01, 0x11A0A }, { 0x11A33, 0x11A38 }, { 0x11A3B, 0x11A3E },
+	{ 0x11A47, 0x11A47 }, { 0x11A51, 0x11A56 }, { 0x11A59, 0x11A5B },
+	{ 0x11A8A, 0x11A96 }, { 0x11A98, 0x11A99 }, { 0x11C30, 0x11C3D },
+	{ 0x11C3F, 0x11C3F }, { 0x11C92, 0x11CA7 }, { 0x11CAA, 0x11CB0 },
+	{ 0x11CB2, 0x11CB3 }, { 0x11CB5, 0x11CB6 }, { 0x11D31, 0x11D45 },
+	{ 0x11D47, 0x11D47 }, { 0x11D90, 0x11D91 }, { 0x11D95, 0x11D95 },
+	{ 0x11D97, 0x11D97 }, { 0x11EF3, 0x11EF4 }, { 0x13430, 0x13438 },
+	{ 0x16AF0, 0x16AF4 }, { 0x16B30, 0x16B36 }, { 0x16F4F, 0x16F4F },
+	{ 0x16F8F, 0x16F92 }, { 0x16FE4, 0x16FE4 }, { 0x1BC9D, 0x1BC9E },
+	{ 0x1BCA0, 0x1CF46 }, { 0x1D167, 0x1D169 }, { 0x1D173, 0x1D182 },
+	{ 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD }, { 0x1D242, 0x1D244 },
+	{ 0x1DA00, 0x1DA36 }, { 0x1DA3B, 0x1DA6C }, { 0x1DA75, 0x1DA75 },
+	{ 0x1DA84, 0x1DA84 }, { 0x1DA9B, 0x1DAAF }, { 0x1E000, 0x1E02A },
+	{ 0x1E130, 0x1E136 }, { 0x1E2AE, 0x1E2AE }, { 0x1E2EC, 0x1E2EF },
+	{ 0x1E8D0, 0x1E8D6 }, { 0x1E944, 0x1E94A }, { 0xE0001, 0xE01EF },
+};
+
+constexpr Range doubleWidth[]{
+	{ 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+	{ 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 },
+	{ 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+	{ 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+	{ 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+	{ 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA },
+	{ 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA },
+	{ 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+	{ 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E },
+	{ 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+	{ 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C },
+	{ 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+	{ 0x3041, 0xA4C6 }, { 0xA960, 0xA97C }, { 0xAC00, 0xD7A3 },
+	{ 0xF900, 0xFAD9 }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6B },
+	{ 0xFF01, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x1B2FB },
+	{ 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E },
+	{ 0x1F191, 0x1F19A }, { 0x1F200, 0x1F320 }, { 0x1F32D, 0x1F335 },
+	{ 0x1F337, 0x1F37C }, { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA },
+	{ 0x1F3CF, 0x1F3D3 }, { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 },
+	{ 0x1F3F8, 0x1F43E }, { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC },
+	{ 0x1F4FF, 0x1F53D }, { 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 },
+	{ 0x1F57A, 0x1F57A }, { 0x1F595, 0x1F596 }, { 0x1F5A4, 0x1F5A4 },
+	{ 0x1F5FB, 0x1F64F }, { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC },
+	{ 0x1F6D0, 0x1F6D2 }, { 0x1F6D5, 0x1F6DF }, { 0x1F6EB, 0x1F6EC },
+	{ 0x1F6F4, 0x1F6FC }, { 0x1F7E0, 0x1F7F0 }, { 0x1F90C, 0x1F93A },
+	{ 0x1F93C, 0x1F945 }, { 0x1F947, 0x1F9FF }, { 0x1FA70, 0x1FAF6 },
+	{ 0x20000, 0x3FFFD },
+};
+
+// The table below covers the code points before this one, a two-bit width
+// for each, in blocks of 128 code points. Identical blocks are stored once.
+constexpr size_t tableEnd{ 0x20000 };
+constexpr size_t blockSize{ 128 };
+constexpr size_t blockCount{ tableEnd / blockSize };
+constexpr size_t blockBytes{ blockSize / 4 };
+
+using Widths = std::array<uint8_t, tableEnd / 4>;
+
+constexpr void
+Paint(Widths& widths, const Range* ranges, size_t count, uint8_t width)
+{
+	for (size_t i = 0; i < count; i++) {
+		for (char32_t c = ranges[i].first; c <= ranges[i].last && c < tableEnd;
+		     c++) {
+			uint8_t& byte = widths[c / 4];
+			int      shift = static_cast<int>(c % 4) * 2;
+
+			byte = static_cast<uint8_t>((byte & ~(3 << shift)) | width << shift);
+		}
+	}
+}
+
+constexpr Widths
+AllWidths()
+{
+	Widths widths{};
+	for (uint8_t& byte : widths) {
+		byte = 0x55; // width 1 everywhere
+	}
+
+	Paint(widths, doubleWidth, std::size(doubleWidth), 2);
+	Paint(widths, zeroWidth, std::size(zeroWidth), 0);
+	return widths;
+}
+
+constexpr Widths allWidths = AllWidths();
+
+constexpr bool
+SameBlock(size_t a, size_t b)
+{
+	for (size_t i = 0; i < blockBytes; i++) {
+		if (allWidths[a * blockBytes + i] != allWidths[b * blockBytes + i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Number of distinct blocks, or with `index` given, the distinct block each
+// block is, numbered in order of appearance
+constexpr size_t
+UniqueBlocks(std::array<uint8_t, blockCount>* index)
+{
+	std::array<uint16_t, blockCount> firsts{};
+	size_t                           count = 0;
+
+	for (size_t block = 0; block < blockCount; block++) {
+		size_t unique = 0;
+		while (unique < count && !SameBlock(firsts[unique], block)) {
+			unique++;
+		}
+		if (unique == count) {
+			firsts[count++] = static_cast<uint16_t>(block);
+		}
+		if (index != nullptr) {
+			(*index)[block] = static_cast<uint8_t>(unique);
+		}
+	}
+	return count;
+}
+
+constexpr size_t uniqueBlocks = UniqueBlocks(nullptr);
+static_assert(uniqueBlocks <= 256, "block numbers have to fit in a byte");
+
+struct WidthTable
+{
+	std::array<uint8_t, blockCount>                index{};
+	std::array<uint8_t, uniqueBlocks * blockBytes> blocks{};
+};
+
+constexpr WidthTable
+BuildTable()
+{
+	WidthTable table{};
+	UniqueBlocks(&table.index);
+
+	for (size_t block = 0; block < blockCount; block++) {
+		size_t to = table.index[block] * blockBytes;
+		for (size_t i = 0; i < blockBytes; i++) {
+			table.blocks[to + i] = allWidths[block * blockBytes + i];
+		}
+	}
+	return table;
+}
+
+constexpr WidthTable widthTable = BuildTable();
+
+template<size_t N>
+bool
+InRanges(const Range (&ranges)[N], char32_t codepoint)
+{
+	const Range* after = std::upper_bound(
+	  ranges, ranges + N, codepoint, [](char32_t codepoint, const Range& range) {
+		  return codepoint < range.first;
+	  });
+	return after != ranges && codepoint <= (after - 1)->last;
+}
+
+using SkipFunction = size_t (*)(const char*, size_t, size_t);
+
+size_t
+SkipScalar(const char* data, size_t from, size_t size)
+{
+	for (size_t i = from; i < size; i++) {
+		auto c = static_cast<unsigned char>(data[i]);
+		if (c == '\t' || c >= 0x80) {
+			return i;
+		}
+	}
+	return size;
+}
+
+#if defined(KJ_X86_SIMD)
+__attribute__((target("sse2"))) size_t
+SkipSse2(const char* data, size_t from, size_t size)
+{
+	const __m128i tab = _mm_set1_epi8('\t');
+
+	size_t i = from;
+	for (; i + 16 <= size; i += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+
+		// The top bit of a byte is set for everything not ASCII
+		auto mask = static_cast<uint32_t>(
+		  _mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, tab))));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return SkipScalar(data, i, size);
+}
+
+__attribute__((target("avx2"))) size_t
+SkipAvx2(const char* data, size_t from, size_t size)
+{
+	const __m256i tab = _mm256_set1_epi8('\t');
+
+	size_t i = from;
+	for (; i + 32 <= size; i += 32) {
+		__m256i block =
+		  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+
+		auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+		  _mm256_or_si256(block, _mm256_cmpeq_epi8(block, tab))));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return SkipSse2(data, i, size);
+}
+#endif
+
+SkipFunction
+SelectSkip(const char** name)
+{
+#if defined(KJ_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return SkipAvx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		*name = "sse2";
+		return SkipSse2;
+	}
+#endif
+	*name = "scalar";
+	return SkipScalar;
+}
+
+const char*  skipName{ nullptr };
+SkipFunction skip = SelectSkip(&skipName);
+
+}
+
+namespace utf8 {
+
+const char*
+Implementation()
+{
+	return skipName;
+}
+
+size_t
+SkipPlain(std::string_view text, size_t from)
+{
+	return skip(text.data(), from, text.size());
+}
+
+size_t
+Decode(std::string_view text, size_t at, char32_t& codepoint)
+{
+	auto lead = static_cast<unsigned char>(text[at]);
+
+	if (lead < 0x80) {
+		codepoint = lead;
+		return 1;
+	}
+
+	size_t   length = 0;
+	char32_t min = 0;
+	if (lead >= 0xc2 && lead <= 0xdf) {
+		length = 2;
+		min = 0x80;
+		codepoint = lead & 0x1f;
+	} else if (lead >= 0xe0 && lead <= 0xef) {
+		length = 3;
+		min = 0x800;
+		codepoint = lead & 0x0f;
+	} else if (lead >= 0xf0 && lead <= 0xf4) {
+		length = 4;
+		min = 0x10000;
+		codepoint = lead & 0x07;
+	} else {
+		codepoint = invalid;
+		return 1;
+	}
+
+	if (text.size() - at < length) {
+		codepoint = invalid;
+		return 1;
+	}
+	for (size_t i = 1; i < length; i++) {
+		if (!IsContinuation(text[at + i])) {
+			codepoint = invalid;
+			return 1;
+		}
+		auto c = static_cast<unsigned char>(text[at + i]);
+		codepoint = codepoint << 6 | (c & 0x3f);
+	}
+
+	if (codepoint < min || codepoint > 0x10ffff ||
+	    (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+		codepoint = invalid;
+		return 1;
+	}
+	return length;
+}
+
+int
+Width(char32_t codepoint)
+{
+	if (codepoint < 0x300 || codepoint == invalid) {
+		return 1;
+	}
+	if (codepoint < tableEnd) {
+		size_t  block = widthTable.index[codepoint / blockSize];
+		uint8_t byte =
+		  widthTable.blocks[block * blockBytes + codepoint % blockSize / 4];
+		return byte >> (codepoint % 4 * 2) & 3;
+	}
+
+	if (InRanges(zeroWidth, codepoint)) {
+		return 0;
+	}
+	return InRanges(doubleWidth, codepoint) ? 2 : 1;
+}
+
+size_t
+Next(std::string_view text, size_t at)
+{
+	if (at >= text.size()) {
+		return text.size();
+	}
+
+	char32_t codepoint = 0;
+	at += Decode(text, at, codepoint);
+
+	while (at < text.size() && static_cast<unsigned char>(text[at]) >= 0x80) {
+		size_t length = Decode(text, at, codepoint);
+		if (Width(codepoint) != 0 || codepoint == invalid) {
+			break;
+		}
+		at += length;
+	}
+	return at;
+}
+
+size_t
+Previous(std::string_view text, size_t at)
+{
+	at = std::min(at, text.size());
+
+	while (at > 0) {
+		// Back to the lead byte, if the bytes before `at` are a whole sequence
+		size_t   start = at - 1;
+		char32_t codepoint = 0;
+		while (start > 0 && at - start < 4 && IsContinuation(text[start])) {
+			start--;
+		}
+		if (Decode(text, start, codepoint) != at - start) {
+			start = at - 1;
+			codepoint = invalid;
+		}
+
+		at = start;
+		if (Width(codepoint) != 0 || codepoint == invalid) {
+			break;
+		}
+	}
+	return at;
+}
+
+}
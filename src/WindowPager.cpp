@@ -0,0 +1,76 @@
+#include <algorithm> // find, max, rotate
+
+#include "MappedFile.hpp"
+#include "WindowPager.hpp"
+
+void
+WindowPager::Attach(const MappedFile* mapped, size_t window, size_t budget)
+{
+	Detach();
+
+	file = mapped;
+	windowSize = window;
+	SetBudget(budget);
+}
+
+void
+WindowPager::Detach()
+{
+	file = nullptr;
+	resident.clear();
+}
+
+void
+WindowPager::SetBudget(size_t budget)
+{
+	// The window being read and the one ahead of it at the least
+	capacity = std::max<size_t>(2, windowSize > 0 ? budget / windowSize : 0);
+
+	while (file != nullptr && resident.size() > capacity) {
+		file->Advise(resident.back() * windowSize, windowSize, false);
+		resident.pop_back();
+	}
+}
+
+void
+WindowPager::Use(size_t window, bool ahead)
+{
+	auto found = std::find(resident.begin(), resident.end(), window);
+
+	if (found != resident.end()) {
+		// Read ahead windows do not count as used
+		if (!ahead) {
+			std::rotate(resident.begin(), found, found + 1);
+		}
+		return;
+	}
+
+	if (resident.size() == capacity) {
+		file->Advise(resident.back() * windowSize, windowSize, false);
+		resident.pop_back();
+	}
+
+	if (ahead) {
+		file->Advise(window * windowSize, windowSize, true);
+	}
+	resident.insert(resident.begin(), window);
+}
+
+void
+WindowPager::Touch(size_t offset, size_t length)
+{
+	if (file == nullptr || windowSize == 0 || offset >= file->Size()) {
+		return;
+	}
+
+	size_t first = offset / windowSize;
+	size_t last = (offset + std::max<size_t>(length, 1) - 1) / windowSize;
+
+	for (size_t window = first; window <= last; window++) {
+		Use(window, false);
+	}
+
+	if ((last + 1) * windowSize < file->Size()) {
+		Use(last + 1, true);
+	}
+}
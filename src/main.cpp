@@ -1,7 +1,11 @@
+#include <cstdio>  // perror
+#include <cstdlib> // getenv, atoi, strtoull
+#include <cstring> // strcmp
 #include <memory>
 
 #include "Terminal.hpp"
 #include "Editor.hpp"
+#include "Instrumentation.hpp"
 
 int
 main(int argc, char* argv[])
@@ -17,11 +21,34 @@ main(int argc, char* argv[])
 
 	editor.Init(std::make_shared<Terminal>(terminal));
 
-	editor.SetStatusMessage(
-	  "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+	// Same variable as curses, in milliseconds
+	if (const char* escapeDelay = std::getenv("ESCDELAY")) {
+		editor.SetEscapeTimeout(std::atoi(escapeDelay));
+	}
+	if (const char* undoLimit = std::getenv("KJ_UNDO_LIMIT")) {
+		editor.SetUndoLimit(std::strtoull(undoLimit, nullptr, 10) << 20);
+	}
+	if (const char* hugeFile = std::getenv("KJ_HUGE_FILE")) {
+		editor.SetHugeFileThreshold(std::strtoull(hugeFile, nullptr, 10) << 20);
+	}
+	if (const char* pageBudget = std::getenv("KJ_PAGE_BUDGET")) {
+		editor.SetPageBudget(std::strtoull(pageBudget, nullptr, 10) << 20);
+	}
+	// 0 saves compressed files as text
+	if (const char* recompress = std::getenv("KJ_RECOMPRESS")) {
+		editor.SetRecompress(std::strcmp(recompress, "0") != 0);
+	}
 
+	editor.SetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | "
+	                        "Ctrl-F = find | Ctrl-G = go to | Ctrl-Z = undo");
+
+	// kj [-f] file, -f following what is appended to it
+	bool follow = argc >= 3 && std::strcmp(argv[1], "-f") == 0;
 	if (argc >= 2) {
-		editor.Open(argv[1]);
+		editor.Open(argv[follow ? 2 : 1]);
+	}
+	if (follow) {
+		editor.Follow(true);
 	}
 
 	while (!editor.shouldClose) {
@@ -30,5 +57,12 @@ main(int argc, char* argv[])
 	}
 
 	terminal.SetMode(TerminalMode::Cooked);
+
+	// Only with KJ_INSTRUMENT, see Instrumentation
+	if (const char* statsFile = std::getenv("KJ_STATS_FILE")) {
+		if (Instrumentation::Dump(statsFile) == -1) {
+			std::perror(statsFile);
+		}
+	}
 	return 0;
 }